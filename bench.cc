@@ -0,0 +1,1333 @@
+#define PRTTY_MAIN
+#include "./prtty.hpp" // include first so as to not shadow errors with missing header files
+#include "./prtty-batch.hpp"
+#include "./prtty-capnames.hpp"
+#include "./prtty-color.hpp"
+#include "./prtty-database.hpp"
+#include "./prtty-eval.hpp"
+#include "./prtty-fanout.hpp"
+#include "./prtty-frame.hpp"
+#include "./prtty-input.hpp"
+#include "./prtty-recognizer.hpp"
+#include "./prtty-render.hpp"
+#include "./prtty-translate.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <malloc.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+
+/*
+	prtty_bench [terminfo dir] [filter]
+
+	runs every benchmark whose name contains `filter` (all of them
+	by default) against xterm-256color from `terminfo dir` (the
+	test fixtures, normally) and prints the results as JSON. the
+	replay benchmarks play back the recorded workloads in the
+	directory's replay/ subdirectory.
+*/
+
+using namespace std;
+
+typedef chrono::steady_clock bench_clock;
+
+// every allocation goes through here, so benchmarks can count them. kept out
+// of line so the compiler doesn't pair the malloc/free up with new/delete.
+static atomic<size_t> allocations(0);
+static atomic<size_t> liveBytes(0);
+
+__attribute__((noinline)) void * operator new(size_t size) {
+	void *p = malloc(size > 0 ? size : 1);
+	if (!p) {
+		throw bad_alloc();
+	}
+	allocations.fetch_add(1, memory_order_relaxed);
+	liveBytes.fetch_add(malloc_usable_size(p), memory_order_relaxed);
+	return p;
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept {
+	if (p) {
+		liveBytes.fetch_sub(malloc_usable_size(p), memory_order_relaxed);
+		free(p);
+	}
+}
+
+struct Result {
+	string name;
+	vector<pair<string, double>> fields;
+};
+
+static vector<Result> results;
+static const char *filter = "";
+
+// a group runs if the filter names it, or something within it (e.g. "eval.cup")
+static bool selected(const char *name) {
+	if (!strstr(name, filter) && !strstr(filter, name)) {
+		return false;
+	}
+	cerr << "running " << name << "..." << endl;
+	return true;
+}
+
+static void result(const string &name, initializer_list<pair<string, double>> fields) {
+	results.push_back(Result{name, fields});
+}
+
+static double seconds(bench_clock::time_point start) {
+	return chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+static void printResults() {
+	cout << "{" << endl;
+	cout << "\t\"compiler\": \"" << __VERSION__ << "\"," << endl;
+#	ifdef PRTTY_METRICS
+	cout << "\t\"metrics\": true," << endl;
+#	else
+	cout << "\t\"metrics\": false," << endl;
+#	endif
+#	ifdef PRTTY_TRACE
+	cout << "\t\"trace\": true," << endl;
+#	else
+	cout << "\t\"trace\": false," << endl;
+#	endif
+	cout << "\t\"results\": [";
+	for (size_t i = 0; i < results.size(); i++) {
+		cout << (i ? "," : "") << endl << "\t\t{\"name\": \"" << results[i].name << "\"";
+		for (auto &f : results[i].fields) {
+			cout << ", \"" << f.first << "\": " << f.second;
+		}
+		cout << "}";
+	}
+	cout << endl << "\t]" << endl << "}" << endl;
+}
+
+static string pasteBuffer(size_t size, const string &keys) {
+	static const char lorem[] = "Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor. ";
+	string buf;
+	buf.reserve(size + 64);
+	size_t line = 0;
+	while (buf.length() < size) {
+		buf += lorem;
+		if (++line % 4 == 0) {
+			buf += keys.empty() ? "\n" : keys;
+		}
+	}
+	return buf;
+}
+
+static bool exists(const string &path) {
+	struct stat st;
+	return stat(path.c_str(), &st) == 0;
+}
+
+// load latency, allocations and resident size per terminal
+static void benchLoad(const string &fixtures) {
+	vector<pair<string, string>> entries; // (label, dir)
+	for (auto name : {"xterm-256color", "linux", "vt100"}) {
+		if (!fixtures.empty()) {
+			entries.push_back({string("fixture.") + name, fixtures});
+		}
+	}
+
+	const char *systemNames[] = {"xterm-256color", "xterm", "screen-256color", "tmux-256color", "linux", "vt100", "rxvt-unicode-256color", "dumb"};
+	for (auto dir : {"/etc/terminfo", "/lib/terminfo", "/usr/share/terminfo"}) {
+		for (auto name : systemNames) {
+			if (exists(string(dir) + "/" + name[0] + "/" + name)) {
+				entries.push_back({string("system.") + name, dir});
+			}
+		}
+	}
+
+	for (auto &e : entries) {
+		string name = e.first.substr(e.first.find('.') + 1);
+
+		size_t allocs = allocations.load();
+		size_t live = liveBytes.load();
+		unique_ptr<prtty::term> kept(new prtty::term(prtty::get(name, e.second)));
+		double allocsPerLoad = static_cast<double>(allocations.load() - allocs);
+		double bytes = static_cast<double>(liveBytes.load() - live);
+
+		const int loads = 200;
+		auto start = bench_clock::now();
+		for (int i = 0; i < loads; i++) {
+			prtty::term t = prtty::get(name, e.second);
+			(void) t;
+		}
+		double secs = seconds(start);
+
+		// copies share the parsed entry
+		const int copies = 100000;
+		allocs = allocations.load();
+		start = bench_clock::now();
+		for (int i = 0; i < copies; i++) {
+			prtty::term copy(*kept);
+			(void) copy;
+		}
+		double copySecs = seconds(start);
+		double allocsPerCopy = static_cast<double>(allocations.load() - allocs) / copies;
+
+		result("load." + e.first, {
+			{"us_per_load", secs / loads * 1e6},
+			{"allocations_per_load", allocsPerLoad},
+			{"bytes_per_term", bytes},
+			{"sizeof_term", static_cast<double>(sizeof(prtty::term))},
+			{"ns_per_copy", copySecs / copies * 1e9},
+			{"allocations_per_copy", allocsPerCopy}
+		});
+	}
+
+	// an unknown TERM, over the whole search path; only the first goes to the filesystem
+	const int lookups = 100000;
+	auto start = bench_clock::now();
+	for (int i = 0; i < lookups; i++) {
+		prtty::locate("no-such-terminal");
+	}
+	result("load.miss", {
+		{"us_per_lookup", seconds(start) / lookups * 1e6},
+		{"directories", static_cast<double>(prtty::search_path().size())}
+	});
+}
+
+// indexing and bulk-loading a whole system database, against a get() per name
+// the first of the usual places that has anything in it
+static string systemDatabase() {
+	for (auto candidate : {"/usr/share/terminfo", "/lib/terminfo", "/etc/terminfo"}) {
+		if (exists(candidate) && prtty::database(candidate).size() > 0) {
+			return candidate;
+		}
+	}
+	return "";
+}
+
+static void benchDatabase() {
+	string dir = systemDatabase();
+	if (dir.empty()) {
+		cerr << "no system terminfo database" << endl;
+		return;
+	}
+
+	auto start = bench_clock::now();
+	prtty::database db(dir);
+	double scan = seconds(start);
+
+	start = bench_clock::now();
+	size_t colorful = db.select([](const prtty::database::entry &e) { return e.caps.max_colors >= 256; }).size();
+	double select = seconds(start);
+
+	// what it takes without the index
+	start = bench_clock::now();
+	size_t loaded = 0;
+	for (auto &e : db.entries()) {
+		try {
+			prtty::term t = prtty::get(e.name, dir);
+			++loaded;
+		} catch (const prtty::PrttyError &) {
+		}
+	}
+	double individually = seconds(start);
+
+	result("database.scan", {
+		{"entries", static_cast<double>(db.size())},
+		{"ms", scan * 1e3},
+		{"select_us", select * 1e6},
+		{"max_colors_256", static_cast<double>(colorful)},
+		{"get_each_ms", individually * 1e3},
+		{"loaded", static_cast<double>(loaded)}
+	});
+
+	unsigned cores = max(1u, thread::hardware_concurrency());
+	double single = 0;
+	for (unsigned threads = 1; threads <= max(4u, cores); threads *= 2) {
+		start = bench_clock::now();
+		auto terms = db.load_all(threads);
+		double secs = seconds(start);
+		if (threads == 1) {
+			single = secs;
+		}
+		result("database.load_all." + to_string(threads), {
+			{"ms", secs * 1e3},
+			{"speedup", single / secs},
+			{"vs_get_each", individually / secs},
+			{"cores", static_cast<double>(cores)}
+		});
+	}
+}
+
+// Sequence::parse over every string capability of the entry
+/*
+	how much of the system database runs on the integer-only path,
+	and what that path saves over the generic one on those strings
+*/
+static void benchAnalysis() {
+	string dir = systemDatabase();
+	if (dir.empty()) {
+		cerr << "no system terminfo database" << endl;
+		return;
+	}
+
+	prtty::database db(dir);
+	auto terms = db.load_all();
+
+	vector<const prtty::impl::Sequence *> integral;
+	size_t parameterized = 0;
+	size_t total = 0;
+	for (auto &t : terms) {
+		if (!t) {
+			continue;
+		}
+		auto visit = [&](const prtty::impl::SequenceStreamer &cap) {
+			++total;
+			if (cap.source().find('%') == string::npos) {
+				return;
+			}
+			++parameterized;
+			if (cap.sequence().integral()) {
+				integral.push_back(&cap.sequence());
+			}
+		};
+#		define PRTTY_DO_STRING(name) if (t->name) visit(t->name);
+#		include "./prtty-strings.inc"
+		for (auto &ext : t->extended_strings) {
+			if (ext.second) {
+				visit(ext.second);
+			}
+		}
+	}
+
+	string out;
+	out.reserve(1 << 16);
+	prtty::impl::StringBuf buf(out);
+	ostream os(&buf);
+	prtty::impl::Data data;
+	const int args[9] = {24, 80, 1, 0, 1, 0, 0, 1, 0};
+	const int rounds = 50;
+
+	auto time = [&](bool fast) {
+		auto start = bench_clock::now();
+		for (int r = 0; r < rounds; r++) {
+			for (auto seq : integral) {
+				out.clear();
+				data.bind(args, 9);
+				if (fast) {
+					seq->run(data, os);
+				} else {
+					seq->interpret(data, os);
+				}
+			}
+		}
+		return seconds(start) / (static_cast<double>(rounds) * static_cast<double>(max<size_t>(1, integral.size())));
+	};
+	double generic = time(false);
+	double fast = time(true);
+
+	result("analysis.integral", {
+		{"terminals", static_cast<double>(terms.size())},
+		{"strings", static_cast<double>(total)},
+		{"parameterized", static_cast<double>(parameterized)},
+		{"integral", static_cast<double>(integral.size())},
+		{"integral_fraction", static_cast<double>(integral.size()) / static_cast<double>(max<size_t>(1, parameterized))},
+		{"generic_ns", generic * 1e9},
+		{"integral_ns", fast * 1e9},
+		{"speedup", generic / fast}
+	});
+}
+
+static void benchParse(const prtty::term &term) {
+	vector<string> sources;
+#	define PRTTY_DO_STRING(name) if (term.name) sources.push_back(term.name.source());
+#	include "./prtty-strings.inc"
+	for (auto &ext : term.extended_strings) {
+		sources.push_back(ext.second.source());
+	}
+
+	size_t bytes = 0;
+	for (auto &src : sources) {
+		bytes += src.length();
+	}
+
+	const int rounds = 500;
+	size_t allocs = allocations.load();
+	auto start = bench_clock::now();
+	size_t ops = 0;
+	for (int r = 0; r < rounds; r++) {
+		for (auto &src : sources) {
+			ops += prtty::impl::Sequence::parse(src).ops.size();
+		}
+	}
+	double secs = seconds(start);
+	double parses = static_cast<double>(sources.size()) * rounds;
+
+	result("parse", {
+		{"capabilities", static_cast<double>(sources.size())},
+		{"parses_per_second", parses / secs},
+		{"mib_per_second", static_cast<double>(bytes) * rounds / (1024.0 * 1024.0) / secs},
+		{"allocations_per_parse", static_cast<double>(allocations.load() - allocs) / parses},
+		{"ops", static_cast<double>(ops) / rounds}
+	});
+}
+
+// runs `call(ostream &, i)` `n` times into a reused buffer
+template <typename Call>
+static void benchCall(const string &name, Call call) {
+	string out;
+	out.reserve(1 << 16);
+	prtty::impl::StringBuf buf(out);
+	ostream os(&buf);
+
+	const int n = 500000;
+	size_t allocs = allocations.load();
+	auto start = bench_clock::now();
+	for (int i = 0; i < n; i++) {
+		if (out.length() > (1 << 15)) {
+			out.clear();
+		}
+		call(os, i);
+	}
+	double secs = seconds(start);
+
+	result(name, {
+		{"ns_per_call", secs / n * 1e9},
+		{"allocations_per_call", static_cast<double>(allocations.load() - allocs) / n}
+	});
+}
+
+// looks every name up `rounds` times with `find(const string &)`
+template <typename Find>
+static void benchLookup(const string &name, const vector<string> &names, Find find) {
+	const int rounds = 5000;
+	double lookups = static_cast<double>(names.size()) * rounds;
+	size_t found = 0;
+	size_t allocs = allocations.load();
+	auto start = bench_clock::now();
+	for (int r = 0; r < rounds; r++) {
+		for (auto &n : names) {
+			found += find(n);
+		}
+	}
+	double secs = seconds(start);
+
+	result(name, {
+		{"names", static_cast<double>(names.size())},
+		{"ns_per_lookup", secs / lookups * 1e9},
+		{"allocations_per_lookup", static_cast<double>(allocations.load() - allocs) / lookups},
+		{"found", static_cast<double>(found) / rounds}
+	});
+}
+
+// capabilities by name: the perfect hash against a plain hash map of the same names
+static void benchCapabilityNames(const prtty::term &term) {
+	vector<string> names;
+	unordered_map<string, prtty::capability> baseline;
+	for (size_t i = 0; i < prtty::impl::CapabilityNames::count; i++) {
+		prtty::capability cap = prtty::impl::CapabilityNames::at(i);
+		for (const char *name : {prtty::long_name(cap), prtty::short_name(cap)}) {
+			names.push_back(name);
+			baseline.emplace(name, cap);
+		}
+	}
+	prtty::find_capability("setaf"); // builds the table
+
+	benchLookup("capnames.perfect_hash", names, [](const string &n) -> size_t {
+		return prtty::find_capability(n.data(), n.length()) ? 1 : 0;
+	});
+	benchLookup("capnames.unordered_map", names, [&](const string &n) -> size_t {
+		return baseline.find(n) != baseline.end() ? 1 : 0;
+	});
+
+	prtty::capability fg = prtty::find_capability("setaf");
+	benchCall("capnames.setaf.eval", [&](ostream &os, int i) { term.get_string(fg).eval(os, i % 256); });
+}
+
+// the capabilities every full-screen program leans on
+static void benchEval(const prtty::term &t) {
+	benchCall("eval.cup.stream", [&](ostream &os, int i) { os << t.cursor_address(i % 50, i % 200); });
+	benchCall("eval.cup.eval", [&](ostream &os, int i) { t.cursor_address.eval(os, i % 50, i % 200); });
+	benchCall("eval.setaf.stream", [&](ostream &os, int i) { os << t.set_a_foreground(i % 256); });
+	benchCall("eval.setaf.eval", [&](ostream &os, int i) { t.set_a_foreground.eval(os, i % 256); });
+	benchCall("eval.sgr.stream", [&](ostream &os, int i) { os << t.set_attributes(i & 1, 0, i & 2, 0, 0, i & 4, 0, 0, 0); });
+	benchCall("eval.sgr.eval", [&](ostream &os, int i) { t.set_attributes.eval(os, i & 1, 0, i & 2, 0, 0, i & 4, 0, 0, 0); });
+	benchCall("eval.clear.stream", [&](ostream &os, int) { os << t.clear_screen; });
+	benchCall("eval.clear.eval", [&](ostream &os, int) { t.clear_screen.eval(os); });
+}
+
+static void benchBatchEvaluation(const prtty::term &term) {
+	// a frame's worth of capabilities: position, colors, attributes
+	vector<prtty::eval_record> records;
+	for (int row = 0; row < 50; row++) {
+		records.push_back({&term.cursor_address, {row, 0}});
+		for (int col = 0; col < 20; col++) {
+			records.push_back({&term.set_a_foreground, {(row + col) % 256}});
+			records.push_back({&term.set_a_background, {col % 8}});
+			records.push_back({&term.set_attributes, {0, col & 1, 0, 0, 0, 1, 0, 0, 0}});
+		}
+		records.push_back({&term.exit_attribute_mode, {}});
+	}
+
+	const int frames = 200;
+	size_t bytes = 0;
+
+	auto start = bench_clock::now();
+	for (int frame = 0; frame < frames; frame++) {
+		ostringstream os;
+		for (auto &r : records) {
+			const int *a = r.args;
+			os << (*r.cap)(a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7], a[8]);
+		}
+		bytes += os.str().length();
+	}
+	double streamed = seconds(start);
+
+	prtty::evaluator ev;
+	start = bench_clock::now();
+	for (int frame = 0; frame < frames; frame++) {
+		bytes += ev.run(records).length();
+	}
+	double batched = seconds(start);
+
+	double calls = static_cast<double>(records.size()) * frames;
+	result("eval.batch.streamed", {{"ns_per_capability", streamed / calls * 1e9}, {"bytes", static_cast<double>(bytes)}});
+	result("eval.batch.evaluator", {{"ns_per_capability", batched / calls * 1e9}, {"speedup", streamed / batched}});
+}
+
+#ifdef PRTTY_METRICS
+static void reportMetrics(const prtty::term &term) {
+	prtty::for_each_metric(term, [](const char *name, const prtty::capability_metrics &m) {
+		if (m.evaluations > 0) {
+			result(string("metrics.") + name, {
+				{"evaluations", static_cast<double>(m.evaluations)},
+				{"bytes", static_cast<double>(m.bytes)},
+				{"seconds", m.seconds},
+				{"p99_ns", m.p99 * 1e9}
+			});
+		}
+	});
+}
+#endif
+
+#ifdef PRTTY_TRACE
+// what a span costs with tracing off and on, and what it adds to a batch
+static void benchTrace(const prtty::term &term) {
+	auto perSpan = [](bool on) {
+		prtty::enable_tracing(on);
+		double best = 1e9;
+		for (int round = 0; round < 5; round++) {
+			const int n = 20000;
+			auto start = bench_clock::now();
+			for (int i = 0; i < n; i++) {
+				prtty::impl::TraceSpan span("budget", "bench");
+			}
+			best = min(best, seconds(start) * 1e9 / n);
+		}
+		prtty::enable_tracing(false);
+		return best;
+	};
+	result("trace.span", {{"ns_off", perSpan(false)}, {"ns_on", perSpan(true)}});
+
+	prtty::evaluator ev;
+	vector<prtty::eval_record> frame;
+	for (int i = 0; i < 256; i++) {
+		frame.push_back({&term.cursor_address, {i % 24, i % 80}});
+	}
+	// alternating, and the best of each, so that noise hits both alike
+	double plain = 1e9, traced = 1e9;
+	for (int round = 0; round < 20; round++) {
+		bool on = round % 2 == 1;
+		prtty::enable_tracing(on);
+		auto start = bench_clock::now();
+		for (int i = 0; i < 50; i++) {
+			ev.run(frame);
+		}
+		double &best = on ? traced : plain;
+		best = min(best, seconds(start));
+	}
+	prtty::enable_tracing(false);
+	prtty::clear_trace();
+	result("trace.batch", {{"plain_us", plain * 1e6 / 50}, {"traced_us", traced * 1e6 / 50}, {"overhead_percent", (traced / plain - 1) * 100}});
+}
+#endif
+
+static void benchInput(const prtty::term &term) {
+	prtty::input in(term);
+	string up = term.key_up;
+
+	const size_t chunk = 4096; // a typical read(2)
+	const struct {
+		const char *name;
+		string buf;
+	} workloads[] = {
+		{"input.paste", pasteBuffer(64 << 20, "")},
+		{"input.typing", pasteBuffer(16 << 20, up)}
+	};
+
+	for (auto &w : workloads) {
+		size_t events = 0;
+		auto start = bench_clock::now();
+		for (size_t off = 0; off < w.buf.length(); off += chunk) {
+			in.feed(w.buf.data() + off, min(chunk, w.buf.length() - off), [&](const prtty::key_event &) {
+				++events;
+			});
+		}
+		double secs = seconds(start);
+		result(w.name, {
+			{"bytes", static_cast<double>(w.buf.length())},
+			{"mib_per_second", static_cast<double>(w.buf.length()) / (1024.0 * 1024.0) / secs},
+			{"events", static_cast<double>(events)}
+		});
+	}
+}
+
+static void benchMouse(const prtty::term &term) {
+	string sgr, x10;
+	for (int i = 0; i < 200000; i++) {
+		int x = i % 200 + 1;
+		int y = i % 50 + 1;
+		sgr += "\x1b[<32;" + to_string(x) + ";" + to_string(y) + "M";
+		x10 += string("\x1b[M@") + static_cast<char>(x % 220 + 33) + static_cast<char>(y + 32);
+	}
+
+	const struct {
+		const char *name;
+		const string &buf;
+		bool coalesce;
+	} workloads[] = {
+		{"mouse.sgr", sgr, false},
+		{"mouse.sgr.coalesced", sgr, true},
+		{"mouse.x10", x10, false},
+		{"mouse.x10.coalesced", x10, true}
+	};
+
+	for (auto &w : workloads) {
+		prtty::input in(term);
+		in.coalesceMotion(w.coalesce);
+
+		size_t events = 0;
+		const size_t chunk = 4096;
+		auto start = bench_clock::now();
+		for (size_t off = 0; off < w.buf.length(); off += chunk) {
+			in.feed(w.buf.data() + off, min(chunk, w.buf.length() - off), [&](const prtty::key_event &) {
+				++events;
+			});
+		}
+		double secs = seconds(start);
+		result(w.name, {
+			{"mib_per_second", static_cast<double>(w.buf.length()) / (1024.0 * 1024.0) / secs},
+			{"reports_per_second", 200000.0 / secs},
+			{"events", static_cast<double>(events)}
+		});
+	}
+}
+
+// something shaped like a full-screen TUI repaint: positioned, colored text
+static string tuiOutput(const prtty::term &term, size_t size) {
+	string buf;
+	string sgr0 = term.exit_attribute_mode;
+	for (int frame = 0; buf.length() < size; frame++) {
+		buf += term.clear_screen;
+		for (int row = 0; row < 50; row++) {
+			buf += term.cursor_address(row, 0);
+			for (int col = 0; col < 4; col++) {
+				buf += term.set_a_foreground((row * 4 + col + frame) % 256);
+				buf += "some status text 12345 ";
+			}
+			buf += sgr0;
+			buf += "\r\n";
+		}
+	}
+	return buf;
+}
+
+static void benchRecognizer(const prtty::term &term) {
+	auto start = bench_clock::now();
+	prtty::recognizer rec(term);
+	result("recognizer.build", {{"patterns", static_cast<double>(rec.patterns())}, {"ms", seconds(start) * 1000.0}});
+
+	const struct {
+		const char *name;
+		string buf;
+	} workloads[] = {
+		{"recognizer.tui", tuiOutput(term, 32 << 20)},
+		{"recognizer.text", pasteBuffer(64 << 20, "\r\n")}
+	};
+
+	for (auto &w : workloads) {
+		size_t events = 0;
+		const size_t chunk = 16384;
+		start = bench_clock::now();
+		for (size_t off = 0; off < w.buf.length(); off += chunk) {
+			rec.feed(w.buf.data() + off, min(chunk, w.buf.length() - off), [&](const prtty::output_event &ev) {
+				events += ev.type == prtty::output_event::Type::CAPABILITY;
+			});
+		}
+		double secs = seconds(start);
+		result(w.name, {
+			{"mib_per_second", static_cast<double>(w.buf.length()) / (1024.0 * 1024.0) / secs},
+			{"capabilities_per_second", static_cast<double>(events) / secs}
+		});
+	}
+}
+
+static void benchTranslate(const prtty::term &term, const prtty::term &target, const string &name) {
+	prtty::translator tr(term, target);
+	string buf = tuiOutput(term, 32 << 20);
+
+	size_t written = 0;
+	const size_t chunk = 16384;
+	auto start = bench_clock::now();
+	for (size_t off = 0; off < buf.length(); off += chunk) {
+		tr.feed(buf.data() + off, min(chunk, buf.length() - off), [&](const char *, size_t len) {
+			written += len;
+		});
+	}
+	double secs = seconds(start);
+	result("translate." + name, {
+		{"mib_per_second", static_cast<double>(buf.length()) / (1024.0 * 1024.0) / secs},
+		{"bytes_in", static_cast<double>(buf.length())},
+		{"bytes_out", static_cast<double>(written)}
+	});
+
+	// keystroke echo: tiny writes, one per key, as an interactive shell would
+	const char *echo[] = {"l", "s", "\r\n", "\x1b[K", "\x1b[1C", "\x1b[32m", "a", "\x1b[m"};
+	const size_t keys = 1000000;
+	start = bench_clock::now();
+	for (size_t i = 0; i < keys; i++) {
+		const char *key = echo[i % 8];
+		tr.feed(key, strlen(key), [&](const char *, size_t len) {
+			written += len;
+		});
+	}
+	secs = seconds(start);
+	result("translate." + name + ".keystroke", {{"ns_per_write", secs / static_cast<double>(keys) * 1e9}});
+}
+
+// a dashboard refresh: a few dozen positioned, colored cells
+static void dashboardFrame(const prtty::term &term, ostream &os, int frame) {
+	for (int row = 0; row < 24; row++) {
+		os << term.cursor_address(row, 0);
+		for (int col = 0; col < 4; col++) {
+			os << term.set_a_foreground((row * 4 + col + frame) % 8) << "cpu " << (row * col + frame) % 100 << "% ";
+		}
+	}
+	os << term.exit_attribute_mode;
+}
+
+static void benchFanout(const vector<const prtty::term *> &terms) {
+	const int frames = 200;
+	for (size_t clients : {1, 10, 100, 1000}) {
+		size_t bytes = 0;
+
+		prtty::fanout fan;
+		for (size_t i = 0; i < clients; i++) {
+			fan.attach(*terms[i % terms.size()], [&](const prtty::fanout::frame &f) {
+				bytes += f->length();
+				return true;
+			});
+		}
+
+		auto start = bench_clock::now();
+		for (int frame = 0; frame < frames; frame++) {
+			fan.broadcast(0, 0, [&](const prtty::term &t, ostream &os) {
+				dashboardFrame(t, os, frame);
+			});
+		}
+		double shared = seconds(start);
+
+		// the same work, rendered separately for every client
+		start = bench_clock::now();
+		for (int frame = 0; frame < frames; frame++) {
+			for (size_t i = 0; i < clients; i++) {
+				ostringstream os;
+				dashboardFrame(*terms[i % terms.size()], os, frame);
+				bytes += os.str().length();
+			}
+		}
+		double naive = seconds(start);
+
+		result("fanout." + to_string(clients), {
+			{"us_per_frame", shared / frames * 1e6},
+			{"per_client_us_per_frame", naive / frames * 1e6},
+			{"terminals", static_cast<double>(terms.size())},
+			{"bytes", static_cast<double>(bytes)}
+		});
+	}
+}
+
+static double cpuSeconds() {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec)
+		+ static_cast<double>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+// endpoints to write to: ptys while the system has them, then socket pairs
+static size_t openEndpoints(size_t count, vector<int> &writers, vector<int> &readers) {
+	size_t ptys = 0;
+	for (size_t i = 0; i < count; i++) {
+		int master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+		if (master >= 0 && grantpt(master) == 0 && unlockpt(master) == 0) {
+			int slave = open(ptsname(master), O_RDWR | O_NOCTTY | O_NONBLOCK);
+			if (slave >= 0) {
+				struct termios raw;
+				tcgetattr(slave, &raw);
+				cfmakeraw(&raw);
+				tcsetattr(slave, TCSANOW, &raw);
+				writers.push_back(slave);
+				readers.push_back(master);
+				++ptys;
+				continue;
+			}
+		}
+		if (master >= 0) {
+			close(master);
+		}
+
+		int pair[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pair) != 0) {
+			break;
+		}
+		writers.push_back(pair[0]);
+		readers.push_back(pair[1]);
+	}
+	return ptys;
+}
+
+static void benchBatch(const prtty::term &term) {
+	ostringstream os;
+	dashboardFrame(term, os, 0);
+	const string bytes = os.str();
+
+	for (size_t count : {100, 1000, 5000}) {
+		vector<int> writers, readers;
+		size_t ptys = openEndpoints(count, writers, readers);
+
+		for (auto backend : {prtty::batch_writer::Backend::URING, prtty::batch_writer::Backend::EPOLL}) {
+			prtty::batch_writer out(backend);
+			const int frames = 50;
+			double cpu = 0;
+			double wall = 0;
+			char sink[65536];
+
+			for (int frame = 0; frame < frames; frame++) {
+				auto f = make_shared<const string>(bytes);
+
+				double c0 = cpuSeconds();
+				auto w0 = bench_clock::now();
+				for (int fd : writers) {
+					out.write(fd, f);
+				}
+				out.wait(chrono::milliseconds(5000));
+				wall += seconds(w0);
+				cpu += cpuSeconds() - c0;
+
+				// the clients' side; not measured
+				for (int fd : readers) {
+					while (read(fd, sink, sizeof(sink)) > 0);
+				}
+			}
+
+			result(string("batch.") + (out.backend() == prtty::batch_writer::Backend::URING ? "io_uring" : "epoll") + "." + to_string(writers.size()), {
+				{"ptys", static_cast<double>(ptys)},
+				{"syscalls_per_frame", static_cast<double>(out.syscalls()) / frames},
+				{"cpu_ms_per_frame", cpu / frames * 1e3},
+				{"ms_per_frame", wall / frames * 1e3},
+				{"errors", static_cast<double>(out.errors())}
+			});
+		}
+
+		for (size_t i = 0; i < writers.size(); i++) {
+			close(writers[i]);
+			close(readers[i]);
+		}
+	}
+}
+
+// a write(2) for every piece, as an application printing straight to the tty does
+class UnbufferedFd : public streambuf {
+public:
+	explicit UnbufferedFd(int fd)
+			: fd(fd) {
+	}
+
+	size_t writes = 0;
+	size_t bytes = 0;
+
+protected:
+	virtual int_type overflow(int_type c) {
+		if (c != traits_type::eof()) {
+			char ch = static_cast<char>(c);
+			this->xsputn(&ch, 1);
+		}
+		return c;
+	}
+
+	virtual streamsize xsputn(const char *s, streamsize n) {
+		streamsize left = n;
+		while (left > 0) {
+			++this->writes;
+			ssize_t written = write(this->fd, s, static_cast<size_t>(left));
+			if (written < 0) {
+				pollfd pfd = {this->fd, POLLOUT, 0};
+				poll(&pfd, 1, 100);
+				continue;
+			}
+			s += written;
+			left -= written;
+			this->bytes += static_cast<size_t>(written);
+		}
+		return n;
+	}
+
+private:
+	int fd;
+};
+
+/*
+	repaint latency through a pty: from starting a frame to the
+	last of it coming out the other side, where a stand-in for the
+	terminal is reading. streamed piece by piece, against built
+	up and written as a prtty::frame.
+*/
+static void benchFrame(const prtty::term &term, const prtty::term &sync) {
+	vector<int> writers, readers;
+	size_t ptys = openEndpoints(1, writers, readers);
+	if (writers.empty()) {
+		return;
+	}
+	int slave = writers[0];
+	int master = readers[0];
+
+	atomic<size_t> received(0);
+	atomic<bool> stop(false);
+	thread terminal([&]() {
+		char sink[65536];
+		while (!stop.load()) {
+			pollfd pfd = {master, POLLIN, 0};
+			poll(&pfd, 1, 10);
+			ssize_t n;
+			while ((n = read(master, sink, sizeof(sink))) > 0) {
+				received += static_cast<size_t>(n);
+			}
+		}
+	});
+
+	const int frames = 500;
+	size_t sent = 0;
+	auto measure = [&](const string &name, function<pair<size_t, size_t>(int)> paint) {
+		double wall = 0;
+		size_t writes = 0;
+		size_t bytes = 0;
+		for (int frame = 0; frame < frames; frame++) {
+			auto start = bench_clock::now();
+			pair<size_t, size_t> out = paint(frame);
+			sent += out.second;
+			while (received.load() < sent) {
+				this_thread::yield();
+			}
+			wall += seconds(start);
+			writes += out.first;
+			bytes += out.second;
+		}
+		result("frame." + name, {
+			{"us_per_repaint", wall / frames * 1e6},
+			{"writes_per_frame", static_cast<double>(writes) / frames},
+			{"bytes_per_frame", static_cast<double>(bytes) / frames},
+			{"pty", static_cast<double>(ptys)}
+		});
+	};
+
+	measure("streamed", [&](int frame) {
+		UnbufferedFd fd(slave);
+		ostream os(&fd);
+		dashboardFrame(term, os, frame);
+		return make_pair(fd.writes, fd.bytes);
+	});
+
+	for (const prtty::term *t : {&term, &sync}) {
+		prtty::frame f(*t);
+		measure(f.synchronized() ? "framed.sync" : "framed", [&](int frame) {
+			f.begin();
+			for (int row = 0; row < 24; row++) {
+				f.put(t->cursor_address, row, 0);
+				for (int col = 0; col < 4; col++) {
+					f.put(t->set_a_foreground, (row * 4 + col + frame) % 8) << "cpu " << (row * col + frame) % 100 << "% ";
+				}
+			}
+			f << t->exit_attribute_mode;
+			f.end().write(slave);
+			return make_pair(size_t(1), f.length());
+		});
+	}
+
+	stop = true;
+	terminal.join();
+	close(slave);
+	close(master);
+}
+
+// truecolor rows mapped onto each palette size: the grid against searching the palette
+static void benchColor() {
+	// a gradient, as themes have, with random cells mixed in
+	mt19937 rng(7);
+	vector<prtty::rgb> row(4096);
+	for (size_t i = 0; i < row.size(); i++) {
+		if (i % 4 == 3) {
+			uint32_t v = rng();
+			row[i] = prtty::rgb{uint8_t(v), uint8_t(v >> 8), uint8_t(v >> 16)};
+		} else {
+			row[i] = prtty::rgb{uint8_t(i / 16), uint8_t(255 - i / 16), uint8_t(i * 7)};
+		}
+	}
+	vector<uint8_t> indices(row.size());
+
+	for (int colors : {8, 16, 88, 256}) {
+		auto start = bench_clock::now();
+		prtty::color_quantizer q(colors);
+		double build = seconds(start);
+
+		const int rounds = 500;
+		start = bench_clock::now();
+		for (int r = 0; r < rounds; r++) {
+			q.quantize(row.data(), indices.data(), row.size());
+		}
+		double grid = seconds(start);
+
+		int exhaustive = 0;
+		start = bench_clock::now();
+		for (int r = 0; r < 5; r++) {
+			for (auto &c : row) {
+				exhaustive += prtty::impl::nearestColor(colors, c);
+			}
+		}
+		double search = seconds(start) * rounds / 5;
+
+		// every 3rd value of each channel, against the exhaustive search
+		size_t same = 0;
+		size_t total = 0;
+		for (int r = 0; r < 256; r += 3) {
+			for (int g = 0; g < 256; g += 3) {
+				for (int b = 0; b < 256; b += 3) {
+					prtty::rgb c = {uint8_t(r), uint8_t(g), uint8_t(b)};
+					same += q.nearest(c) == prtty::impl::nearestColor(colors, c);
+					++total;
+				}
+			}
+		}
+
+		double cells = static_cast<double>(row.size()) * rounds;
+		result("color." + to_string(colors), {
+			{"build_ms", build * 1e3},
+			{"cells_per_second", cells / grid},
+			{"exhaustive_cells_per_second", cells / search},
+			{"speedup", search / grid},
+			{"exact_fraction", static_cast<double>(same) / total},
+			{"checksum", static_cast<double>(indices[0] + exhaustive % 2)}
+		});
+	}
+}
+
+static void benchRender(const prtty::term &term) {
+	// a 500x150 screen in one-row bands, color changing every 5 cells
+	vector<prtty::region> bands;
+	for (int row = 0; row < 150; row++) {
+		bands.push_back({row, 0, 1, 500});
+	}
+
+	// 30 panes of a multiplexer
+	vector<prtty::region> panes;
+	for (int y = 0; y < 6; y++) {
+		for (int x = 0; x < 5; x++) {
+			panes.push_back({y * 25, x * 100, 25, 100});
+		}
+	}
+
+	auto paint = [](prtty::region_output &out) {
+		const prtty::term &t = out.terminal();
+		const prtty::region &r = out.bounds();
+		for (int row = 0; row < r.rows; row++) {
+			out.moveTo(row, 0);
+			for (int col = 0; col < r.cols; col += 5) {
+				out.put(t.set_a_foreground, (r.row + row + col) % 256);
+				out.put(t.set_a_background, (r.row + col) % 16);
+				out << "x" << (col % 10) << "y" << (row % 10) << "#";
+			}
+		}
+		out << t.exit_attribute_mode;
+	};
+
+	const struct {
+		const char *name;
+		const vector<prtty::region> &regions;
+	} layouts[] = {
+		{"bands", bands},
+		{"panes", panes}
+	};
+
+	unsigned cores = max(1u, thread::hardware_concurrency());
+	for (auto &layout : layouts) {
+		double single = 0;
+		for (unsigned threads = 1; threads <= max(8u, cores); threads *= 2) {
+			prtty::parallel_renderer renderer(term, threads);
+			const int frames = 50;
+			auto start = bench_clock::now();
+			for (int frame = 0; frame < frames; frame++) {
+				renderer.render(layout.regions, paint);
+			}
+			double secs = seconds(start) / frames;
+			if (threads == 1) {
+				single = secs;
+			}
+			result(string("render.") + layout.name + "." + to_string(threads), {
+				{"ms_per_frame", secs * 1e3},
+				{"bytes", static_cast<double>(renderer.length())},
+				{"speedup", single / secs},
+				{"cores", static_cast<double>(cores)}
+			});
+		}
+	}
+}
+
+/*
+	a recorded workload from test/replay: "frame" starts a frame,
+	"text <bytes>" is output as is and any other line is a
+	capability's long name followed by its arguments.
+*/
+struct ReplayOp {
+	const prtty::impl::SequenceStreamer *cap;
+	int args[9];
+	string text;
+};
+
+typedef vector<ReplayOp> ReplayFrame;
+
+static vector<ReplayFrame> loadReplay(const prtty::term &term, const string &path) {
+	map<string, const prtty::impl::SequenceStreamer *> caps;
+#	define PRTTY_DO_STRING(name) caps[#name] = &term.name;
+#	include "./prtty-strings.inc"
+
+	ifstream in(path);
+	if (!in) {
+		throw prtty::PrttyError("could not open " + path);
+	}
+
+	vector<ReplayFrame> frames;
+	string line;
+	while (getline(in, line)) {
+		if (line.empty() || line[0] == '#') {
+			continue;
+		}
+		if (line == "frame") {
+			frames.emplace_back();
+			continue;
+		}
+		if (frames.empty()) {
+			throw prtty::PrttyError(path + ": output before the first frame");
+		}
+
+		ReplayOp op = {nullptr, {}, ""};
+		if (line.compare(0, 5, "text ") == 0) {
+			op.text = line.substr(5);
+		} else {
+			istringstream words(line);
+			string name;
+			words >> name;
+			auto cap = caps.find(name);
+			if (cap == caps.end()) {
+				throw prtty::PrttyError(path + ": unknown capability " + name);
+			}
+			op.cap = cap->second;
+			for (int i = 0; i < 9 && words >> op.args[i]; i++) {
+			}
+		}
+		frames.back().push_back(move(op));
+	}
+
+	return frames;
+}
+
+static void replayFrame(const ReplayFrame &frame, prtty::impl::Data &data, ostream &os) {
+	for (auto &op : frame) {
+		if (!op.cap) {
+			os.write(op.text.data(), static_cast<streamsize>(op.text.length()));
+		} else if (*op.cap) {
+			data.bind(op.args, 9);
+			op.cap->run(data, os);
+		}
+	}
+}
+
+/*
+	replays each workload into a null sink (evaluation only) and
+	into a pty whose other end is drained by another thread. a
+	frame's latency is from starting to evaluate it until the last
+	of its bytes has been written.
+*/
+static void benchReplay(const prtty::term &term, const string &corpus) {
+	int master = -1;
+	int slave = -1;
+	{
+		vector<int> writers, readers;
+		if (openEndpoints(1, writers, readers) == 1) {
+			slave = writers[0];
+			master = readers[0];
+			for (int fd : {slave, master}) {
+				fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+			}
+		} else {
+			for (size_t i = 0; i < writers.size(); i++) {
+				close(writers[i]);
+				close(readers[i]);
+			}
+			cerr << "no pty; replaying into the null sink only" << endl;
+		}
+	}
+
+	thread drain;
+	if (master >= 0) {
+		drain = thread([master]() {
+			char buf[65536];
+			while (::read(master, buf, sizeof buf) > 0) {
+			}
+		});
+	}
+
+	for (auto name : {"logtail", "htop", "editor", "gradient"}) {
+		vector<ReplayFrame> frames = loadReplay(term, corpus + "/" + name + ".replay");
+		size_t passes = max<size_t>(1, 2000 / frames.size());
+
+		for (auto sink : {"null", "pty"}) {
+			bool pty = strcmp(sink, "pty") == 0;
+			if (pty && slave < 0) {
+				continue;
+			}
+
+			string out;
+			out.reserve(1 << 16);
+			prtty::impl::StringBuf buf(out);
+			ostream os(&buf);
+			prtty::impl::Data data;
+
+			vector<double> latencies;
+			latencies.reserve(passes * frames.size());
+			size_t bytes = 0;
+			size_t allocs = allocations.load();
+			auto start = bench_clock::now();
+
+			for (size_t pass = 0; pass < passes; pass++) {
+				for (auto &frame : frames) {
+					auto begin = bench_clock::now();
+					out.clear();
+					replayFrame(frame, data, os);
+					if (pty) {
+						for (size_t done = 0; done < out.length();) {
+							ssize_t n = ::write(slave, out.data() + done, out.length() - done);
+							if (n < 0 && errno != EINTR) {
+								throw prtty::PrttyError(string("write failed: ") + strerror(errno));
+							}
+							done += n > 0 ? static_cast<size_t>(n) : 0;
+						}
+					}
+					latencies.push_back(seconds(begin));
+					bytes += out.length();
+				}
+			}
+
+			double secs = seconds(start);
+			double count = static_cast<double>(latencies.size());
+			sort(latencies.begin(), latencies.end());
+
+			result(string("replay.") + name + "." + sink, {
+				{"frames", count},
+				{"frames_per_second", count / secs},
+				{"bytes_per_frame", static_cast<double>(bytes) / count},
+				{"p50_us", latencies[latencies.size() / 2] * 1e6},
+				{"p99_us", latencies[latencies.size() * 99 / 100] * 1e6},
+				{"allocations_per_frame", static_cast<double>(allocations.load() - allocs) / count}
+			});
+		}
+	}
+
+	if (slave >= 0) {
+		close(slave);
+		drain.join();
+		close(master);
+	}
+}
+
+int main(int argc, char **argv) {
+	string fixtures = argc >= 2 ? argv[1] : "";
+	prtty::term term = argc >= 2
+		? prtty::get("xterm-256color", argv[1])
+		: prtty::get();
+
+#	ifdef PRTTY_METRICS
+	// only the eval benchmarks by default, to compare against the uninstrumented build
+	filter = argc >= 3 ? argv[2] : "eval";
+#	elif defined(PRTTY_TRACE)
+	// only the tracing overhead by default
+	filter = argc >= 3 ? argv[2] : "trace";
+#	else
+	filter = argc >= 3 ? argv[2] : "";
+#	endif
+
+	if (selected("load")) benchLoad(fixtures);
+	if (selected("database")) benchDatabase();
+	if (selected("analysis")) benchAnalysis();
+	if (selected("parse")) benchParse(term);
+	if (selected("capnames")) benchCapabilityNames(term);
+	if (selected("eval")) {
+		benchEval(term);
+		benchBatchEvaluation(term);
+	}
+
+#	ifdef PRTTY_METRICS
+	reportMetrics(term);
+#	endif
+
+#	ifdef PRTTY_TRACE
+	if (selected("trace")) benchTrace(term);
+#	endif
+
+	if (selected("input")) benchInput(term);
+	if (selected("mouse")) benchMouse(term);
+	if (selected("recognizer")) benchRecognizer(term);
+
+	if (selected("translate")) {
+		benchTranslate(term, term, "identity");
+		if (!fixtures.empty()) {
+			benchTranslate(term, prtty::get("linux", fixtures), "linux");
+		}
+	}
+
+	if (selected("fanout") && !fixtures.empty()) {
+		prtty::term linux = prtty::get("linux", fixtures);
+		prtty::term vt100 = prtty::get("vt100", fixtures);
+		benchFanout({&term, &linux, &vt100});
+	}
+
+	if (selected("frame") && !fixtures.empty()) benchFrame(term, prtty::get("xterm-sync", fixtures + "/sync"));
+	if (selected("batch")) benchBatch(term);
+	if (selected("color")) benchColor();
+	if (selected("render")) benchRender(term);
+	if (selected("replay") && !fixtures.empty()) benchReplay(term, fixtures + "/replay");
+
+	printResults();
+	return 0;
+}
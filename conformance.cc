@@ -0,0 +1,384 @@
+#define PRTTY_MAIN
+#include "./prtty.hpp" // include first so as to not shadow errors with missing header files
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+#include <dirent.h>
+
+#ifdef PRTTY_HAVE_TINFO
+// declared here rather than through <term.h>, whose capability macros clash with term's fields
+extern "C" char * tiparm(const char *, ...);
+#endif
+
+/*
+	prtty_conformance db [terminfo dir...]
+	prtty_conformance record <terminfo dir> <name> <corpus file>
+	prtty_conformance corpus <terminfo dir> <corpus file>
+
+	checks prtty's evaluator against ncurses' tiparm(3).
+
+	`db` walks every entry of the given terminfo directories (the
+	system's by default) and evaluates each parameterized string
+	both ways over a grid of arguments, diffing the bytes and
+	timing the two. `record` saves tiparm's output for one entry
+	to a corpus file, which `corpus` later checks prtty against
+	without needing ncurses at all.
+
+	exits 77 (skipped, to ctest) when a mode needs ncurses and it
+	wasn't found at build time.
+*/
+
+using namespace std;
+
+typedef chrono::steady_clock conformance_clock;
+
+static const int skipped = 77;
+
+struct Case {
+	string name;
+	string source;
+	prtty::impl::SequenceStreamer cap; // extended ones are made on the fly, so held by value
+};
+
+// every string capability of an entry that takes numeric parameters
+static vector<Case> parameterized(const prtty::term &t) {
+	vector<Case> cases;
+	auto add = [&](const string &name, const prtty::impl::SequenceStreamer &cap) {
+		const string &src = cap.source();
+		// %s and %l take string parameters, which tiparm would dereference
+		if (src.find('%') == string::npos || src.find("%s") != string::npos || src.find("%l") != string::npos) {
+			return;
+		}
+		cases.push_back(Case{name, src, cap});
+	};
+
+#	define PRTTY_DO_STRING(name) if (t.name) add(#name, t.name);
+#	include "./prtty-strings.inc"
+	for (auto &ext : t.extended_strings) {
+		if (ext.second) {
+			add(ext.first, ext.second);
+		}
+	}
+
+	return cases;
+}
+
+// the argument grid: all-zero, then spread over values that hit the edge cases
+static vector<vector<int>> argumentGrid() {
+	static const int values[] = {0, 1, 2, 7, 8, 9, 10, 15, 16, 31, 80, 99, 100, 127, 255, 256, 1000, 32767};
+	const size_t n = sizeof(values) / sizeof(values[0]);
+
+	vector<vector<int>> grid;
+	for (size_t t = 0; t < n * 2; t++) {
+		vector<int> args(9);
+		for (size_t i = 0; i < 9; i++) {
+			args[i] = t == 0 ? 0 : values[(t * (i + 1) + i) % n];
+		}
+		grid.push_back(args);
+	}
+	return grid;
+}
+
+static string evaluate(const prtty::impl::SequenceStreamer &cap, const vector<int> &args) {
+	prtty::impl::Data data;
+	string out;
+	prtty::impl::StringBuf buf(out);
+	ostream os(&buf);
+	data.bind(args.data(), args.size());
+	cap.run(data, os);
+	return out;
+}
+
+// $<..> delays, which tiparm leaves for tputs and prtty drops (padding being off)
+static string unpadded(const string &s) {
+	string out;
+	for (size_t i = 0; i < s.length(); i++) {
+		size_t close = s.find('>', i + 2);
+		if (s.compare(i, 2, "$<") == 0 && i + 2 < s.length() && (isdigit(static_cast<unsigned char>(s[i + 2])) || s[i + 2] == '.')
+				&& close != string::npos) {
+			i = close;
+		} else {
+			out += s[i];
+		}
+	}
+	return out;
+}
+
+// tiparm returns a C string, so it can't show anything past a NUL
+static bool same(const string &actual, const string &expected) {
+	return actual.substr(0, actual.find('\0')) == unpadded(expected);
+}
+
+static string escape(const string &bytes) {
+	static const char hex[] = "0123456789abcdef";
+	string out;
+	for (unsigned char c : bytes) {
+		if (c < 0x20 || c >= 0x7f || c == '\\' || c == '\t') {
+			out += "\\x";
+			out += hex[c >> 4];
+			out += hex[c & 15];
+		} else {
+			out += static_cast<char>(c);
+		}
+	}
+	return out;
+}
+
+static string unescape(const string &text) {
+	string out;
+	for (size_t i = 0; i < text.length(); i++) {
+		if (text[i] == '\\' && i + 3 < text.length() && text[i + 1] == 'x') {
+			out += static_cast<char>(stoi(text.substr(i + 2, 2), nullptr, 16));
+			i += 3;
+		} else {
+			out += text[i];
+		}
+	}
+	return out;
+}
+
+static string join(const vector<int> &args) {
+	string out;
+	for (size_t i = 0; i < args.size(); i++) {
+		out += (i ? "," : "") + to_string(args[i]);
+	}
+	return out;
+}
+
+static vector<int> split(const string &text) {
+	vector<int> args;
+	istringstream in(text);
+	string field;
+	while (getline(in, field, ',')) {
+		args.push_back(stoi(field));
+	}
+	return args;
+}
+
+// corpus lines: capability name, arguments and tiparm's output, tab separated
+static int checkCorpus(const string &dir, const string &path) {
+	ifstream in(path);
+	if (!in) {
+		cerr << "could not open " << path << endl;
+		return 1;
+	}
+
+	unique_ptr<prtty::term> t;
+	map<string, prtty::impl::SequenceStreamer> caps;
+	size_t checked = 0;
+	size_t mismatched = 0;
+
+	string line;
+	while (getline(in, line)) {
+		if (line.compare(0, 7, "# term ") == 0) {
+			t.reset(new prtty::term(prtty::get(line.substr(7), dir)));
+			caps.clear();
+			for (auto &c : parameterized(*t)) {
+				caps.emplace(c.name, c.cap);
+			}
+			continue;
+		}
+		if (line.empty() || line[0] == '#') {
+			continue;
+		}
+
+		size_t a = line.find('\t');
+		size_t b = line.find('\t', a + 1);
+		auto cap = caps.find(line.substr(0, a));
+		if (!t || a == string::npos || b == string::npos || cap == caps.end()) {
+			cerr << path << ": bad line: " << line << endl;
+			return 1;
+		}
+
+		vector<int> args = split(line.substr(a + 1, b - a - 1));
+		string expected = unescape(line.substr(b + 1));
+		string actual = evaluate(cap->second, args);
+		++checked;
+		if (!same(actual, expected)) {
+			++mismatched;
+			cout << "MISMATCH: " << cap->first << "(" << join(args) << ") " << cap->second.source() << endl
+				<< "\ttiparm: " << escape(expected) << endl
+				<< "\tprtty:  " << escape(actual) << endl;
+		}
+	}
+
+	cout << checked << " evaluations checked, " << mismatched << " mismatched" << endl;
+	return checked > 0 && mismatched == 0 ? 0 : 1;
+}
+
+#ifdef PRTTY_HAVE_TINFO
+// tiparm keeps %P[A-Z] between calls, as prtty does per term; start every case from zero
+static void resetStatics() {
+	static string reset;
+	if (reset.empty()) {
+		for (char v = 'A'; v <= 'Z'; v++) {
+			reset += string("%{0}%P") + v;
+		}
+	}
+	tiparm(reset.c_str());
+}
+
+static bool reference(const string &source, const vector<int> &args, string &out) {
+	resetStatics();
+	const char *result = tiparm(source.c_str(), args[0], args[1], args[2], args[3], args[4], args[5], args[6], args[7], args[8]);
+	if (!result) {
+		return false;
+	}
+	out = result;
+	return true;
+}
+
+static int record(const string &dir, const string &name, const string &path) {
+	prtty::term t = prtty::get(name, dir);
+	ofstream out(path);
+	out << "# tiparm output for " << name << "'s parameterized strings; see conformance.cc" << endl;
+	out << "# term " << name << endl;
+
+	size_t lines = 0;
+	for (auto &c : parameterized(t)) {
+		for (auto &args : argumentGrid()) {
+			string expected;
+			if (reference(c.source, args, expected)) {
+				out << c.name << "\t" << join(args) << "\t" << escape(expected) << "\n";
+				++lines;
+			}
+		}
+	}
+
+	cout << lines << " evaluations recorded to " << path << endl;
+	return 0;
+}
+
+static void entries(const string &dir, vector<string> &names) {
+	DIR *top = opendir(dir.c_str());
+	if (!top) {
+		return;
+	}
+	while (struct dirent *sub = readdir(top)) {
+		// entries live in directories named by their first character or its hex code
+		if (sub->d_name[0] == '.' || strlen(sub->d_name) > 2) {
+			continue;
+		}
+		DIR *d = opendir((dir + "/" + sub->d_name).c_str());
+		if (!d) {
+			continue;
+		}
+		while (struct dirent *e = readdir(d)) {
+			if (e->d_name[0] != '.') {
+				names.push_back(e->d_name);
+			}
+		}
+		closedir(d);
+	}
+	closedir(top);
+}
+
+static int walk(const vector<string> &dirs) {
+	const vector<vector<int>> grid = argumentGrid();
+	size_t terminals = 0;
+	size_t evaluations = 0;
+	size_t mismatched = 0;
+	size_t unloadable = 0;
+	double prttySeconds = 0;
+	double tinfoSeconds = 0;
+
+	for (auto &dir : dirs) {
+		vector<string> names;
+		entries(dir, names);
+
+		for (auto &name : names) {
+			unique_ptr<prtty::term> t;
+			try {
+				t.reset(new prtty::term(prtty::get(name, dir)));
+			} catch (const exception &e) {
+				cout << "UNLOADABLE: " << dir << "/" << name << ": " << e.what() << endl;
+				++unloadable;
+				continue;
+			}
+			++terminals;
+
+			for (auto &c : parameterized(*t)) {
+				for (auto &args : grid) {
+					string expected;
+					if (!reference(c.source, args, expected)) {
+						continue;
+					}
+					string actual = evaluate(c.cap, args);
+					++evaluations;
+					if (!same(actual, expected)) {
+						if (++mismatched <= 50) {
+							cout << "MISMATCH: " << name << " " << c.name << "(" << join(args) << ") " << escape(c.source) << endl
+								<< "\ttiparm: " << escape(expected) << endl
+								<< "\tprtty:  " << escape(actual) << endl;
+						}
+					}
+				}
+
+				// the same grid again, timed, with state set up the way each would in use
+				prtty::impl::Data data;
+				string out;
+				prtty::impl::StringBuf buf(out);
+				ostream os(&buf);
+				auto start = conformance_clock::now();
+				for (auto &args : grid) {
+					out.clear();
+					data.bind(args.data(), args.size());
+					c.cap.run(data, os);
+				}
+				prttySeconds += chrono::duration<double>(conformance_clock::now() - start).count();
+
+				start = conformance_clock::now();
+				for (auto &args : grid) {
+					tiparm(c.source.c_str(), args[0], args[1], args[2], args[3], args[4], args[5], args[6], args[7], args[8]);
+				}
+				tinfoSeconds += chrono::duration<double>(conformance_clock::now() - start).count();
+			}
+		}
+	}
+
+	cout << terminals << " terminals, " << evaluations << " evaluations, "
+		<< mismatched << " mismatched, " << unloadable << " unloadable" << endl;
+	if (evaluations > 0) {
+		cout << "prtty: " << prttySeconds / evaluations * 1e9 << " ns/evaluation, tiparm: "
+			<< tinfoSeconds / evaluations * 1e9 << " ns/evaluation (" << tinfoSeconds / prttySeconds << "x)" << endl;
+	}
+
+	return mismatched == 0 && unloadable == 0 ? 0 : 1;
+}
+#endif
+
+int main(int argc, char **argv) {
+	string mode = argc >= 2 ? argv[1] : "db";
+
+	if (mode == "corpus" && argc == 4) {
+		return checkCorpus(argv[2], argv[3]);
+	}
+
+#	ifdef PRTTY_HAVE_TINFO
+	if (mode == "record" && argc == 5) {
+		return record(argv[2], argv[3], argv[4]);
+	}
+	if (mode == "db") {
+		vector<string> dirs(argv + min(argc, 2), argv + argc);
+		if (dirs.empty()) {
+			dirs = {"/etc/terminfo", "/lib/terminfo", "/usr/share/terminfo"};
+		}
+		return walk(dirs);
+	}
+#	else
+	if (mode == "record" || mode == "db") {
+		cout << "built without ncurses; skipping" << endl;
+		return skipped;
+	}
+#	endif
+
+	cerr << "usage: prtty_conformance db [terminfo dir...]" << endl
+		<< "       prtty_conformance record <terminfo dir> <name> <corpus file>" << endl
+		<< "       prtty_conformance corpus <terminfo dir> <corpus file>" << endl;
+	return 2;
+}
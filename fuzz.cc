@@ -0,0 +1,208 @@
+#define PRTTY_MAIN
+#include "./prtty.hpp" // include first so as to not shadow errors with missing header files
+#include "./prtty-database.hpp"
+
+#include <iostream>
+#include <random>
+
+/*
+	prtty_fuzz <terminfo dir> [iterations] [seed]
+
+	throws mutated strings at the parser and verifier, and mutated
+	compiled entries at the loader, starting from every capability
+	of the entries in the given directory. whatever parses is then
+	evaluated with numeric and string arguments, on both evaluation
+	paths, which must agree.
+
+	built with the address and undefined behavior sanitizers and
+	with libstdc++'s assertions, which bounds-check every access to
+	the (exactly sized) evaluation stack, so a program the verifier
+	lets through with too small a stack, or one that would pop an
+	empty one, stops the run.
+*/
+
+using namespace std;
+
+static const char escapes[] = "%%%%pPgd{}'?te;+-*/m&|^=<>AO!~icsl0123456789:.#xXo[";
+
+struct Mutator {
+	explicit Mutator(unsigned seed)
+			: rng(seed) {
+	}
+
+	size_t below(size_t n) {
+		return n == 0 ? 0 : static_cast<size_t>(this->rng() % n);
+	}
+
+	char byte() {
+		// mostly the characters that mean something in a format
+		if (this->below(4) != 0) {
+			return escapes[this->below(sizeof(escapes) - 1)];
+		}
+		return static_cast<char>(this->below(256));
+	}
+
+	string mutate(string s, const vector<string> &corpus) {
+		for (size_t n = 1 + this->below(4); n > 0; n--) {
+			size_t at = this->below(s.length() + 1);
+			switch (this->below(6)) {
+			case 0:
+				if (at < s.length()) {
+					s[at] = this->byte();
+				}
+				break;
+			case 1:
+				s.insert(at, 1, this->byte());
+				break;
+			case 2:
+				if (at < s.length()) {
+					s.erase(at, 1 + this->below(4));
+				}
+				break;
+			case 3:
+				s.resize(at);
+				break;
+			case 4: {
+				const string &other = corpus[this->below(corpus.size())];
+				size_t from = this->below(other.length());
+				s.insert(at, other.substr(from, this->below(16)));
+				break;
+			}
+			case 5:
+				s.insert(at, this->below(2) ? "%?" : "%;");
+				break;
+			}
+		}
+		return s;
+	}
+
+	// flips a few bytes of a compiled entry, mostly in its header and tables
+	string corrupt(string s) {
+		for (size_t n = 1 + this->below(8); n > 0 && !s.empty(); n--) {
+			size_t at = this->below(2) ? this->below(min(s.length(), static_cast<size_t>(64))) : this->below(s.length());
+			s[at] = static_cast<char>(this->below(256));
+		}
+		if (this->below(8) == 0) {
+			s.resize(this->below(s.length()));
+		}
+		return s;
+	}
+
+	mt19937 rng;
+};
+
+static size_t failures = 0;
+
+static void fail(const string &what, const string &source) {
+	if (++failures <= 20) {
+		cout << "FAIL: " << what << ": ";
+		for (unsigned char c : source) {
+			if (c < 0x20 || c >= 0x7f) {
+				cout << "\\x" << hex << static_cast<int>(c) << dec;
+			} else {
+				cout << c;
+			}
+		}
+		cout << endl;
+	}
+}
+
+static string run(const prtty::impl::Sequence &seq, const int *args, bool fast) {
+	prtty::impl::Data data;
+	string out;
+	prtty::impl::StringBuf buf(out);
+	ostream os(&buf);
+	data.bind(args, 9);
+	if (fast) {
+		seq.run(data, os);
+	} else {
+		seq.interpret(data, os);
+	}
+	return out;
+}
+
+static void exercise(const prtty::impl::Sequence &seq, const string &source, Mutator &m) {
+	const prtty::impl::Shape &shape = seq.shape;
+	if (shape.zeros > shape.depth) {
+		fail("zeros beyond the stack's depth", source);
+	}
+
+	int args[9];
+	for (auto &a : args) {
+		a = static_cast<int>(m.below(4) == 0 ? m.rng() : m.below(300));
+	}
+	string fast = run(seq, args, true);
+	if (fast != run(seq, args, false)) {
+		fail("integer-only and generic paths disagree", source);
+	}
+
+	// strings (and chars) everywhere the program might look
+	prtty::impl::Data data;
+	ostringstream os;
+	data.session("abc", 'x', 1, "", 2, 'y', "z", 3, 4);
+	seq.interpret(data, os);
+	if (data.stk.items.size() != shape.depth) {
+		fail("stack not sized to the verified depth", source);
+	}
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		cerr << "usage: prtty_fuzz <terminfo dir> [iterations] [seed]" << endl;
+		return 2;
+	}
+	size_t iterations = argc >= 3 ? stoul(argv[2]) : 100000;
+	unsigned seed = argc >= 4 ? static_cast<unsigned>(stoul(argv[3])) : 1;
+
+	prtty::database db(argv[1]);
+	vector<string> corpus = {
+		"%d%d%d", "%?%p1%t%d%;", "%e%e%;%;", "%t%t", "%?%?%?", "%p9%p9%p9%+%+%c",
+		"%'", "%{", "%{-", "%P", "%g", "%gA%PA%gA", "%i%i%d", "%99999999999d", "%{99999999999}%d"
+	};
+	vector<string> compiled;
+	for (auto &e : db.entries()) {
+		compiled.push_back(db.compiled(e));
+		prtty::term t = db.load(e.name);
+#		define PRTTY_DO_STRING(name) if (t.name) corpus.push_back(t.name.source());
+#		include "./prtty-strings.inc"
+		for (auto &ext : t.extended_strings) {
+			if (ext.second) {
+				corpus.push_back(ext.second.source());
+			}
+		}
+	}
+
+	Mutator m(seed);
+	size_t parsed = 0;
+	size_t rejected = 0;
+	size_t loaded = 0;
+	for (size_t i = 0; i < iterations; i++) {
+		// every so often a whole entry instead
+		if (i % 64 == 0 && !compiled.empty()) {
+			string bytes = m.corrupt(compiled[m.below(compiled.size())]);
+			try {
+				prtty::term t = prtty::load("fuzz", bytes);
+				++loaded;
+#				define PRTTY_DO_STRING(name) if (t.name) exercise(t.name.sequence(), t.name.source(), m);
+#				include "./prtty-strings.inc"
+			} catch (const prtty::PrttyError &) {
+			}
+			continue;
+		}
+
+		string source = m.mutate(corpus[m.below(corpus.size())], corpus);
+		prtty::impl::Sequence seq;
+		try {
+			seq = prtty::impl::Sequence::parse(source);
+		} catch (const prtty::PrttyError &) {
+			++rejected;
+			continue;
+		}
+		++parsed;
+		exercise(seq, source, m);
+	}
+
+	cout << iterations << " iterations (seed " << seed << "): " << parsed << " parsed, " << rejected << " rejected, "
+		<< loaded << " corrupted entries loaded, " << failures << " failures" << endl;
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,720 @@
+#ifndef PRTTY_BATCH_H
+#define PRTTY_BATCH_H
+#pragma once
+
+/*
+	Batched output for servers writing frames to many terminals
+	(ptys, sockets) at once. Where `prtty::writer` looks after a
+	single fd, this queues writes across any number of fds and
+	pushes them out together.
+
+	On Linux with io_uring available, a whole batch goes to the
+	kernel in one io_uring_enter(2). Frames are copied once into
+	a buffer registered with the ring, however many fds they go
+	to - which is what `prtty::fanout` hands out - and written
+	from there with fixed-buffer writes; frames too big for it
+	are written from their own memory. Otherwise it falls back to
+	writev(2) per fd, with epoll waiting out the fds that would
+	block (so those should be O_NONBLOCK). Away from Linux only
+	the fallback exists, and it waits with poll(2) instead.
+
+	Writes to the same fd always go out in order. A write that
+	fails (the client went away) drops everything queued for
+	that fd and is counted in `errors()`.
+
+	Typical use, under a fanout:
+
+		fan.attach(term, [&](const prtty::fanout::frame &f) {
+			out.write(fd, f);
+			return true;
+		});
+		fan.broadcast(0, 0, render);
+		out.submit();
+
+	Not thread-safe. `wait()` for everything to finish before
+	destroying one.
+*/
+
+#include "./prtty.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+#include <poll.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#	include <sys/epoll.h>
+#	include <sys/mman.h>
+#	include <sys/syscall.h>
+#	include <linux/io_uring.h>
+#endif
+
+namespace prtty {
+	class batch_writer {
+	public:
+		typedef shared_ptr<const string> frame;
+
+		enum class Backend {
+			URING,
+			EPOLL
+		};
+
+		explicit batch_writer(Backend prefer = Backend::URING, unsigned entries = 1024, size_t registered = 1 << 20) {
+			this->kind = Backend::EPOLL;
+#			ifdef __linux__
+			if (prefer == Backend::URING && this->setupRing(entries, registered)) {
+				this->kind = Backend::URING;
+				return;
+			}
+
+			this->epfd = epoll_create1(EPOLL_CLOEXEC);
+			if (this->epfd < 0) {
+				throw PrttyError(string("could not create epoll instance: ") + strerror(errno));
+			}
+#			else
+			(void) prefer;
+			(void) entries;
+			(void) registered;
+#			endif
+		}
+
+		batch_writer(const batch_writer &) = delete;
+		batch_writer &operator=(const batch_writer &) = delete;
+
+		~batch_writer() {
+#			ifdef __linux__
+			if (this->ring >= 0) {
+				close(this->ring);
+			}
+			if (this->rings && this->rings != MAP_FAILED) {
+				munmap(this->rings, this->ringsSize);
+			}
+			if (this->cqRing && this->cqRing != MAP_FAILED) {
+				munmap(this->cqRing, this->cqRingSize);
+			}
+			if (this->sqes && this->sqes != MAP_FAILED) {
+				munmap(this->sqes, this->sqesSize);
+			}
+			if (this->arena && this->arena != MAP_FAILED) {
+				munmap(this->arena, this->arenaSize);
+			}
+			if (this->epfd >= 0) {
+				close(this->epfd);
+			}
+#			endif
+		}
+
+		// queues `f` for `fd`; nothing is written until `submit()`
+		void write(int fd, frame f) {
+			if (f->empty()) {
+				return;
+			}
+
+			Channel &c = this->channels[fd];
+			Op op{move(f), nullptr, -1};
+			op.data = op.f->data();
+
+#			ifdef __linux__
+			if (this->kind == Backend::URING && this->arenaSize > 0) {
+				this->placeInArena(op);
+			}
+#			endif
+
+			c.queue.push_back(move(op));
+			++this->queuedWrites;
+			if (!c.busy && c.queue.size() == 1) {
+				this->dirty.push_back(fd);
+			}
+		}
+
+		/*
+			starts everything queued and collects whatever has already
+			finished. never blocks (unless an fd does under the epoll
+			backend).
+		*/
+		void submit() {
+#			ifdef PRTTY_TRACE
+			impl::TraceSpan span("batch_writer::submit", "output");
+			span.note("writes", this->queuedWrites);
+#			endif
+#			ifdef __linux__
+			if (this->kind == Backend::URING) {
+				this->submitRing();
+				return;
+			}
+#			endif
+			this->submitEpoll(0);
+		}
+
+		/*
+			submits, then waits up to `timeout` for every queued write
+			to finish. returns whether they all did.
+		*/
+		bool wait(chrono::milliseconds timeout) {
+#			ifdef PRTTY_TRACE
+			impl::TraceSpan span("batch_writer::wait", "output");
+#			endif
+			auto deadline = chrono::steady_clock::now() + timeout;
+			this->submit();
+
+			while (this->queuedWrites > 0) {
+				auto left = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now());
+				if (left.count() <= 0) {
+					return false;
+				}
+
+#				ifdef __linux__
+				if (this->kind == Backend::URING) {
+					struct pollfd p = {this->ring, POLLIN, 0};
+					++this->calls;
+					::poll(&p, 1, static_cast<int>(left.count()));
+					this->submitRing();
+					continue;
+				}
+#				endif
+				this->submitEpoll(static_cast<int>(left.count()));
+			}
+
+			return true;
+		}
+
+		/*
+			forgets `fd`, which has been or is about to be closed, so that
+			the number can be reused; anything still queued for it is
+			dropped. under io_uring, a write already in flight finishes
+			(or fails) first and is then dropped too.
+		*/
+		void forget(int fd) {
+			auto it = this->channels.find(fd);
+			if (it == this->channels.end()) {
+				return;
+			}
+			Channel &c = it->second;
+
+			this->dirty.erase(remove(this->dirty.begin(), this->dirty.end(), fd), this->dirty.end());
+
+#			ifdef __linux__
+			if (this->kind == Backend::URING && c.busy) {
+				// the kernel still has the front write; reap() drops it
+				while (c.queue.size() > 1) {
+					this->release(c.queue.back());
+					c.queue.pop_back();
+					--this->queuedWrites;
+				}
+				c.awaitWritable = false;
+				c.forgotten = true;
+				return;
+			}
+			if (c.watched) {
+				// fails harmlessly if `fd` is already closed
+				++this->calls;
+				epoll_ctl(this->epfd, EPOLL_CTL_DEL, fd, nullptr);
+			}
+#			else
+			this->watching.erase(remove(this->watching.begin(), this->watching.end(), fd), this->watching.end());
+#			endif
+
+			if (c.busy && this->kind == Backend::EPOLL) {
+				--this->armed;
+			}
+			while (!c.queue.empty()) {
+				this->release(c.queue.front());
+				c.queue.pop_front();
+				--this->queuedWrites;
+			}
+			this->channels.erase(it);
+		}
+
+		Backend backend() const {
+			return this->kind;
+		}
+
+		// writes queued or in flight
+		size_t pending() const {
+			return this->queuedWrites;
+		}
+
+		// syscalls made so far, for comparing backends
+		size_t syscalls() const {
+			return this->calls;
+		}
+
+		// writes that failed (their fd's queue was dropped)
+		size_t errors() const {
+			return this->failures;
+		}
+
+	private:
+		struct Op {
+			frame f;
+			const char *data; // in the registered buffer, or the frame itself
+			int buffer; // registered buffer index, or -1
+		};
+
+		struct Channel {
+			deque<Op> queue;
+			size_t offset = 0;
+			bool busy = false; // write in flight, or waiting to become writable
+			bool watched = false; // registered with epoll
+			bool awaitWritable = false; // poll before the next write
+			bool forgotten = false; // forget()ten with a write in flight
+		};
+
+		void release(const Op &op) {
+#			ifdef __linux__
+			if (op.buffer >= 0) {
+				this->releaseArena(op.f);
+			}
+#			else
+			(void) op;
+#			endif
+		}
+
+		// called once a write has completely finished
+		void finished(Channel &c) {
+			this->release(c.queue.front());
+			c.queue.pop_front();
+			c.offset = 0;
+			--this->queuedWrites;
+		}
+
+		void fail(Channel &c) {
+			++this->failures;
+			while (!c.queue.empty()) {
+				this->finished(c);
+			}
+			c.busy = false;
+		}
+
+#		ifdef __linux__
+		// a frame's copy in the registered buffer, shared by every
+		// write of it until the last one finishes
+		struct Slot {
+			size_t offset;
+			size_t size;
+			size_t refs;
+		};
+
+		static const uint64_t pollFlag = uint64_t(1) << 32;
+
+		bool setupRing(unsigned entries, size_t registered) {
+			struct io_uring_params p;
+			memset(&p, 0, sizeof(p));
+
+			int fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+			if (fd < 0) {
+				return false;
+			}
+			this->ring = fd;
+
+			size_t sqSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+			size_t cqSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+			bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+
+			this->ringsSize = single ? max(sqSize, cqSize) : sqSize;
+			this->rings = mmap(nullptr, this->ringsSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+			if (this->rings == MAP_FAILED) {
+				return this->abandonRing();
+			}
+
+			char *cq = static_cast<char *>(this->rings);
+			if (!single) {
+				this->cqRingSize = cqSize;
+				this->cqRing = mmap(nullptr, cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+				if (this->cqRing == MAP_FAILED) {
+					return this->abandonRing();
+				}
+				cq = static_cast<char *>(this->cqRing);
+			}
+
+			this->sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+			this->sqes = mmap(nullptr, this->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+			if (this->sqes == MAP_FAILED) {
+				return this->abandonRing();
+			}
+
+			char *sq = static_cast<char *>(this->rings);
+			this->sqHead = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+			this->sqTail = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+			this->sqMask = *reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+			this->sqArray = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+			this->sqEntries = p.sq_entries;
+
+			this->cqHead = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+			this->cqTail = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+			this->cqMask = *reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+			this->cqes = reinterpret_cast<struct io_uring_cqe *>(cq + p.cq_off.cqes);
+			this->cqEntries = p.cq_entries;
+
+			// the registered buffer is optional; without it frames are
+			// just written from their own memory
+			if (registered > 0) {
+				this->arena = mmap(nullptr, registered, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+				if (this->arena != MAP_FAILED) {
+					struct iovec iov = {this->arena, registered};
+					if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, &iov, 1) == 0) {
+						this->arenaSize = registered;
+						this->arenaFree[0] = registered;
+					} else {
+						munmap(this->arena, registered);
+						this->arena = nullptr;
+					}
+				} else {
+					this->arena = nullptr;
+				}
+			}
+
+			return true;
+		}
+
+		bool abandonRing() {
+			close(this->ring);
+			this->ring = -1;
+			return false;
+		}
+
+		/*
+			copies a frame into the registered buffer, once per frame.
+			slots are keyed by the frame itself, which keeps it (and so
+			its address) alive for as long as the slot is in use, and
+			are handed back one by one, so an fd that never drains only
+			pins its own frames.
+		*/
+		void placeInArena(Op &op) {
+			auto found = this->arenaSlots.find(op.f);
+			if (found != this->arenaSlots.end()) {
+				++found->second.refs;
+				op.data = static_cast<char *>(this->arena) + found->second.offset;
+				op.buffer = 0;
+				return;
+			}
+
+			// first fit
+			size_t size = (op.f->length() + 63) & ~size_t(63);
+			auto hole = this->arenaFree.begin();
+			while (hole != this->arenaFree.end() && hole->second < size) {
+				++hole;
+			}
+			if (hole == this->arenaFree.end()) {
+				return;
+			}
+
+			size_t offset = hole->first;
+			if (hole->second > size) {
+				this->arenaFree[offset + size] = hole->second - size;
+			}
+			this->arenaFree.erase(hole);
+
+			char *at = static_cast<char *>(this->arena) + offset;
+			memcpy(at, op.f->data(), op.f->length());
+			this->arenaSlots.emplace(op.f, Slot{offset, size, 1});
+			op.data = at;
+			op.buffer = 0;
+		}
+
+		void releaseArena(const frame &f) {
+			auto found = this->arenaSlots.find(f);
+			if (--found->second.refs > 0) {
+				return;
+			}
+
+			size_t offset = found->second.offset;
+			size_t size = found->second.size;
+			this->arenaSlots.erase(found);
+
+			// merge with the holes either side
+			auto next = this->arenaFree.lower_bound(offset);
+			if (next != this->arenaFree.end() && next->first == offset + size) {
+				size += next->second;
+				next = this->arenaFree.erase(next);
+			}
+			if (next != this->arenaFree.begin()) {
+				auto prev = next;
+				--prev;
+				if (prev->first + prev->second == offset) {
+					prev->second += size;
+					return;
+				}
+			}
+			this->arenaFree.emplace_hint(next, offset, size);
+		}
+
+		int enter(unsigned submit, unsigned wait) {
+			++this->calls;
+			return static_cast<int>(syscall(__NR_io_uring_enter, this->ring, submit, wait, wait > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0));
+		}
+
+		void submitRing() {
+			this->reap();
+
+			while (!this->dirty.empty()) {
+				unsigned batch = 0;
+				unsigned tail = *this->sqTail;
+
+				while (!this->dirty.empty() && this->inflight < this->cqEntries
+						&& tail - __atomic_load_n(this->sqHead, __ATOMIC_ACQUIRE) < this->sqEntries) {
+					int fd = this->dirty.front();
+					this->dirty.pop_front();
+					this->prepare(fd, tail++);
+					++batch;
+				}
+
+				__atomic_store_n(this->sqTail, tail, __ATOMIC_RELEASE);
+
+				// out of room: wait for some completions to free it up
+				this->enter(batch, this->inflight >= this->cqEntries ? 1 : 0);
+				this->reap();
+			}
+		}
+
+		void prepare(int fd, unsigned tail) {
+			Channel &c = this->channels[fd];
+			unsigned index = tail & this->sqMask;
+			struct io_uring_sqe *sqe = static_cast<struct io_uring_sqe *>(this->sqes) + index;
+			memset(sqe, 0, sizeof(*sqe));
+
+			sqe->fd = fd;
+			if (c.awaitWritable) {
+				c.awaitWritable = false;
+				sqe->opcode = IORING_OP_POLL_ADD;
+				sqe->poll32_events = POLLOUT;
+				sqe->user_data = static_cast<uint32_t>(fd) | pollFlag;
+			} else {
+				const Op &op = c.queue.front();
+				sqe->opcode = op.buffer >= 0 ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+				sqe->addr = reinterpret_cast<uint64_t>(op.data + c.offset);
+				sqe->len = static_cast<unsigned>(op.f->length() - c.offset);
+				sqe->buf_index = static_cast<uint16_t>(op.buffer >= 0 ? op.buffer : 0);
+				sqe->off = static_cast<uint64_t>(-1); // current position, as write(2) would
+				sqe->user_data = static_cast<uint32_t>(fd);
+			}
+
+			this->sqArray[index] = index;
+			c.busy = true;
+			++this->inflight;
+		}
+
+		void reap() {
+			unsigned head = *this->cqHead;
+			unsigned tail = __atomic_load_n(this->cqTail, __ATOMIC_ACQUIRE);
+
+			for (; head != tail; ++head) {
+				const struct io_uring_cqe &cqe = this->cqes[head & this->cqMask];
+				int fd = static_cast<int>(cqe.user_data & 0xffffffff);
+				bool poll = (cqe.user_data & pollFlag) != 0;
+				--this->inflight;
+
+				Channel &c = this->channels[fd];
+				c.busy = false;
+
+				if (c.forgotten) {
+					// whatever happened to it, the write is no longer wanted
+					this->finished(c);
+					c.forgotten = false;
+					if (c.queue.empty()) {
+						this->channels.erase(fd);
+					} else {
+						this->dirty.push_back(fd);
+					}
+					continue;
+				}
+
+				if (poll) {
+					// retry the write whether that was POLLOUT or an error
+					if (!c.queue.empty()) {
+						this->dirty.push_back(fd);
+					}
+					continue;
+				}
+
+				if (cqe.res == -EAGAIN || cqe.res == -EINTR) {
+					// wait for POLLOUT before trying again
+					c.awaitWritable = true;
+					this->dirty.push_back(fd);
+					continue;
+				}
+
+				if (cqe.res < 0) {
+					this->fail(c);
+					continue;
+				}
+
+				c.offset += static_cast<size_t>(cqe.res);
+				if (c.offset >= c.queue.front().f->length()) {
+					this->finished(c);
+				}
+				if (!c.queue.empty()) {
+					this->dirty.push_back(fd);
+				}
+			}
+
+			__atomic_store_n(this->cqHead, head, __ATOMIC_RELEASE);
+		}
+
+#		endif
+
+		void submitEpoll(int timeout) {
+			if (this->armed > 0) {
+				this->readyToWrite(this->dirty.empty() ? timeout : 0);
+			}
+
+			while (!this->dirty.empty()) {
+				int fd = this->dirty.front();
+				this->dirty.pop_front();
+				this->writeChannel(fd, this->channels[fd]);
+			}
+		}
+
+		void writeChannel(int fd, Channel &c) {
+			while (!c.queue.empty()) {
+				struct iovec iov[64];
+				int n = 0;
+				for (auto it = c.queue.begin(); it != c.queue.end() && n < 64; ++it, ++n) {
+					size_t skip = n == 0 ? c.offset : 0;
+					iov[n].iov_base = const_cast<char *>(it->data + skip);
+					iov[n].iov_len = it->f->length() - skip;
+				}
+
+				++this->calls;
+				ssize_t written = ::writev(fd, iov, n);
+				if (written < 0) {
+					if (errno == EINTR) {
+						continue;
+					}
+					if (errno == EAGAIN || errno == EWOULDBLOCK) {
+						if (!this->watch(fd, c)) {
+							this->fail(c);
+							return;
+						}
+						c.busy = true;
+						++this->armed;
+						return;
+					}
+					this->fail(c);
+					return;
+				}
+
+				size_t left = static_cast<size_t>(written);
+				while (left > 0) {
+					size_t rest = c.queue.front().f->length() - c.offset;
+					if (left < rest) {
+						c.offset += left;
+						break;
+					}
+					left -= rest;
+					this->finished(c);
+				}
+			}
+		}
+
+		// waits for `fd` to become writable
+		bool watch(int fd, Channel &c) {
+#			ifdef __linux__
+			struct epoll_event ev;
+			ev.events = EPOLLOUT | EPOLLONESHOT;
+			ev.data.fd = fd;
+			++this->calls;
+			int rc = epoll_ctl(this->epfd, c.watched ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev);
+			if (rc != 0 && errno == ENOENT && c.watched) {
+				// closing the fd dropped it from the epoll set; this is
+				// a reused number that was never forget()ten
+				++this->calls;
+				rc = epoll_ctl(this->epfd, EPOLL_CTL_ADD, fd, &ev);
+			}
+			if (rc != 0) {
+				return false;
+			}
+			c.watched = true;
+#			else
+			(void) c;
+			this->watching.push_back(fd);
+#			endif
+			return true;
+		}
+
+		// queues up whichever watched fds have become writable
+		void readyToWrite(int timeout) {
+			++this->calls;
+#			ifdef __linux__
+			struct epoll_event events[64];
+			int n = epoll_wait(this->epfd, events, 64, timeout);
+			for (int i = 0; i < n; i++) {
+				int fd = events[i].data.fd;
+				this->channels[fd].busy = false;
+				this->dirty.push_back(fd);
+				--this->armed;
+			}
+#			else
+			vector<struct pollfd> fds;
+			for (int fd : this->watching) {
+				fds.push_back({fd, POLLOUT, 0});
+			}
+			if (::poll(fds.data(), static_cast<nfds_t>(fds.size()), timeout) <= 0) {
+				return;
+			}
+
+			this->watching.clear();
+			for (auto &p : fds) {
+				if (p.revents == 0) {
+					this->watching.push_back(p.fd);
+					continue;
+				}
+				// an error shows up when the write is retried
+				this->channels[p.fd].busy = false;
+				this->dirty.push_back(p.fd);
+				--this->armed;
+			}
+#			endif
+		}
+
+		Backend kind;
+		unordered_map<int, Channel> channels;
+		deque<int> dirty;
+		size_t queuedWrites = 0;
+		size_t calls = 0;
+		size_t failures = 0;
+
+#		ifdef __linux__
+		// io_uring
+		int ring = -1;
+		void *rings = nullptr;
+		size_t ringsSize = 0;
+		void *cqRing = nullptr;
+		size_t cqRingSize = 0;
+		void *sqes = nullptr;
+		size_t sqesSize = 0;
+
+		unsigned *sqHead = nullptr;
+		unsigned *sqTail = nullptr;
+		unsigned *sqArray = nullptr;
+		unsigned sqMask = 0;
+		unsigned sqEntries = 0;
+
+		unsigned *cqHead = nullptr;
+		unsigned *cqTail = nullptr;
+		struct io_uring_cqe *cqes = nullptr;
+		unsigned cqMask = 0;
+		unsigned cqEntries = 0;
+		unsigned inflight = 0;
+
+		void *arena = nullptr;
+		size_t arenaSize = 0;
+		unordered_map<frame, Slot> arenaSlots;
+		map<size_t, size_t> arenaFree; // offset -> length
+
+		// epoll
+		int epfd = -1;
+#		else
+		vector<int> watching;
+#		endif
+		size_t armed = 0; // fds waiting to become writable
+	};
+}
+
+#endif
@@ -0,0 +1,307 @@
+#ifndef PRTTY_CAPNAMES_H
+#define PRTTY_CAPNAMES_H
+#pragma once
+
+/*
+	Looks standard capabilities up by name, for code that gets
+	them as strings (configuration files, bindings to other
+	languages) rather than as term's members. Both the long names
+	and terminfo's short ones work:
+
+		prtty::capability fg = prtty::find_capability("setaf");
+		if (fg && t.get_string(fg)) {
+			cout << t.get_string(fg)(1); // as t.set_a_foreground(1)
+		}
+
+	The names are in a perfect hash table, built from the same
+	lists as term's members the first time one is looked up. A
+	lookup after that hashes the name once, reads two tables and
+	compares one name, and never allocates.
+
+	Extended capabilities aren't in it; they're in term's
+	extended_* maps, by their short names.
+*/
+
+#include "./prtty.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+namespace prtty {
+	namespace impl {
+		struct CapabilityNames {
+			static const size_t booleans = 0
+#			define PRTTY_DO_BOOLEAN(name) + 1
+#			include "./prtty-booleans.inc"
+				;
+			static const size_t integers = 0
+#			define PRTTY_DO_INTEGER(name) + 1
+#			include "./prtty-integers.inc"
+				;
+			static const size_t strings = 0
+#			define PRTTY_DO_STRING(name) + 1
+#			include "./prtty-strings.inc"
+				;
+			static const size_t count = booleans + integers + strings;
+
+			// where a capability's names are in the tables below
+			static size_t position(capability cap) {
+				switch (cap.type) {
+				case capability::Type::BOOLEAN:
+					return cap.index < booleans ? cap.index : count;
+				case capability::Type::INTEGER:
+					return cap.index < integers ? booleans + cap.index : count;
+				case capability::Type::STRING:
+					return cap.index < strings ? booleans + integers + cap.index : count;
+				default:
+					return count;
+				}
+			}
+
+			static capability at(size_t position) {
+				if (position < booleans) {
+					return capability(capability::Type::BOOLEAN, static_cast<uint16_t>(position));
+				}
+				if (position < booleans + integers) {
+					return capability(capability::Type::INTEGER, static_cast<uint16_t>(position - booleans));
+				}
+				return capability(capability::Type::STRING, static_cast<uint16_t>(position - booleans - integers));
+			}
+
+			// booleans, integers and strings, each in the order of their .inc
+			static const char * const * longNames() {
+				static const char * const names[] = {
+#					define PRTTY_DO_BOOLEAN(name) #name,
+#					include "./prtty-booleans.inc"
+#					define PRTTY_DO_INTEGER(name) #name,
+#					include "./prtty-integers.inc"
+#					define PRTTY_DO_STRING(name) #name,
+#					include "./prtty-strings.inc"
+				};
+				static_assert(sizeof(names) / sizeof(names[0]) == count, "a long name for every capability");
+				return names;
+			}
+
+			static const char * const * shortNames() {
+				static const char * const names[] = {
+					// booleans
+					"bw", "am", "xsb", "xhp", "xenl", "eo", "gn", "hc", "km", "hs", "in", "da", "db", "mir", "msgr",
+					"os", "eslok", "xt", "hz", "ul", "xon", "nxon", "mc5i", "chts", "nrrmc", "npc", "ndscr", "ccc",
+					"bce", "hls", "xhpa", "crxm", "daisy", "xvpa", "sam", "cpix", "lpix",
+					// integers
+					"cols", "it", "lines", "lm", "xmc", "pb", "vt", "wsl", "nlab", "lh", "lw", "ma", "wnum",
+					"colors", "pairs", "ncv", "bufsz", "spinv", "spinh", "maddr", "mjump", "mcs", "mls", "npins",
+					"orc", "orl", "orhi", "orvi", "cps", "widcs", "btns", "bitwin", "bitype",
+					// strings
+					"cbt", "bel", "cr", "csr", "tbc", "clear", "el", "ed", "hpa", "cmdch", "cup", "cud1", "home",
+					"civis", "cub1", "mrcup", "cnorm", "cuf1", "ll", "cuu1", "cvvis", "dch1", "dl1", "dsl", "hd",
+					"smacs", "blink", "bold", "smcup", "smdc", "dim", "smir", "invis", "prot", "rev", "smso", "smul",
+					"ech", "rmacs", "sgr0", "rmcup", "rmdc", "rmir", "rmso", "rmul", "flash", "ff", "fsl", "is1",
+					"is2", "is3", "if", "ich1", "il1", "ip", "kbs", "ktbc", "kclr", "kctab", "kdch1", "kdl1",
+					"kcud1", "krmir", "kel", "ked", "kf0", "kf1", "kf10", "kf2", "kf3", "kf4", "kf5", "kf6", "kf7",
+					"kf8", "kf9", "khome", "kich1", "kil1", "kcub1", "kll", "knp", "kpp", "kcuf1", "kind", "kri",
+					"khts", "kcuu1", "rmkx", "smkx", "lf0", "lf1", "lf10", "lf2", "lf3", "lf4", "lf5", "lf6", "lf7",
+					"lf8", "lf9", "rmm", "smm", "nel", "pad", "dch", "dl", "cud", "ich", "indn", "il", "cub", "cuf",
+					"rin", "cuu", "pfkey", "pfloc", "pfx", "mc0", "mc4", "mc5", "rep", "rs1", "rs2", "rs3", "rf",
+					"rc", "vpa", "sc", "ind", "ri", "sgr", "hts", "wind", "ht", "tsl", "uc", "hu", "iprog", "ka1",
+					"ka3", "kb2", "kc1", "kc3", "mc5p", "rmp", "acsc", "pln", "kcbt", "smxon", "rmxon", "smam",
+					"rmam", "xonc", "xoffc", "enacs", "smln", "rmln", "kbeg", "kcan", "kclo", "kcmd", "kcpy", "kcrt",
+					"kend", "kent", "kext", "kfnd", "khlp", "kmrk", "kmsg", "kmov", "knxt", "kopn", "kopt", "kprv",
+					"kprt", "krdo", "kref", "krfr", "krpl", "krst", "kres", "ksav", "kspd", "kund", "kBEG", "kCAN",
+					"kCMD", "kCPY", "kCRT", "kDC", "kDL", "kslt", "kEND", "kEOL", "kEXT", "kFND", "kHLP", "kHOM",
+					"kIC", "kLFT", "kMSG", "kMOV", "kNXT", "kOPT", "kPRV", "kPRT", "kRDO", "kRPL", "kRIT", "kRES",
+					"kSAV", "kSPD", "kUND", "rfi", "kf11", "kf12", "kf13", "kf14", "kf15", "kf16", "kf17", "kf18",
+					"kf19", "kf20", "kf21", "kf22", "kf23", "kf24", "kf25", "kf26", "kf27", "kf28", "kf29", "kf30",
+					"kf31", "kf32", "kf33", "kf34", "kf35", "kf36", "kf37", "kf38", "kf39", "kf40", "kf41", "kf42",
+					"kf43", "kf44", "kf45", "kf46", "kf47", "kf48", "kf49", "kf50", "kf51", "kf52", "kf53", "kf54",
+					"kf55", "kf56", "kf57", "kf58", "kf59", "kf60", "kf61", "kf62", "kf63", "el1", "mgc", "smgl",
+					"smgr", "fln", "sclk", "dclk", "rmclk", "cwin", "wingo", "hup", "dial", "qdial", "tone", "pulse",
+					"hook", "pause", "wait", "u0", "u1", "u2", "u3", "u4", "u5", "u6", "u7", "u8", "u9", "op", "oc",
+					"initc", "initp", "scp", "setf", "setb", "cpi", "lpi", "chr", "cvr", "defc", "swidm", "sdrfq",
+					"sitm", "slm", "smicm", "snlq", "snrmq", "sshm", "ssubm", "ssupm", "sum", "rwidm", "ritm", "rlm",
+					"rmicm", "rshm", "rsubm", "rsupm", "rum", "mhpa", "mcud1", "mcub1", "mcuf1", "mvpa", "mcuu1",
+					"porder", "mcud", "mcub", "mcuf", "mcuu", "scs", "smgb", "smgbp", "smglp", "smgrp", "smgt",
+					"smgtp", "sbim", "scsd", "rbim", "rcsd", "subcs", "supcs", "docr", "zerom", "csnm", "kmous",
+					"minfo", "reqmp", "getm", "setaf", "setab", "pfxl", "devt", "csin", "s0ds", "s1ds", "s2ds",
+					"s3ds", "smglr", "smgtb", "birep", "binel", "bicr", "colornm", "defbi", "endbi", "setcolor",
+					"slines", "dispc", "smpch", "rmpch", "smsc", "rmsc", "pctrm", "scesc", "scesa", "ehhlm", "elhlm",
+					"elohlm", "erhlm", "ethlm", "evhlm", "sgr1", "slength",
+				};
+				static_assert(sizeof(names) / sizeof(names[0]) == count, "a short name for every capability");
+				return names;
+			}
+		};
+
+		/*
+			a perfect hash over all the long and short names: a name's
+			hash picks one of the buckets, and the displacement chosen
+			for that bucket when the table was built picks a slot no
+			other name hashes to.
+		*/
+		class CapabilityIndex {
+		public:
+			CapabilityIndex() {
+				const char * const *longNames = CapabilityNames::longNames();
+				const char * const *shortNames = CapabilityNames::shortNames();
+				for (size_t i = 0; i < CapabilityNames::count; i++) {
+					capability cap = CapabilityNames::at(i);
+					this->keys.push_back(Key{longNames[i], strlen(longNames[i]), cap});
+					// a few are the same both ways, e.g. "lines"
+					if (strcmp(longNames[i], shortNames[i]) != 0) {
+						this->keys.push_back(Key{shortNames[i], strlen(shortNames[i]), cap});
+					}
+				}
+
+				for (uint64_t seed = 0; !this->build(seed); seed++) {
+					if (seed == maxSeeds) {
+						throw PrttyError("could not build the capability name table");
+					}
+				}
+			}
+
+			CapabilityIndex(const CapabilityIndex &) = delete;
+			CapabilityIndex & operator =(const CapabilityIndex &) = delete;
+
+			capability find(const char *name, size_t length) const noexcept(true) {
+				uint64_t h = hash(name, length, this->seed);
+				uint16_t k = this->slots[slot(h, this->displacements[h & (bucketCount - 1)])];
+				if (k == empty) {
+					return capability();
+				}
+				const Key &key = this->keys[k];
+				if (key.length != length || memcmp(key.name, name, length) != 0) {
+					return capability();
+				}
+				return key.cap;
+			}
+
+		private:
+			static const size_t slotCount = 2048;
+			static const size_t bucketCount = 512;
+			static const uint16_t empty = 0xFFFF;
+			static const uint64_t maxSeeds = 64;
+
+			struct Key {
+				const char *name;
+				size_t length;
+				capability cap;
+			};
+
+			// eight bytes at a time (names are short), then a finalizer so the bucket and slot bits are all mixed
+			static uint64_t hash(const char *s, size_t length, uint64_t seed) noexcept(true) {
+				const uint64_t k = 0x9E3779B97F4A7C15ull;
+				uint64_t h = (seed + length) * k;
+				for (; length >= 8; s += 8, length -= 8) {
+					uint64_t w;
+					memcpy(&w, s, 8);
+					h = (h ^ w) * k;
+					h ^= h >> 29;
+				}
+				uint64_t w = 0;
+				for (size_t i = 0; i < length; i++) {
+					w |= uint64_t(static_cast<unsigned char>(s[i])) << (i * 8);
+				}
+				h = (h ^ w) * k;
+				h ^= h >> 33;
+				h *= 0xFF51AFD7ED558CCDull;
+				h ^= h >> 33;
+				return h;
+			}
+
+			// the step is odd, so a bucket's displacements reach every slot
+			static size_t slot(uint64_t h, uint16_t displacement) noexcept(true) {
+				return static_cast<size_t>(((h >> 16) + displacement * ((h >> 40) | 1)) & (slotCount - 1));
+			}
+
+			// places the largest buckets first, while there's the most room
+			bool build(uint64_t seed) {
+				this->seed = seed;
+				vector<uint64_t> hashes;
+				vector<vector<uint16_t>> buckets(bucketCount);
+				for (size_t i = 0; i < this->keys.size(); i++) {
+					hashes.push_back(hash(this->keys[i].name, this->keys[i].length, seed));
+					buckets[hashes[i] & (bucketCount - 1)].push_back(static_cast<uint16_t>(i));
+				}
+
+				vector<size_t> order;
+				for (size_t b = 0; b < bucketCount; b++) {
+					order.push_back(b);
+				}
+				stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+					return buckets[a].size() > buckets[b].size();
+				});
+
+				for (auto &s : this->slots) {
+					s = empty;
+				}
+				for (auto &d : this->displacements) {
+					d = 0;
+				}
+
+				vector<size_t> taken;
+				for (size_t b : order) {
+					bool placed = buckets[b].empty();
+					for (size_t d = 0; d < slotCount && !placed; d++) {
+						taken.clear();
+						placed = true;
+						for (uint16_t k : buckets[b]) {
+							size_t s = slot(hashes[k], static_cast<uint16_t>(d));
+							if (this->slots[s] != empty || std::find(taken.begin(), taken.end(), s) != taken.end()) {
+								placed = false;
+								break;
+							}
+							taken.push_back(s);
+						}
+						if (placed) {
+							for (size_t i = 0; i < taken.size(); i++) {
+								this->slots[taken[i]] = buckets[b][i];
+							}
+							this->displacements[b] = static_cast<uint16_t>(d);
+						}
+					}
+					if (!placed) {
+						return false;
+					}
+				}
+				return true;
+			}
+
+			vector<Key> keys;
+			array<uint16_t, slotCount> slots;
+			array<uint16_t, bucketCount> displacements;
+			uint64_t seed = 0;
+		};
+
+		inline const CapabilityIndex & capabilityIndex() {
+			static CapabilityIndex index;
+			return index;
+		}
+	}
+
+	// a standard capability by its long or short name, e.g. "set_a_foreground" or "setaf"; false if there's none
+	inline capability find_capability(const char *name, size_t length) {
+		return impl::capabilityIndex().find(name, length);
+	}
+
+	inline capability find_capability(const string &name) {
+		return find_capability(name.data(), name.length());
+	}
+
+	inline capability find_capability(const char *name) {
+		return find_capability(name, strlen(name));
+	}
+
+	// its names, or null if it isn't one
+	inline const char * long_name(capability cap) {
+		size_t at = impl::CapabilityNames::position(cap);
+		return at < impl::CapabilityNames::count ? impl::CapabilityNames::longNames()[at] : nullptr;
+	}
+
+	inline const char * short_name(capability cap) {
+		size_t at = impl::CapabilityNames::position(cap);
+		return at < impl::CapabilityNames::count ? impl::CapabilityNames::shortNames()[at] : nullptr;
+	}
+}
+
+#endif
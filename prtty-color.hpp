@@ -0,0 +1,389 @@
+#ifndef PRTTY_COLOR_H
+#define PRTTY_COLOR_H
+#pragma once
+
+/*
+	Palette helpers for degrading colors to what a terminal
+	can actually show (see `max_colors`).
+
+	The palettes are the xterm defaults: the 16 ANSI colors,
+	then either the 4x4x4 cube and 8 grays of the 88-color
+	variant or the 6x6x6 cube and 24 grays of the 256-color one.
+	Real terminals let users change these, so nearest-color
+	matches are only ever as good as that assumption (or pass
+	the real palette, e.g. as queried with OSC 4).
+
+	`color_quantizer` maps 24-bit colors onto the palette of a
+	terminal without direct color, for drawing truecolor themes
+	on it:
+
+		prtty::color_quantizer q(term);
+		q.quantize(row, indices, width);
+		for (size_t x = 0; x < width; x++) {
+			out += q.foreground(indices[x]);
+			...
+
+	Rather than searching the palette for every cell, it looks
+	colors up in a 32x32x32 grid whose cells keep every entry
+	that could be nearest to some color within them, so the
+	answer is always the exhaustive search's (prtty_bench's
+	color group confirms it, as an exact_fraction of 1). The
+	grid for each default palette is built once per process
+	and shared.
+*/
+
+#include "./prtty.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+
+namespace prtty {
+	struct rgb {
+		uint8_t r;
+		uint8_t g;
+		uint8_t b;
+	};
+
+	namespace impl {
+		inline rgb paletteColor(int colors, int index) {
+			static const uint8_t ansi[16][3] = {
+				{0, 0, 0}, {205, 0, 0}, {0, 205, 0}, {205, 205, 0},
+				{0, 0, 238}, {205, 0, 205}, {0, 205, 205}, {229, 229, 229},
+				{127, 127, 127}, {255, 0, 0}, {0, 255, 0}, {255, 255, 0},
+				{92, 92, 255}, {255, 0, 255}, {0, 255, 255}, {255, 255, 255}
+			};
+
+			if (index < 16) {
+				return rgb{ansi[index][0], ansi[index][1], ansi[index][2]};
+			}
+
+			index -= 16;
+
+			if (colors == 88) {
+				static const uint8_t cube[4] = {0, 139, 205, 255};
+				static const uint8_t grays[8] = {46, 92, 115, 139, 162, 185, 208, 231};
+				if (index < 64) {
+					return rgb{cube[index / 16], cube[(index / 4) % 4], cube[index % 4]};
+				}
+				uint8_t v = grays[(index - 64) & 7];
+				return rgb{v, v, v};
+			}
+
+			static const uint8_t cube[6] = {0, 95, 135, 175, 215, 255};
+			if (index < 216) {
+				return rgb{cube[index / 36], cube[(index / 6) % 6], cube[index % 6]};
+			}
+			uint8_t v = static_cast<uint8_t>(8 + 10 * ((index - 216) % 24));
+			return rgb{v, v, v};
+		}
+
+		// weighted squared distance; cheap and close enough to perceptual
+		inline int colorDistance(rgb a, rgb b) {
+			int dr = a.r - b.r;
+			int dg = a.g - b.g;
+			int db = a.b - b.b;
+			return 2 * dr * dr + 4 * dg * dg + 3 * db * db;
+		}
+
+		// exhaustive search over the first `colors` palette entries
+		inline int nearestColor(int colors, rgb c) {
+			int best = 0;
+			int bestDistance = -1;
+			int limit = colors > 256 ? 256 : colors;
+			for (int i = 0; i < limit; i++) {
+				int d = colorDistance(c, paletteColor(colors, i));
+				if (bestDistance < 0 || d < bestDistance) {
+					best = i;
+					bestDistance = d;
+				}
+			}
+			return best;
+		}
+
+		/*
+			a 32x32x32 grid over the colors, each cell holding the
+			palette entries that could be nearest to some color in
+			it. how much nearer one entry is than another is linear
+			in the color, for colorDistance, so it's at its best at
+			one of the cell's corners; entries that can't beat the
+			one nearest the middle there are left out. usually that
+			leaves just one, which the cell then holds itself;
+			otherwise it points at a short list to pick from.
+		*/
+		class PaletteGrid {
+		public:
+			static const int bits = 5;
+
+			explicit PaletteGrid(const vector<rgb> &palette)
+					: palette(palette) {
+				const int shift = 8 - bits;
+				const int side = 1 << bits;
+				const size_t n = palette.size();
+
+				// squared distances along each channel from every entry to
+				// each cell's middle and its two faces
+				vector<int> middles(3 * side * n), lows(3 * side * n), highs(3 * side * n);
+				for (int ch = 0; ch < 3; ch++) {
+					const int weight = ch == 0 ? 2 : ch == 1 ? 4 : 3;
+					for (int v = 0; v < side; v++) {
+						int lo = v << shift;
+						int hi = lo + (1 << shift) - 1;
+						int mid = lo | 1 << (shift - 1);
+						for (size_t i = 0; i < n; i++) {
+							int c = ch == 0 ? palette[i].r : ch == 1 ? palette[i].g : palette[i].b;
+							size_t at = (size_t(ch) * side + size_t(v)) * n + i;
+							middles[at] = weight * (mid - c) * (mid - c);
+							lows[at] = weight * (lo - c) * (lo - c);
+							highs[at] = weight * (hi - c) * (hi - c);
+						}
+					}
+				}
+
+				// from the middle to the furthest corner of a cell
+				const double radius = sqrt((2.0 + 4.0 + 3.0) * (1 << (shift - 1)) * (1 << (shift - 1)));
+
+				map<vector<uint8_t>, size_t> seen;
+				vector<uint8_t> candidates;
+				vector<int> distances(n);
+				for (int r = 0; r < side; r++) {
+					for (int g = 0; g < side; g++) {
+						for (int b = 0; b < side; b++) {
+							const size_t rows[3] = {size_t(r) * n, (size_t(side) + size_t(g)) * n, (2 * size_t(side) + size_t(b)) * n};
+							size_t best = 0;
+							for (size_t i = 0; i < n; i++) {
+								distances[i] = middles[rows[0] + i] + middles[rows[1] + i] + middles[rows[2] + i];
+								if (distances[i] < distances[best]) {
+									best = i;
+								}
+							}
+
+							/*
+								the most each entry can be nearer than `best` somewhere
+								in the cell. those further from the middle than `best`
+								by more than the cell is wide can't be, and are skipped.
+							*/
+							double reach = sqrt(double(distances[best])) + 2 * radius;
+							int far = static_cast<int>(reach * reach) + 1;
+							candidates.clear();
+							for (size_t i = 0; i < n; i++) {
+								if (distances[i] > far) {
+									continue;
+								}
+								int margin = 0;
+								for (size_t row : rows) {
+									margin += min(lows[row + i] - lows[row + best], highs[row + i] - highs[row + best]);
+								}
+								if (i == best || margin <= 0) {
+									candidates.push_back(static_cast<uint8_t>(i));
+								}
+							}
+
+							rgb middle = {
+								static_cast<uint8_t>(r << shift | 1 << (shift - 1)),
+								static_cast<uint8_t>(g << shift | 1 << (shift - 1)),
+								static_cast<uint8_t>(b << shift | 1 << (shift - 1))
+							};
+							uint16_t &cell = this->cells[key(middle)];
+							if (candidates.size() == 1) {
+								cell = candidates[0];
+								continue;
+							}
+							// neighboring cells often have the same ones
+							auto known = seen.find(candidates);
+							if (known == seen.end()) {
+								known = seen.emplace(candidates, this->starts.size()).first;
+								this->starts.push_back(static_cast<uint32_t>(this->lists.size()));
+								this->lists.push_back(static_cast<uint8_t>(candidates.size() - 1));
+								this->lists.insert(this->lists.end(), candidates.begin(), candidates.end());
+							}
+							cell = static_cast<uint16_t>(256 + known->second);
+						}
+					}
+				}
+			}
+
+			static size_t key(rgb c) {
+				const int shift = 8 - bits;
+				return static_cast<size_t>((c.r >> shift) << (2 * bits) | (c.g >> shift) << bits | (c.b >> shift));
+			}
+
+			uint8_t nearest(rgb c) const {
+				uint16_t cell = this->cells[key(c)];
+				return cell < 256 ? static_cast<uint8_t>(cell) : this->pick(cell - 256, c);
+			}
+
+			// the same nearest entry as an exhaustive search (first of any ties)
+			uint8_t pick(size_t list, rgb c) const {
+				const uint8_t *candidates = &this->lists[this->starts[list] + 1];
+				size_t count = size_t(this->lists[this->starts[list]]) + 1;
+				uint8_t best = candidates[0];
+				int bestDistance = colorDistance(c, this->palette[best]);
+				for (size_t i = 1; i < count; i++) {
+					int d = colorDistance(c, this->palette[candidates[i]]);
+					if (d < bestDistance) {
+						best = candidates[i];
+						bestDistance = d;
+					}
+				}
+				return best;
+			}
+
+			uint16_t cells[1 << (3 * bits)];
+
+			size_t ambiguous() const {
+				size_t n = 0;
+				for (uint16_t c : this->cells) {
+					n += c >= 256;
+				}
+				return n;
+			}
+
+		private:
+			vector<rgb> palette;
+			vector<uint8_t> lists; // each a count - 1 then the candidates, in palette order
+			vector<uint32_t> starts;
+		};
+
+		// the default palette of a terminal with `colors` colors (at most 256)
+		inline vector<rgb> defaultPalette(int colors) {
+			vector<rgb> palette;
+			for (int i = 0; i < min(colors, 256); i++) {
+				palette.push_back(paletteColor(colors, i));
+			}
+			return palette;
+		}
+
+		// shared by every quantizer in the process
+		inline shared_ptr<const PaletteGrid> defaultGrid(int colors) {
+			static mutex lock;
+			static map<int, shared_ptr<const PaletteGrid>> grids;
+			lock_guard<mutex> guard(lock);
+			shared_ptr<const PaletteGrid> &grid = grids[colors];
+			if (!grid) {
+				grid = make_shared<PaletteGrid>(defaultPalette(colors));
+			}
+			return grid;
+		}
+	}
+
+	class color_quantizer {
+	public:
+		/*
+			for `t`'s max_colors, with the default palette or the
+			terminal's own (in index order; entries past max_colors,
+			or 256, are ignored). a terminal with no colors maps
+			everything to 0, and its sequences are empty.
+
+			the sequences are evaluated with state of the quantizer's
+			own, so `t` is left alone and can be in use elsewhere.
+		*/
+		explicit color_quantizer(const term &t, const vector<rgb> &palette = vector<rgb>())
+				: count(t.max_colors > 256 ? 256 : max(t.max_colors, 0))
+				, isDirect(t.max_colors >= (1 << 24) || t.extended_booleans.count("RGB") > 0) {
+			this->setup(palette.empty() ? palette : vector<rgb>(palette.begin(), palette.begin() + min(palette.size(), static_cast<size_t>(this->count))));
+
+			impl::Data data;
+			for (int i = 0; i < this->count; i++) {
+				this->fg[i] = sequence(t.set_a_foreground, data, i);
+				this->bg[i] = sequence(t.set_a_background, data, i);
+			}
+		}
+
+		// for a palette alone, with no sequences
+		explicit color_quantizer(int colors, const vector<rgb> &palette = vector<rgb>())
+				: count(colors > 256 ? 256 : max(colors, 0))
+				, isDirect(false) {
+			this->setup(palette);
+		}
+
+		int colors() const {
+			return this->count;
+		}
+
+		// whether the terminal takes 24-bit colors itself (and this isn't needed)
+		bool direct() const {
+			return this->isDirect;
+		}
+
+		uint8_t nearest(rgb c) const {
+			return this->grid->nearest(c);
+		}
+
+		/*
+			the palette index of each of `n` colors. most cells hold
+			their answer outright, so the loop is unrolled to keep
+			several table loads in flight (without a gather instruction
+			they're one at a time anyway), and the few colors whose
+			cells have more than one candidate are settled after.
+		*/
+		void quantize(const rgb *in, uint8_t *out, size_t n) const {
+			const uint16_t *cells = this->grid->cells;
+			size_t i = 0;
+			unsigned int ambiguous = 0;
+			for (; i + 4 <= n; i += 4) {
+				uint16_t c0 = cells[impl::PaletteGrid::key(in[i])];
+				uint16_t c1 = cells[impl::PaletteGrid::key(in[i + 1])];
+				uint16_t c2 = cells[impl::PaletteGrid::key(in[i + 2])];
+				uint16_t c3 = cells[impl::PaletteGrid::key(in[i + 3])];
+				out[i] = static_cast<uint8_t>(c0);
+				out[i + 1] = static_cast<uint8_t>(c1);
+				out[i + 2] = static_cast<uint8_t>(c2);
+				out[i + 3] = static_cast<uint8_t>(c3);
+				ambiguous |= c0 | c1 | c2 | c3;
+			}
+			for (; i < n; i++) {
+				uint16_t c = cells[impl::PaletteGrid::key(in[i])];
+				out[i] = static_cast<uint8_t>(c);
+				ambiguous |= c;
+			}
+
+			if (ambiguous >= 256) {
+				for (i = 0; i < n; i++) {
+					uint16_t c = cells[impl::PaletteGrid::key(in[i])];
+					if (c >= 256) {
+						out[i] = this->grid->pick(c - 256u, in[i]);
+					}
+				}
+			}
+		}
+
+		// set_a_foreground/set_a_background of a palette index, evaluated once up front
+		const string & foreground(uint8_t index) const {
+			return this->fg[index];
+		}
+
+		const string & background(uint8_t index) const {
+			return this->bg[index];
+		}
+
+	private:
+		static string sequence(const impl::SequenceStreamer &cap, impl::Data &data, int index) {
+			string out;
+			if (cap) {
+				impl::StringBuf buf(out);
+				ostream os(&buf);
+				cap.evaluate(data, os, index);
+			}
+			return out;
+		}
+
+		void setup(const vector<rgb> &palette) {
+			if (!palette.empty()) {
+				vector<rgb> own(palette.begin(), palette.begin() + min(palette.size(), static_cast<size_t>(256)));
+				this->count = static_cast<int>(own.size());
+				this->grid = make_shared<impl::PaletteGrid>(own);
+			} else {
+				this->grid = impl::defaultGrid(max(this->count, 1));
+			}
+		}
+
+		int count;
+		bool isDirect;
+		shared_ptr<const impl::PaletteGrid> grid;
+		string fg[256];
+		string bg[256];
+	};
+}
+
+#endif
@@ -0,0 +1,289 @@
+#ifndef PRTTY_DATABASE_H
+#define PRTTY_DATABASE_H
+#pragma once
+
+/*
+	An index over a whole terminfo directory, for tools that
+	list, search or preload many entries rather than look up one.
+
+	Constructing a database scans the tree once: every compiled
+	entry is read into one in-memory arena (entries linked under
+	several names are read once) and indexed by all of its names
+	and aliases, along with a summary of its booleans and numbers
+	so it can be searched without being loaded.
+
+		prtty::database db("/usr/share/terminfo");
+
+		for (auto e : db.select([](const prtty::database::entry &e) {
+			return e.caps.max_colors >= 256;
+		})) {
+			cout << e->name << endl;
+		}
+
+		prtty::term t = db.load("xterm");
+
+	Loading parses straight from the arena, so it never touches
+	the filesystem, and `load_all()` parses every entry at once
+	on a pool of threads.
+
+	POSIX only. The index isn't updated when the directory changes;
+	construct a new one.
+*/
+
+#include "./prtty.hpp"
+#include "./prtty-pool.hpp"
+
+#include <algorithm>
+#include <unordered_map>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace prtty {
+	class database {
+	public:
+		// an entry's standard booleans and numbers (-1 when absent)
+		struct summary {
+#			define PRTTY_DO_BOOLEAN(name) bool name;
+#			include "./prtty-booleans.inc"
+#			define PRTTY_DO_INTEGER(name) int name;
+#			include "./prtty-integers.inc"
+		};
+
+		struct entry {
+			string name; // the first of its names
+			vector<string> aliases; // the others, and any other names it's linked under
+			string description;
+			string path;
+			size_t offset; // of its compiled bytes in the arena
+			size_t size;
+			summary caps;
+		};
+
+		explicit database(const string &basePath)
+				: base(basePath) {
+			DIR *top = opendir(basePath.c_str());
+			if (!top) {
+				throw PrttyError("could not open terminfo directory: " + basePath);
+			}
+
+			// files already read, by device and inode, to fold links together
+			map<pair<dev_t, ino_t>, size_t> seen;
+
+			while (struct dirent *sub = readdir(top)) {
+				// entries live in directories named by their first character or its hex code
+				if (sub->d_name[0] == '.' || strlen(sub->d_name) > 2) {
+					continue;
+				}
+
+				string dir = basePath + "/" + sub->d_name;
+				DIR *d = opendir(dir.c_str());
+				if (!d) {
+					continue;
+				}
+				while (struct dirent *f = readdir(d)) {
+					if (f->d_name[0] != '.') {
+						this->add(dir + "/" + f->d_name, f->d_name, seen);
+					}
+				}
+				closedir(d);
+			}
+			closedir(top);
+
+			for (size_t i = 0; i < this->items.size(); i++) {
+				this->byName.emplace(this->items[i].name, i);
+				for (auto &alias : this->items[i].aliases) {
+					this->byName.emplace(alias, i);
+				}
+			}
+		}
+
+		database(const database &) = delete;
+		database & operator =(const database &) = delete;
+
+		size_t size() const {
+			return this->items.size();
+		}
+
+		const vector<entry> & entries() const {
+			return this->items;
+		}
+
+		const string & path() const {
+			return this->base;
+		}
+
+		// by any of its names; null if there's no such entry
+		const entry * find(const string &name) const {
+			auto itr = this->byName.find(name);
+			return itr == this->byName.end() ? nullptr : &this->items[itr->second];
+		}
+
+		// every entry for which `pred(const entry &)` is true
+		template <typename Pred>
+		vector<const entry *> select(Pred pred) const {
+			vector<const entry *> result;
+			for (auto &e : this->items) {
+				if (pred(e)) {
+					result.push_back(&e);
+				}
+			}
+			return result;
+		}
+
+		// the compiled bytes of an entry, as they are on disk
+		string compiled(const entry &e) const {
+			return this->arena.substr(e.offset, e.size);
+		}
+
+		term load(const string &name) const {
+			const entry *e = this->find(name);
+			if (!e) {
+				throw PrttyError("no such terminal in " + this->base + ": " + name);
+			}
+			return prtty::load(name, this->compiled(*e));
+		}
+
+		/*
+			loads every entry, in the order of `entries()`, parsing on
+			`threads` threads (0 for one per core). entries that fail
+			to parse are left null.
+		*/
+		vector<unique_ptr<term>> load_all(unsigned threads = 0) const {
+			vector<unique_ptr<term>> terms(this->items.size());
+			impl::WorkPool pool(threads > 0 ? threads : max(1u, thread::hardware_concurrency()));
+
+			function<void(size_t)> task = [&](size_t i) {
+				const entry &e = this->items[i];
+				try {
+					terms[i].reset(new term(prtty::load(e.name, this->compiled(e))));
+				} catch (const PrttyError &) {
+				}
+			};
+			pool.run(this->items.size(), task);
+
+			return terms;
+		}
+
+	private:
+		void add(const string &path, const string &filename, map<pair<dev_t, ino_t>, size_t> &seen) {
+			int fd = ::open(path.c_str(), O_RDONLY);
+			if (fd < 0) {
+				return;
+			}
+
+			struct stat st;
+			if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+				::close(fd);
+				return;
+			}
+
+			auto id = make_pair(st.st_dev, st.st_ino);
+			auto known = seen.find(id);
+			if (known != seen.end()) {
+				::close(fd);
+				this->alias(this->items[known->second], filename);
+				return;
+			}
+
+			size_t offset = this->arena.length();
+			size_t size = static_cast<size_t>(st.st_size);
+			this->arena.resize(offset + size);
+			size_t got = 0;
+			while (got < size) {
+				ssize_t n = ::read(fd, &this->arena[offset + got], size - got);
+				if (n <= 0) {
+					break;
+				}
+				got += static_cast<size_t>(n);
+			}
+			::close(fd);
+			this->arena.resize(offset + got);
+
+			entry e;
+			e.path = path;
+			e.offset = offset;
+			e.size = got;
+			if (!summarize(this->arena.substr(offset, got), e)) {
+				this->arena.resize(offset);
+				return;
+			}
+
+			this->alias(e, filename);
+			seen[id] = this->items.size();
+			this->items.push_back(move(e));
+		}
+
+		static void alias(entry &e, const string &name) {
+			if (name != e.name && std::find(e.aliases.begin(), e.aliases.end(), name) == e.aliases.end()) {
+				e.aliases.push_back(name);
+			}
+		}
+
+		// reads the names, booleans and numbers; false if it isn't an entry
+		static bool summarize(const string &file, entry &e) {
+			try {
+				impl::Reader rd(file);
+				int16_t magic = rd.s16();
+				if (magic != 0432 && magic != 01036) {
+					return false;
+				}
+				bool wide = magic == 01036;
+
+				size_t nameSize = rd.count();
+				size_t boolSize = rd.count();
+				size_t numCount = rd.count();
+				rd.count();
+				rd.count();
+
+				vector<string> names;
+				rd.need(nameSize);
+				impl::split(string(&file[rd.pos], nameSize > 0 ? nameSize - 1 : 0), '|', names);
+				rd.skip(nameSize);
+				if (names.empty()) {
+					return false;
+				}
+
+				// the last name is a description, if there's more than one
+				e.name = names[0];
+				if (names.size() > 1) {
+					e.description = names.back();
+					names.pop_back();
+				}
+				e.aliases.assign(names.begin() + 1, names.end());
+
+				vector<uint8_t> bools;
+				for (size_t i = 0; i < boolSize; i++) {
+					bools.push_back(rd.u8());
+				}
+				rd.align();
+
+				vector<int> nums;
+				for (size_t i = 0; i < numCount; i++) {
+					int v = wide ? rd.s32() : rd.s16();
+					nums.push_back(v < 0 ? -1 : v);
+				}
+
+				size_t i = 0;
+#				define PRTTY_DO_BOOLEAN(name) e.caps.name = i < bools.size() && bools[i] == 1; ++i;
+#				include "./prtty-booleans.inc"
+				i = 0;
+#				define PRTTY_DO_INTEGER(name) e.caps.name = i < nums.size() ? nums[i] : -1; ++i;
+#				include "./prtty-integers.inc"
+			} catch (const PrttyError &) {
+				return false;
+			}
+
+			return true;
+		}
+
+		string base;
+		string arena;
+		vector<entry> items;
+		unordered_map<string, size_t> byName;
+	};
+}
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef PRTTY_EVAL_H
+#define PRTTY_EVAL_H
+#pragma once
+
+/*
+	Evaluates a whole list of capabilities at once, for frame
+	builders that would otherwise stream thousands of
+	`term.cap(args)` calls one at a time.
+
+	Each of those calls sets up its own evaluation (and, as a
+	deferred call, a std::function), and saves and restores the
+	stream's flags around it. Here the output buffer and its
+	stream are set up once, and each record only resets what the
+	next program mustn't see: the stack, the dynamic variables
+	and the parameters. Static variables carry over, as they do
+	between separate calls.
+
+		prtty::eval_record frame[] = {
+			{&term.cursor_address, {3, 4}},
+			{&term.set_a_foreground, {100}},
+			{&term.exit_attribute_mode, {}}
+		};
+
+		prtty::evaluator ev;
+		const string &bytes = ev.run(frame, 3);
+
+	`offsets()` says where each record's bytes start, so the
+	output can be spliced or a part of it re-sent.
+
+	Records are evaluated with their term's compiled programs but
+	the evaluator's own state, so evaluators (one per thread) can
+	share a term.
+*/
+
+#include "./prtty.hpp"
+
+namespace prtty {
+	struct eval_record {
+		const impl::SequenceStreamer *cap;
+		int args[9];
+	};
+
+	class evaluator {
+	public:
+		evaluator()
+				: sb(out)
+				, os(&sb) {
+		}
+
+		evaluator(const evaluator &) = delete;
+		evaluator & operator =(const evaluator &) = delete;
+
+		// evaluates `count` records back to back, replacing the last output
+		const string & run(const eval_record *records, size_t count) {
+#			ifdef PRTTY_TRACE
+			impl::TraceSpan span("evaluator::run", "eval");
+			span.note("records", count);
+#			endif
+			this->out.clear();
+			this->starts.clear();
+			this->starts.reserve(count + 1);
+
+			for (size_t i = 0; i < count; i++) {
+				this->starts.push_back(this->out.length());
+
+				const impl::SequenceStreamer *cap = records[i].cap;
+				if (cap && *cap) {
+					this->data.bind(records[i].args, 9);
+					cap->run(this->data, this->os);
+				}
+			}
+
+			this->starts.push_back(this->out.length());
+			return this->out;
+		}
+
+		const string & run(const vector<eval_record> &records) {
+			return this->run(records.data(), records.size());
+		}
+
+		const string & output() const {
+			return this->out;
+		}
+
+		/*
+			offsets()[i] is where record i's bytes start in the output;
+			one more entry than there were records, the last being the
+			output's length.
+		*/
+		const vector<size_t> & offsets() const {
+			return this->starts;
+		}
+
+	private:
+		impl::Data data;
+		string out;
+		impl::StringBuf sb;
+		ostream os;
+		vector<size_t> starts;
+	};
+}
+
+#endif
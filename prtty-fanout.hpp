@@ -0,0 +1,207 @@
+#ifndef PRTTY_FANOUT_H
+#define PRTTY_FANOUT_H
+#pragma once
+
+/*
+	Sends the same frames to many clients (shared dashboards,
+	multiplexer-style attach) while only rendering each frame
+	once per distinct terminal.
+
+	Clients are grouped by the entry their `term` was loaded
+	from, so copies of one loaded term share a group; the same
+	TERM loaded twice makes two. Every client in a group is
+	handed the same immutable, refcounted buffer; nothing is
+	copied per client.
+
+	A client's sink returns false when it can't take a frame
+	(its connection is backed up, say). It's then considered
+	behind: frames are skipped for it until it accepts one again,
+	at which point it's first sent a resync - attributes reset
+	and the cursor moved to where the frame expects it - so the
+	frame's relative movements land in the right place. Clients
+	that keep up never pay for this.
+
+	Not thread-safe; render and deliver from one thread. Sinks
+	may attach and detach clients (themselves included) while a
+	frame is delivered: a client attached then gets the frame,
+	and one detached doesn't.
+*/
+
+#include "./prtty.hpp"
+
+#include <list>
+
+namespace prtty {
+	class fanout {
+	public:
+		typedef shared_ptr<const string> frame;
+		typedef function<bool(const frame &)> sink;
+
+		// returns an id to pass to `detach`
+		size_t attach(const term &t, sink s) {
+			Group *group = nullptr;
+			for (auto &g : this->groups) {
+				if (g.t.same_entry(t)) {
+					group = &g;
+					break;
+				}
+			}
+
+			if (!group) {
+				this->groups.push_back(Group{t, {}});
+				group = &this->groups.back();
+			}
+
+			// new clients know nothing about the screen yet
+			group->clients.push_back(Client{this->nextId, move(s), true, false});
+			return this->nextId++;
+		}
+
+		void detach(size_t id) {
+			for (auto g = this->groups.begin(); g != this->groups.end(); ++g) {
+				for (auto c = g->clients.begin(); c != g->clients.end(); ++c) {
+					if (c->id != id || c->detached) {
+						continue;
+					}
+
+					// mid-broadcast it's only marked, and dropped once that's done
+					if (this->broadcasting) {
+						c->detached = true;
+						this->swept = false;
+						return;
+					}
+
+					g->clients.erase(c);
+					if (g->clients.empty()) {
+						this->groups.erase(g);
+					}
+					return;
+				}
+			}
+		}
+
+		/*
+			renders and delivers a frame. `render(const term &, ostream &)`
+			is called once per group; `row` and `col` are where the
+			frame expects the cursor to be when it starts.
+		*/
+		template <typename Render>
+		void broadcast(int row, int col, Render render) {
+			string bytes;
+			impl::StringBuf buf(bytes);
+			ostream os(&buf);
+
+			// detaching only marks clients until the broadcast's over, however it ends
+			struct Done {
+				~Done() {
+					self->broadcasting = false;
+					if (!self->swept) {
+						self->sweep();
+					}
+				}
+
+				fanout *self;
+			} done{this};
+			this->broadcasting = true;
+
+			for (auto &g : this->groups) {
+				bytes.clear();
+				render(g.t, os);
+				frame f = std::make_shared<const string>(move(bytes));
+				++this->rendered;
+
+				frame resync;
+				for (auto &c : g.clients) {
+					if (c.detached) {
+						continue;
+					}
+					if (c.behind) {
+						if (!resync) {
+							resync = this->resync(g.t, row, col);
+						}
+						if (!c.write(resync)) {
+							continue;
+						}
+						++this->resyncs;
+					}
+					if (!c.detached) {
+						c.behind = !c.write(f);
+					}
+				}
+
+				bytes = string();
+			}
+		}
+
+		size_t clients() const {
+			size_t n = 0;
+			for (auto &g : this->groups) {
+				for (auto &c : g.clients) {
+					n += !c.detached;
+				}
+			}
+			return n;
+		}
+
+		// number of distinct terminals frames are rendered for
+		size_t terminals() const {
+			return this->groups.size();
+		}
+
+		// total frames rendered and resyncs sent so far
+		size_t renders() const {
+			return this->rendered;
+		}
+
+		size_t resynced() const {
+			return this->resyncs;
+		}
+
+	private:
+		struct Client {
+			size_t id;
+			sink write;
+			bool behind;
+			bool detached;
+		};
+
+		// a list, so that sinks attaching clients don't move the others
+		struct Group {
+			term t;
+			list<Client> clients;
+		};
+
+		// drops the clients detached during a broadcast
+		void sweep() {
+			for (auto g = this->groups.begin(); g != this->groups.end();) {
+				g->clients.remove_if([](const Client &c) { return c.detached; });
+				g = g->clients.empty() ? this->groups.erase(g) : next(g);
+			}
+			this->swept = true;
+		}
+
+		static frame resync(const term &t, int row, int col) {
+			string bytes;
+			impl::StringBuf buf(bytes);
+			ostream os(&buf);
+
+			if (t.exit_attribute_mode) {
+				os << t.exit_attribute_mode;
+			}
+			if (t.cursor_address) {
+				os << t.cursor_address(row, col);
+			}
+
+			return std::make_shared<const string>(move(bytes));
+		}
+
+		list<Group> groups;
+		size_t nextId = 0;
+		size_t rendered = 0;
+		size_t resyncs = 0;
+		bool broadcasting = false;
+		bool swept = true;
+	};
+}
+
+#endif
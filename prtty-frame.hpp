@@ -0,0 +1,210 @@
+#ifndef PRTTY_FRAME_H
+#define PRTTY_FRAME_H
+#pragma once
+
+/*
+	Frames: everything one screen update writes, collected and
+	sent to the terminal in one piece so that it's painted in
+	one piece.
+
+		prtty::frame f(term);
+
+		f.begin();
+		f.put(term.cursor_address, 3, 10) << "hello";
+		f.end();
+		f.write(fd);
+
+	Where the entry advertises synchronized output (the extended
+	`Sync` string, DEC private mode 2026), the frame is opened
+	and closed with it, and the terminal holds off repainting
+	until the whole frame is in. Elsewhere, a frame that moves
+	the cursor around is wrapped in cursor_invisible and
+	cursor_normal instead, so that at least the cursor doesn't
+	flicker across the screen while it's drawn. Both are left
+	out of empty frames, and the cursor isn't touched if the
+	application keeps it hidden anyway (`cursorHidden(true)`).
+
+	The frame is built in one buffer, room for the opening left
+	at its start, so that `write()` is a single write(2) however
+	it turned out. Capabilities should go in through `put` (or
+	be streamed without arguments), which evaluates them with
+	the frame's own state and tells it when they move the cursor.
+*/
+
+#include "./prtty.hpp"
+
+#include <cerrno>
+
+#include <poll.h>
+#include <unistd.h>
+
+namespace prtty {
+	class frame {
+	public:
+		explicit frame(const term &t)
+				: t(t)
+				, sb(buf)
+				, os(&sb) {
+			auto eval = [&](const impl::SequenceStreamer &cap, int arg) {
+				string s;
+				impl::StringBuf to(s);
+				ostream out(&to);
+				cap.evaluate(this->data, out, arg);
+				return s;
+			};
+
+			auto sync = t.extended_strings.find("Sync");
+			if (sync != t.extended_strings.end()) {
+				this->syncBegin = eval(sync->second, 1);
+				this->syncEnd = eval(sync->second, 2);
+			}
+			if (t.cursor_invisible && t.cursor_normal) {
+				this->hide = eval(t.cursor_invisible, 0);
+				this->show = eval(t.cursor_normal, 0);
+			}
+
+			// anything that takes the cursor somewhere other than just after what it wrote
+			const impl::SequenceStreamer *motion[] = {
+				&t.cursor_address, &t.cursor_home, &t.cursor_to_ll, &t.column_address, &t.row_address,
+				&t.cursor_up, &t.cursor_down, &t.cursor_left, &t.cursor_right,
+				&t.parm_up_cursor, &t.parm_down_cursor, &t.parm_left_cursor, &t.parm_right_cursor,
+				&t.restore_cursor, &t.clear_screen, &t.change_scroll_region
+			};
+			for (auto cap : motion) {
+				if (*cap) {
+					this->moves.push_back(&cap->sequence());
+				}
+			}
+
+			this->gap = this->syncBegin.length() + this->hide.length();
+			this->begin();
+		}
+
+		// starts a new frame, dropping the last one
+		frame & begin() {
+			this->buf.assign(this->gap, '\0');
+			this->start = this->gap;
+			this->moved = false;
+			this->hidden = false;
+			return *this;
+		}
+
+		// text, numbers, etc.
+		template <typename T>
+		frame & operator <<(const T &value) {
+			this->os << value;
+			return *this;
+		}
+
+		frame & operator <<(const impl::SequenceStreamer &cap) {
+			return this->put(cap);
+		}
+
+		template <typename... Args>
+		frame & put(const impl::SequenceStreamer &cap, Args... args) {
+			if (!this->moved) {
+				this->moved = find(this->moves.begin(), this->moves.end(), &cap.sequence()) != this->moves.end();
+			}
+			cap.evaluate(this->data, this->os, args...);
+			return *this;
+		}
+
+		// finishes the frame off; it's ready to write from here until the next begin()
+		frame & end() {
+			if (this->buf.length() == this->gap) {
+				return *this;
+			}
+
+			// hiding the cursor is only worth its bytes when the terminal would show it jumping around
+			this->hidden = this->syncBegin.empty() && !this->hide.empty() && this->moved && !this->keepHidden;
+			size_t hideLength = this->hidden ? this->hide.length() : 0;
+			this->start = this->gap - this->syncBegin.length() - hideLength;
+			this->buf.replace(this->start, this->syncBegin.length(), this->syncBegin);
+			this->buf.replace(this->start + this->syncBegin.length(), hideLength, this->hide, 0, hideLength);
+
+			if (this->hidden) {
+				this->buf += this->show;
+			}
+			this->buf += this->syncEnd;
+			return *this;
+		}
+
+		const char * bytes() const noexcept(true) {
+			return this->buf.data() + this->start;
+		}
+
+		size_t length() const noexcept(true) {
+			return this->buf.length() - this->start;
+		}
+
+		string str() const {
+			return string(this->bytes(), this->length());
+		}
+
+		// writes the frame in one go, waiting out a nonblocking fd that's full
+		void write(int fd) const {
+#			ifdef PRTTY_TRACE
+			impl::TraceSpan span("frame::write", "output");
+			span.note("bytes", this->length());
+#			endif
+			const char *p = this->bytes();
+			size_t left = this->length();
+			while (left > 0) {
+				ssize_t written = ::write(fd, p, left);
+				if (written < 0) {
+					if (errno == EINTR) {
+						continue;
+					}
+					if (errno == EAGAIN || errno == EWOULDBLOCK) {
+						pollfd pfd = {fd, POLLOUT, 0};
+						::poll(&pfd, 1, -1);
+						continue;
+					}
+					throw PrttyError(string("write failed: ") + strerror(errno));
+				}
+				p += written;
+				left -= static_cast<size_t>(written);
+			}
+		}
+
+		// whether the terminal applies frames all at once
+		bool synchronized() const noexcept(true) {
+			return !this->syncBegin.empty();
+		}
+
+		// whether the last frame hid the cursor while it was drawn
+		bool hidCursor() const noexcept(true) {
+			return this->hidden;
+		}
+
+		// the application keeps the cursor hidden, so frames should leave it be
+		void cursorHidden(bool hidden) noexcept(true) {
+			this->keepHidden = hidden;
+		}
+
+		const term & terminal() const {
+			return this->t;
+		}
+
+	private:
+		const term &t;
+		impl::Data data;
+
+		string syncBegin;
+		string syncEnd;
+		string hide;
+		string show;
+		vector<const impl::Sequence *> moves;
+
+		string buf;
+		impl::StringBuf sb;
+		ostream os;
+		size_t gap = 0;
+		size_t start = 0;
+		bool moved = false;
+		bool hidden = false;
+		bool keepHidden = false;
+	};
+}
+
+#endif
@@ -0,0 +1,455 @@
+#ifndef PRTTY_INPUT_H
+#define PRTTY_INPUT_H
+#pragma once
+
+/*
+	Decodes raw bytes read from a terminal into key events
+	using the key_* capabilities of a loaded `term`.
+
+	The key sequences are compiled into a trie once, when the
+	`input` object is constructed. Runs of plain text are handed
+	back untouched (pointing into the caller's buffer) and are
+	found with a vectorized scan, so pastes cost next to nothing.
+
+	A lone ESC is ambiguous - it's either the escape key or the
+	start of a sequence that was split across reads. Bytes that
+	could still become a key are held back; `timeout()` tells you
+	how long to wait for more input (pass it to poll(2)) and
+	`expire()` resolves whatever is pending once that time is up.
+
+	If the terminal can report mouse events (it has `key_mouse`
+	or the `XM` extended capability), X10, SGR and urxvt reports
+	are decoded into MOUSE events. While dragging, terminals send
+	far more motion reports than anyone can draw; with
+	`coalesceMotion(true)` a run of identical-button motion
+	reports is collapsed into just the last one.
+*/
+
+#include "./prtty.hpp"
+#include "./prtty-mouse.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+
+namespace prtty {
+	struct key_event {
+		enum class Type {
+			TEXT,
+			KEY,
+			MOUSE
+		};
+
+		Type type;
+
+		// the raw bytes of the text run or key sequence. only
+		// valid for the duration of the callback.
+		const char *bytes;
+		size_t length;
+
+		// index into the string capability list (prtty-strings.inc)
+		// and its long name (e.g. "key_up"). KEY events only.
+		size_t capability;
+		const char *name;
+
+		// MOUSE events only.
+		mouse_event mouse;
+	};
+
+	class input {
+	public:
+		explicit input(const term &term, chrono::milliseconds escapeDelay = chrono::milliseconds(25))
+				: escapeDelay(escapeDelay)
+				, maxKeyLength(0)
+				, controlOnly(true)
+				, mouseCapable(false)
+				, mouseCapability(0)
+				, coalesce(false)
+				, pendingLength(0) {
+			vector<map<unsigned char, uint32_t>> tree(1);
+			vector<int32_t> accepts(1, -1);
+
+			size_t index = 0;
+#			define PRTTY_DO_STRING(name) \
+				if (&term.name == &term.key_mouse) this->mouseCapability = index; \
+				this->addKey(tree, accepts, index++, #name, term.name);
+#			include "./prtty-strings.inc"
+
+			this->mouseCapable = bool(term.key_mouse) || term.extended_strings.count("XM") > 0;
+			if (this->mouseCapable) {
+				// whatever key_mouse says, the terminal may have been
+				// switched to either encoding.
+				this->addMouse(tree, accepts, this->mouseCapability, "\x1b[M", mouse_event::Protocol::X10);
+				this->addMouse(tree, accepts, this->mouseCapability, "\x1b[<", mouse_event::Protocol::SGR);
+				this->maxKeyLength = max(this->maxKeyLength, static_cast<size_t>(maxMouseReport));
+			}
+
+			this->compile(tree, accepts);
+			this->held.resize(this->maxKeyLength * 2 + 1);
+		}
+
+		/*
+			decodes `len` bytes, calling `callback(const key_event &)`
+			for every text run and key found. a trailing partial
+			sequence is kept until more input arrives or it expires.
+		*/
+		template <typename Callback>
+		void feed(const char *buf, size_t len, Callback callback) {
+			const char *end = buf + len;
+
+			if (this->pendingLength > 0) {
+				size_t take = min(len, this->maxKeyLength);
+				memcpy(&this->held[this->pendingLength], buf, take);
+
+				const char *sbegin = this->held.data();
+				const char *send = sbegin + this->pendingLength + take;
+				const char *stop = this->decode(sbegin, send, sbegin + this->pendingLength, callback, false);
+				size_t used = static_cast<size_t>(stop - sbegin);
+
+				if (used < this->pendingLength) {
+					// still ambiguous; `take` covered all of `buf`.
+					this->pendingLength = static_cast<size_t>(send - stop);
+					memmove(&this->held[0], stop, this->pendingLength);
+					this->pendingSince = chrono::steady_clock::now();
+					return;
+				}
+
+				buf += used - this->pendingLength;
+				this->pendingLength = 0;
+			}
+
+			const char *stop = this->decode(buf, end, end, callback, false);
+			if (stop != end) {
+				this->pendingLength = static_cast<size_t>(end - stop);
+				memcpy(&this->held[0], stop, this->pendingLength);
+				this->pendingSince = chrono::steady_clock::now();
+			}
+		}
+
+		/*
+			milliseconds left before pending bytes should be expired,
+			0 if they're overdue, or -1 if nothing is pending.
+		*/
+		int timeout() const {
+			if (this->pendingLength == 0) {
+				return -1;
+			}
+
+			auto elapsed = chrono::steady_clock::now() - this->pendingSince;
+			auto left = chrono::duration_cast<chrono::milliseconds>(this->escapeDelay - elapsed).count();
+			return left > 0 ? static_cast<int>(left) : 0;
+		}
+
+		bool pending() const {
+			return this->pendingLength > 0;
+		}
+
+		void coalesceMotion(bool enable) {
+			this->coalesce = enable;
+		}
+
+		/*
+			resolves pending bytes as-is: the longest complete key
+			wins, anything else is emitted as text.
+		*/
+		template <typename Callback>
+		void expire(Callback callback) {
+			const char *begin = this->held.data();
+			const char *end = begin + this->pendingLength;
+			this->pendingLength = 0;
+			this->decode(begin, end, end, callback, true);
+		}
+
+	private:
+		struct Key {
+			size_t capability;
+			const char *name;
+			int mouse; // mouse_event::Protocol, or -1 for plain keys
+		};
+
+		static const size_t maxMouseReport = 32;
+
+		struct Node {
+			uint32_t edges;
+			uint32_t count;
+			int32_t key;
+		};
+
+		struct Edge {
+			unsigned char byte;
+			uint32_t next;
+		};
+
+		enum class Match {
+			NONE,
+			KEY,
+			PARTIAL
+		};
+
+		void addKey(vector<map<unsigned char, uint32_t>> &tree, vector<int32_t> &accepts, size_t capability, const char *name, const impl::SequenceStreamer &cap) {
+			if (strncmp(name, "key_", 4) != 0 || !cap) {
+				return;
+			}
+
+			string seq = cap;
+			if (seq.empty()) {
+				return;
+			}
+
+			uint32_t node = 0;
+			for (char c : seq) {
+				unsigned char b = static_cast<unsigned char>(c);
+				auto itr = tree[node].find(b);
+				if (itr == tree[node].end()) {
+					uint32_t next = static_cast<uint32_t>(tree.size());
+					tree[node][b] = next;
+					tree.emplace_back();
+					accepts.push_back(-1);
+					node = next;
+				} else {
+					node = itr->second;
+				}
+			}
+
+			// the first capability to claim a sequence keeps it
+			if (accepts[node] < 0) {
+				accepts[node] = static_cast<int32_t>(this->keys.size());
+				this->keys.push_back(Key{capability, name, -1});
+			}
+
+			this->maxKeyLength = max(this->maxKeyLength, seq.length());
+		}
+
+		void addMouse(vector<map<unsigned char, uint32_t>> &tree, vector<int32_t> &accepts, size_t capability, const char *seq, mouse_event::Protocol protocol) {
+			uint32_t node = 0;
+			for (const char *c = seq; *c; ++c) {
+				unsigned char b = static_cast<unsigned char>(*c);
+				auto itr = tree[node].find(b);
+				if (itr == tree[node].end()) {
+					uint32_t next = static_cast<uint32_t>(tree.size());
+					tree[node][b] = next;
+					tree.emplace_back();
+					accepts.push_back(-1);
+					node = next;
+				} else {
+					node = itr->second;
+				}
+			}
+
+			// takes over key_mouse's own entry, if that's where it landed
+			int32_t key = accepts[node];
+			if (key < 0 || this->keys[static_cast<size_t>(key)].capability == capability) {
+				if (key < 0) {
+					key = static_cast<int32_t>(this->keys.size());
+					accepts[node] = key;
+					this->keys.push_back(Key{capability, "key_mouse", -1});
+				}
+				this->keys[static_cast<size_t>(key)].mouse = static_cast<int>(protocol);
+			}
+		}
+
+		void compile(const vector<map<unsigned char, uint32_t>> &tree, const vector<int32_t> &accepts) {
+			fill(&this->root[0], &this->root[256], 0u);
+
+			this->nodes.resize(tree.size());
+			for (size_t i = 0; i < tree.size(); i++) {
+				Node &node = this->nodes[i];
+				node.edges = static_cast<uint32_t>(this->edges.size());
+				node.count = static_cast<uint32_t>(tree[i].size());
+				node.key = accepts[i];
+				for (auto &kv : tree[i]) {
+					this->edges.push_back(Edge{kv.first, kv.second});
+				}
+			}
+
+			for (auto &kv : tree[0]) {
+				this->root[kv.first] = kv.second;
+				if (kv.first >= 0x20 && kv.first != 0x7F) {
+					this->controlOnly = false;
+				}
+			}
+		}
+
+		// finds the next byte that could start a key sequence
+		const char * scan(const char *p, const char *end) const {
+			if (!this->controlOnly) {
+				while (p != end && !this->root[static_cast<unsigned char>(*p)]) {
+					++p;
+				}
+				return p;
+			}
+
+			for (;;) {
+				p = impl::findControl(p, end);
+				if (p == end || this->root[static_cast<unsigned char>(*p)]) {
+					return p;
+				}
+				++p;
+			}
+		}
+
+		Match match(const char *p, const char *end, size_t &len, int32_t &key) const {
+			uint32_t node = this->root[static_cast<unsigned char>(*p)];
+			size_t i = 1;
+			key = -1;
+			len = 0;
+
+			for (;;) {
+				const Node &n = this->nodes[node];
+				if (n.key >= 0) {
+					key = n.key;
+					len = i;
+				}
+
+				if (n.count == 0) {
+					break;
+				}
+
+				if (p + i == end) {
+					return Match::PARTIAL;
+				}
+
+				const Edge *e = &this->edges[n.edges];
+				const Edge *eend = e + n.count;
+				unsigned char b = static_cast<unsigned char>(p[i]);
+				for (; e != eend && e->byte != b; ++e);
+				if (e == eend) {
+					break;
+				}
+
+				node = e->next;
+				++i;
+			}
+
+			return key < 0 ? Match::NONE : Match::KEY;
+		}
+
+		static key_event makeEvent(key_event::Type type, const char *bytes, size_t length) {
+			key_event ev;
+			memset(&ev, 0, sizeof(ev));
+			ev.type = type;
+			ev.bytes = bytes;
+			ev.length = length;
+			return ev;
+		}
+
+		/*
+			decodes the mouse report whose introducer (of `len` bytes)
+			is at `p`. on success `len` becomes the length of the whole
+			report - or of the whole run of reports, when coalescing.
+		*/
+		impl::MouseParse mouse(mouse_event::Protocol protocol, const char *p, const char *end, size_t &len, key_event &ev) const {
+			size_t body;
+			impl::MouseParse r = impl::parseMouse(protocol, p + len, end, body, ev.mouse);
+			if (r != impl::MouseParse::OK) {
+				return r;
+			}
+
+			size_t intro = len;
+			len += body;
+
+			if (this->coalesce && ev.mouse.type == mouse_event::Type::MOTION) {
+				const char *last = p;
+				const char *q = p + len;
+				size_t n;
+				while ((n = impl::sameMouseReport(protocol, q, end, p, intro)) > 0) {
+					last = q;
+					q += n;
+				}
+
+				if (last != p) {
+					impl::parseMouse(protocol, last + intro, end, body, ev.mouse);
+					len = static_cast<size_t>(q - p);
+				}
+			}
+
+			return impl::MouseParse::OK;
+		}
+
+		template <typename Callback>
+		const char * decode(const char *begin, const char *end, const char *limit, Callback &callback, bool flush) const {
+			const char *p = begin;
+			const char *text = begin;
+
+			while (p < limit) {
+				p = this->scan(p, end);
+				if (p == end) {
+					break;
+				}
+
+				size_t len;
+				int32_t key;
+				Match m = this->match(p, end, len, key);
+				if (m == Match::PARTIAL && !flush) {
+					break;
+				}
+
+				key_event ev = makeEvent(key_event::Type::KEY, p, 0);
+				int protocol = key < 0 ? -1 : this->keys[static_cast<size_t>(key)].mouse;
+
+				if (key < 0 && this->mouseCapable && end - p > 2 && p[0] == '\x1b' && p[1] == '[' && p[2] >= '1' && p[2] <= '9') {
+					// possibly urxvt, which has no fixed introducer
+					len = 2;
+					protocol = static_cast<int>(mouse_event::Protocol::URXVT);
+				}
+
+				if (protocol >= 0) {
+					impl::MouseParse r = this->mouse(static_cast<mouse_event::Protocol>(protocol), p, end, len, ev);
+					if (r == impl::MouseParse::PARTIAL && !flush) {
+						break;
+					}
+					if (r == impl::MouseParse::OK) {
+						ev.type = key_event::Type::MOUSE;
+						ev.capability = this->mouseCapability;
+						ev.name = "key_mouse";
+					} else {
+						key = -1;
+					}
+				}
+
+				if (key < 0 && ev.type != key_event::Type::MOUSE) {
+					++p; // not a key after all; keep it in the text run
+					continue;
+				}
+
+				if (p != text) {
+					callback(makeEvent(key_event::Type::TEXT, text, static_cast<size_t>(p - text)));
+				}
+
+				ev.length = len;
+				if (ev.type == key_event::Type::KEY) {
+					const Key &k = this->keys[static_cast<size_t>(key)];
+					ev.capability = k.capability;
+					ev.name = k.name;
+				}
+				callback(ev);
+				p += len;
+				text = p;
+			}
+
+			if (p != text) {
+				callback(makeEvent(key_event::Type::TEXT, text, static_cast<size_t>(p - text)));
+			}
+
+			return p;
+		}
+
+		chrono::milliseconds escapeDelay;
+		size_t maxKeyLength;
+
+		uint32_t root[256];
+		vector<Node> nodes;
+		vector<Edge> edges;
+		vector<Key> keys;
+		bool controlOnly;
+		bool mouseCapable;
+		size_t mouseCapability;
+		bool coalesce;
+
+		vector<char> held;
+		size_t pendingLength;
+		chrono::steady_clock::time_point pendingSince;
+	};
+}
+
+#endif
@@ -0,0 +1,211 @@
+#ifndef PRTTY_MOUSE_H
+#define PRTTY_MOUSE_H
+#pragma once
+
+/*
+	Mouse report decoding for the three encodings terminals
+	actually send once mouse tracking is enabled (see the
+	`XM` extended capability):
+
+		X10/normal   ESC [ M Cb Cx Cy           (bytes offset by 32)
+		SGR (1006)   ESC [ < Cb ; Cx ; Cy M|m   (decimal)
+		urxvt (1015) ESC [ Cb ; Cx ; Cy M       (decimal, Cb offset by 32)
+
+	Nothing in here allocates; reports are decoded in place.
+	Normally you don't use this directly - `prtty::input`
+	hands these out as MOUSE events.
+*/
+
+#include <cstddef>
+#include <cstring>
+
+namespace prtty {
+	struct mouse_event {
+		enum class Type {
+			PRESS,
+			RELEASE,
+			MOTION,
+			WHEEL
+		};
+
+		enum class Protocol {
+			X10,
+			SGR,
+			URXVT
+		};
+
+		Type type;
+		Protocol protocol;
+
+		// 0-2 for left/middle/right, 3-6 for the wheel (up, down,
+		// left, right), 7+ for extra buttons. -1 if the protocol
+		// doesn't say (X10/urxvt releases, button-less motion).
+		int button;
+
+		// zero-based cell coordinates
+		int x;
+		int y;
+
+		bool shift;
+		bool meta;
+		bool control;
+	};
+
+	namespace impl {
+		enum class MouseParse {
+			INVALID,
+			OK,
+			PARTIAL
+		};
+
+		inline void decodeMouseButton(int cb, bool release, mouse_event &ev) {
+			int low = cb & 3;
+			ev.shift = (cb & 4) != 0;
+			ev.meta = (cb & 8) != 0;
+			ev.control = (cb & 16) != 0;
+
+			if (cb & 64) {
+				ev.type = (cb & 32) ? mouse_event::Type::MOTION : mouse_event::Type::WHEEL;
+				ev.button = ((cb & 128) ? 7 : 3) + low;
+				return;
+			}
+
+			if (cb & 128) {
+				ev.button = 7 + low;
+			} else {
+				ev.button = low == 3 ? -1 : low;
+			}
+
+			if (cb & 32) {
+				ev.type = mouse_event::Type::MOTION;
+			} else if (release || low == 3) {
+				ev.type = mouse_event::Type::RELEASE;
+			} else {
+				ev.type = mouse_event::Type::PRESS;
+			}
+		}
+
+		// parses a decimal field followed by `term` (or, if `alt` is
+		// non-zero, `alt`); `stop` receives the terminator.
+		inline MouseParse parseMouseField(const char *&p, const char *end, char term, char alt, int &value, char &stop) {
+			const char *start = p;
+			value = 0;
+			for (; p != end && *p >= '0' && *p <= '9'; ++p) {
+				if (p - start > 5) {
+					return MouseParse::INVALID;
+				}
+				value = value * 10 + (*p - '0');
+			}
+
+			if (p == end) {
+				return MouseParse::PARTIAL;
+			}
+			if (p == start || (*p != term && (alt == 0 || *p != alt))) {
+				return MouseParse::INVALID;
+			}
+
+			stop = *p++;
+			return MouseParse::OK;
+		}
+
+		/*
+			`p` points just past the protocol's introducer (ESC [ M,
+			ESC [ <, or ESC [ for urxvt). on success `len` is the
+			number of bytes consumed from `p`.
+		*/
+		inline MouseParse parseMouse(mouse_event::Protocol protocol, const char *p, const char *end, size_t &len, mouse_event &ev) {
+			ev.protocol = protocol;
+
+			if (protocol == mouse_event::Protocol::X10) {
+				if (end - p < 3) {
+					return MouseParse::PARTIAL;
+				}
+
+				const unsigned char *b = reinterpret_cast<const unsigned char *>(p);
+				if (b[0] < 32 || b[1] < 33 || b[2] < 33) {
+					return MouseParse::INVALID;
+				}
+
+				decodeMouseButton(b[0] - 32, false, ev);
+				ev.x = b[1] - 33;
+				ev.y = b[2] - 33;
+				len = 3;
+				return MouseParse::OK;
+			}
+
+			const char *start = p;
+			int cb, cx, cy;
+			char stop;
+			MouseParse r;
+
+			if ((r = parseMouseField(p, end, ';', 0, cb, stop)) != MouseParse::OK) return r;
+			if ((r = parseMouseField(p, end, ';', 0, cx, stop)) != MouseParse::OK) return r;
+
+			if (protocol == mouse_event::Protocol::SGR) {
+				if ((r = parseMouseField(p, end, 'M', 'm', cy, stop)) != MouseParse::OK) return r;
+				decodeMouseButton(cb, stop == 'm', ev);
+			} else {
+				if ((r = parseMouseField(p, end, 'M', 0, cy, stop)) != MouseParse::OK) return r;
+				if (cb < 32) {
+					return MouseParse::INVALID;
+				}
+				decodeMouseButton(cb - 32, false, ev);
+			}
+
+			if (cx < 1 || cy < 1) {
+				return MouseParse::INVALID;
+			}
+
+			ev.x = cx - 1;
+			ev.y = cy - 1;
+			len = static_cast<size_t>(p - start);
+			return MouseParse::OK;
+		}
+
+		/*
+			length of the mouse report at `p` (including the
+			introducer) if it's a complete report of `protocol`
+			whose button byte/field is the same as the report at
+			`ref`, otherwise 0. used to skip over runs of drag
+			reports without decoding each one.
+		*/
+		inline size_t sameMouseReport(mouse_event::Protocol protocol, const char *p, const char *end, const char *ref, size_t introLength) {
+			if (static_cast<size_t>(end - p) <= introLength || memcmp(p, ref, introLength) != 0) {
+				return 0;
+			}
+
+			if (protocol == mouse_event::Protocol::X10) {
+				if (end - p < 6 || p[3] != ref[3]) {
+					return 0;
+				}
+				return 6;
+			}
+
+			// compare the button field, then find the terminator
+			size_t i = introLength;
+			for (;; i++) {
+				if (p + i == end || p[i] != ref[i]) {
+					return 0;
+				}
+				if (p[i] == ';') {
+					break;
+				}
+			}
+
+			size_t avail = static_cast<size_t>(end - p);
+			for (++i; i < avail && i < 32; i++) {
+				char c = p[i];
+				if (c == 'M' || c == 'm') {
+					return c == 'M' ? i + 1 : 0; // motion is never reported with 'm'
+				}
+				if ((c < '0' || c > '9') && c != ';') {
+					return 0;
+				}
+			}
+
+			return 0;
+		}
+	}
+}
+
+#endif
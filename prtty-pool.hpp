@@ -0,0 +1,168 @@
+#ifndef PRTTY_POOL_H
+#define PRTTY_POOL_H
+#pragma once
+
+/*
+	The thread pool behind prtty::parallel_renderer and
+	prtty::database's bulk loading.
+*/
+
+#include "./prtty.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+namespace prtty {
+	namespace impl {
+		/*
+			a fixed set of threads running batches of indexed tasks.
+			each thread starts on its own contiguous share of the
+			batch and steals from the others' once it runs out. the
+			calling thread takes part, so a pool of 1 has no threads
+			and runs everything in order.
+		*/
+		class WorkPool {
+		public:
+			explicit WorkPool(unsigned threads)
+					: queues(threads > 0 ? threads : 1) {
+				for (auto &q : this->queues) {
+					q.reset(new Queue());
+				}
+				for (unsigned i = 1; i < this->queues.size(); i++) {
+					this->workers.emplace_back([this, i]() { this->loop(i); });
+				}
+			}
+
+			WorkPool(const WorkPool &) = delete;
+			WorkPool & operator =(const WorkPool &) = delete;
+
+			~WorkPool() {
+				{
+					lock_guard<mutex> guard(this->lock);
+					this->stopping = true;
+				}
+				this->wake.notify_all();
+				for (auto &w : this->workers) {
+					w.join();
+				}
+			}
+
+			unsigned size() const {
+				return static_cast<unsigned>(this->queues.size());
+			}
+
+			void run(size_t tasks, const function<void(size_t)> &task) {
+				if (this->workers.empty()) {
+					for (size_t i = 0; i < tasks; i++) {
+						task(i);
+					}
+					return;
+				}
+
+				size_t n = this->queues.size();
+				for (size_t q = 0; q < n; q++) {
+					lock_guard<mutex> guard(this->queues[q]->lock);
+					for (size_t i = tasks * q / n; i < tasks * (q + 1) / n; i++) {
+						this->queues[q]->tasks.push_back(i);
+					}
+				}
+
+				{
+					lock_guard<mutex> guard(this->lock);
+					this->job = &task;
+					this->active = this->workers.size();
+					this->error = nullptr;
+					++this->generation;
+				}
+				this->wake.notify_all();
+
+				this->work(0);
+
+				unique_lock<mutex> guard(this->lock);
+				this->done.wait(guard, [this]() { return this->active == 0; });
+				this->job = nullptr;
+				if (this->error) {
+					rethrow_exception(this->error);
+				}
+			}
+
+		private:
+			struct Queue {
+				mutex lock;
+				deque<size_t> tasks;
+			};
+
+			// own work from the front (in order), others' from the back
+			bool next(size_t self, size_t &task) {
+				size_t n = this->queues.size();
+				for (size_t k = 0; k < n; k++) {
+					Queue &q = *this->queues[(self + k) % n];
+					lock_guard<mutex> guard(q.lock);
+					if (!q.tasks.empty()) {
+						if (k == 0) {
+							task = q.tasks.front();
+							q.tasks.pop_front();
+						} else {
+							task = q.tasks.back();
+							q.tasks.pop_back();
+						}
+						return true;
+					}
+				}
+				return false;
+			}
+
+			void work(size_t self) {
+				size_t task;
+				while (this->next(self, task)) {
+					try {
+						(*this->job)(task);
+					} catch (...) {
+						lock_guard<mutex> guard(this->lock);
+						if (!this->error) {
+							this->error = current_exception();
+						}
+					}
+				}
+			}
+
+			void loop(size_t self) {
+				size_t seen = 0;
+				for (;;) {
+					{
+						unique_lock<mutex> guard(this->lock);
+						this->wake.wait(guard, [&]() { return this->stopping || this->generation != seen; });
+						if (this->stopping) {
+							return;
+						}
+						seen = this->generation;
+					}
+
+					this->work(self);
+
+					lock_guard<mutex> guard(this->lock);
+					if (--this->active == 0) {
+						this->done.notify_one();
+					}
+				}
+			}
+
+			vector<unique_ptr<Queue>> queues;
+			vector<thread> workers;
+
+			mutex lock;
+			condition_variable wake;
+			condition_variable done;
+			const function<void(size_t)> *job = nullptr;
+			size_t generation = 0;
+			size_t active = 0;
+			bool stopping = false;
+			exception_ptr error;
+		};
+	}
+}
+
+#endif
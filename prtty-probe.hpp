@@ -0,0 +1,638 @@
+#ifndef PRTTY_PROBE_H
+#define PRTTY_PROBE_H
+#pragma once
+
+/*
+	Asks the terminal things - where the cursor is, what it is
+	(its device attributes), what its own terminfo says (xterm's
+	XTGETTCAP) - several at a time.
+
+	Queries are queued up, then `request()` gives the bytes that
+	ask all of them, to be sent in one write, so a batch costs a
+	single round trip however many queries are in it. Replies
+	are picked out of whatever the terminal sends back using the
+	entry's reply formats (user6 for the cursor position, user8
+	for the device attributes); anything else that arrives in
+	the meantime, like keys typed at the time, is handed back
+	untouched.
+
+		prtty::prober p(term);
+		size_t pos = p.cursorPosition();
+		size_t colors = p.capability("Co");
+		size_t da = p.deviceAttributes();
+		p.exchange(fd, [&](const char *bytes, size_t length) {
+			// not a reply; e.g. on to prtty::input
+		});
+
+		if (p.result(pos).state == prtty::probe_result::State::ANSWERED) {
+			int row = p.result(pos).args[0];
+			...
+
+	Every query has its own timeout. Terminals answer in order,
+	and every one of them answers a device attributes query, so
+	asking that last settles a batch early: once its reply is
+	in, whatever was asked before it and hasn't been answered
+	never will be.
+
+	`exchange()` writes, polls and reads on a terminal fd (which
+	should be in raw mode) until every query is settled. In an
+	event loop of your own, send `request()`, pass what's read to
+	`feed()`, and call `expire()` when `timeout()` runs out.
+*/
+
+#include "./prtty.hpp"
+
+#include <bitset>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+
+#include <poll.h>
+#include <unistd.h>
+
+namespace prtty {
+	struct probe_result {
+		enum class State {
+			PENDING,
+			ANSWERED,
+			UNANSWERED, // the terminal answered something asked after it
+			TIMED_OUT,
+			UNSUPPORTED // the entry has no way to ask, or the terminal said it doesn't know
+		};
+
+		State state;
+
+		// the cursor position's row and column (from 0), or the
+		// device attributes' parameters
+		int args[9];
+		int nargs;
+
+		// the device attributes as sent (e.g. "64;1;2"), or the
+		// value of the capability asked for with XTGETTCAP
+		string text;
+
+		// from `request()` to the reply
+		chrono::steady_clock::duration latency;
+	};
+
+	namespace impl {
+		/*
+			a reply format (user6, user8) turned around to parse the
+			replies: literal bytes, %d and %c (into the parameter %p
+			picked, or the next one), %i, and %[...], which takes any
+			run of the characters listed. matching is greedy and
+			never backtracks.
+		*/
+		class ReplyPattern {
+		public:
+			enum class Result {
+				NONE,
+				PARTIAL,
+				MATCH
+			};
+
+			struct Match {
+				size_t length;
+				int args[9];
+				int nargs;
+				// what each %[...] took
+				const char *texts[2];
+				size_t textLengths[2];
+				int ntexts;
+			};
+
+			// false if there's something in `format` a reply can't be matched against
+			bool compile(const string &format) {
+				this->tokens.clear();
+				this->increment = false;
+
+				int next = 0;
+				int param = -1;
+				for (size_t i = 0; i < format.length(); i++) {
+					char c = format[i];
+					int ms;
+					bool mandatory;
+					size_t end;
+					if (c == '$' && (end = impl::Sequence::delay(format, i, ms, mandatory)) != string::npos) {
+						i = end;
+						continue;
+					}
+					if (c != '%') {
+						this->literal(c);
+						continue;
+					}
+
+					c = ++i < format.length() ? format[i] : '\0';
+					switch (c) {
+					case '%':
+						this->literal('%');
+						break;
+					case 'i':
+						this->increment = true;
+						break;
+					case 'p':
+						if (i + 1 >= format.length() || format[i + 1] < '1' || format[i + 1] > '9') {
+							return this->fail();
+						}
+						param = format[++i] - '1';
+						break;
+					case 'd':
+					case 'c': {
+						Token t;
+						t.kind = c == 'd' ? Kind::NUMBER : Kind::CHAR;
+						t.byte = 0;
+						t.param = param >= 0 ? param : next++;
+						if (t.param > 8) {
+							return this->fail();
+						}
+						this->tokens.push_back(t);
+						param = -1;
+						break;
+					}
+					case '[': {
+						size_t close = format.find(']', i + 1);
+						if (close == string::npos) {
+							return this->fail();
+						}
+						Token t;
+						t.kind = Kind::CLASS;
+						t.byte = 0;
+						t.param = 0;
+						for (size_t j = i + 1; j < close; j++) {
+							t.set.set(static_cast<unsigned char>(format[j]));
+						}
+						this->tokens.push_back(t);
+						i = close;
+						break;
+					}
+					default:
+						return this->fail();
+					}
+				}
+
+				// replies are found by their first byte
+				if (this->tokens.empty() || this->tokens[0].kind != Kind::LITERAL) {
+					return this->fail();
+				}
+				return true;
+			}
+
+			bool empty() const {
+				return this->tokens.empty();
+			}
+
+			unsigned char first() const {
+				return this->tokens[0].byte;
+			}
+
+			// PARTIAL if [begin, end) could still become a reply
+			Result match(const char *begin, const char *end, Match &m) const noexcept(true) {
+				const char *p = begin;
+				m.nargs = 0;
+				m.ntexts = 0;
+				for (int &a : m.args) {
+					a = 0;
+				}
+
+				for (const Token &t : this->tokens) {
+					if (p == end) {
+						return Result::PARTIAL;
+					}
+					unsigned char b = static_cast<unsigned char>(*p);
+
+					switch (t.kind) {
+					case Kind::LITERAL:
+						if (b != t.byte) {
+							return Result::NONE;
+						}
+						++p;
+						break;
+					case Kind::NUMBER: {
+						if (b < '0' || b > '9') {
+							return Result::NONE;
+						}
+						long long v = 0;
+						for (; p != end && *p >= '0' && *p <= '9'; ++p) {
+							v = min(v * 10 + (*p - '0'), static_cast<long long>(INT_MAX));
+						}
+						this->set(m, t.param, static_cast<int>(v));
+						break;
+					}
+					case Kind::CHAR:
+						this->set(m, t.param, b);
+						++p;
+						break;
+					case Kind::CLASS: {
+						const char *from = p;
+						while (p != end && t.set[static_cast<unsigned char>(*p)] && static_cast<size_t>(p - begin) < maxLength) {
+							++p;
+						}
+						if (m.ntexts < 2) {
+							m.texts[m.ntexts] = from;
+							m.textLengths[m.ntexts] = static_cast<size_t>(p - from);
+						}
+						++m.ntexts;
+						break;
+					}
+					}
+
+					if (static_cast<size_t>(p - begin) >= maxLength) {
+						return Result::NONE;
+					}
+				}
+
+				m.length = static_cast<size_t>(p - begin);
+				return Result::MATCH;
+			}
+
+		private:
+			// longer than any reply; a run past it isn't one
+			static const size_t maxLength = 512;
+
+			enum class Kind {
+				LITERAL,
+				NUMBER,
+				CHAR,
+				CLASS
+			};
+
+			struct Token {
+				Kind kind;
+				unsigned char byte;
+				int param;
+				bitset<256> set;
+			};
+
+			void literal(char c) {
+				Token t;
+				t.kind = Kind::LITERAL;
+				t.byte = static_cast<unsigned char>(c);
+				t.param = 0;
+				this->tokens.push_back(t);
+			}
+
+			bool fail() {
+				this->tokens.clear();
+				return false;
+			}
+
+			void set(Match &m, int param, int value) const noexcept(true) {
+				m.args[param] = this->increment && param < 2 ? value - 1 : value;
+				m.nargs = max(m.nargs, param + 1);
+			}
+
+			vector<Token> tokens;
+			bool increment = false;
+		};
+
+		inline string hexEncode(const string &s) {
+			static const char digits[] = "0123456789ABCDEF";
+			string out;
+			for (unsigned char c : s) {
+				out += digits[c >> 4];
+				out += digits[c & 0xF];
+			}
+			return out;
+		}
+
+		inline string hexDecode(const char *s, size_t length) {
+			auto nibble = [](char c) {
+				return c >= 'a' ? c - 'a' + 10 : c >= 'A' ? c - 'A' + 10 : c - '0';
+			};
+			string out;
+			for (size_t i = 0; i + 1 < length; i += 2) {
+				out += static_cast<char>(nibble(s[i]) << 4 | nibble(s[i + 1]));
+			}
+			return out;
+		}
+	}
+
+	class prober {
+	public:
+		explicit prober(const term &term) {
+			if (term.user7 && this->patterns[POSITION].compile(term.user6.source())) {
+				this->asks[POSITION] = string(term.user7);
+			}
+
+			// older entries have the reply of the terminal they describe
+			// rather than a pattern; its parameters could be anything
+			string attributes = term.user8.source();
+			if (attributes.find('%') == string::npos) {
+				string general;
+				for (size_t i = 0; i < attributes.length(); i++) {
+					bool param = (attributes[i] >= '0' && attributes[i] <= '9') || attributes[i] == ';';
+					if (!param) {
+						general += attributes[i];
+					} else if (i == 0 || !((attributes[i - 1] >= '0' && attributes[i - 1] <= '9') || attributes[i - 1] == ';')) {
+						general += "%[;0123456789]";
+					}
+				}
+				attributes = general;
+			}
+			if (term.user9 && this->patterns[ATTRIBUTES].compile(attributes)) {
+				this->asks[ATTRIBUTES] = string(term.user9);
+			}
+
+			// not in terminfo; xterm's own
+			this->patterns[CAPABILITY].compile("\x1bP%[01]+r%[0123456789ABCDEFabcdef=]\x1b\\");
+
+			for (auto &p : this->patterns) {
+				if (!p.empty()) {
+					this->starts.set(p.first());
+				}
+			}
+		}
+
+		// each returns the query's id, for `result()`
+		size_t cursorPosition(chrono::milliseconds timeout = chrono::milliseconds(500)) {
+			return this->add(POSITION, this->asks[POSITION], "", timeout);
+		}
+
+		size_t deviceAttributes(chrono::milliseconds timeout = chrono::milliseconds(500)) {
+			return this->add(ATTRIBUTES, this->asks[ATTRIBUTES], "", timeout);
+		}
+
+		// XTGETTCAP, by terminfo short name (e.g. "Co", "RGB" or "TN")
+		size_t capability(const string &name, chrono::milliseconds timeout = chrono::milliseconds(500)) {
+			return this->add(CAPABILITY, "\x1bP+q" + impl::hexEncode(name) + "\x1b\\", name, timeout);
+		}
+
+		// the bytes that ask every query not yet asked, whose clocks start now
+		string request() {
+			string out;
+			auto now = chrono::steady_clock::now();
+			for (auto &q : this->queries) {
+				if (!q.sent && q.result.state == probe_result::State::PENDING) {
+					out += q.ask;
+					q.sent = true;
+					q.sentAt = now;
+				}
+			}
+			return out;
+		}
+
+		/*
+			takes `len` bytes read from the terminal, settling the
+			queries they answer and calling `passthrough(const char *,
+			size_t)` with everything else. what might be the start of
+			a reply is held back until more arrives or, once nothing
+			is awaited any more, `expire()`.
+		*/
+		template <typename Callback>
+		void feed(const char *buf, size_t len, Callback passthrough) {
+			this->held.append(buf, len);
+			this->decode(passthrough, false);
+		}
+
+		// milliseconds until a query should be given up on, or -1 if none are awaited
+		int timeout() const {
+			auto now = chrono::steady_clock::now();
+			long long soonest = -1;
+			for (auto &q : this->queries) {
+				if (q.sent && q.result.state == probe_result::State::PENDING) {
+					long long left = max(0ll, static_cast<long long>(
+						chrono::duration_cast<chrono::milliseconds>(q.sentAt + q.timeout - now).count()));
+					soonest = soonest < 0 ? left : min(soonest, left);
+				}
+			}
+			return static_cast<int>(min(soonest, static_cast<long long>(INT_MAX)));
+		}
+
+		// times out overdue queries, and lets held bytes go once there's nothing to wait for
+		template <typename Callback>
+		void expire(Callback passthrough) {
+			auto now = chrono::steady_clock::now();
+			for (auto &q : this->queries) {
+				if (q.sent && q.result.state == probe_result::State::PENDING && now >= q.sentAt + q.timeout) {
+					q.result.state = probe_result::State::TIMED_OUT;
+				}
+			}
+			if (!this->awaiting()) {
+				this->decode(passthrough, true);
+			}
+		}
+
+		// whether every query has been settled one way or another
+		bool done() const {
+			for (auto &q : this->queries) {
+				if (q.result.state == probe_result::State::PENDING) {
+					return false;
+				}
+			}
+			return true;
+		}
+
+		const probe_result & result(size_t id) const {
+			return this->queries.at(id).result;
+		}
+
+		size_t size() const {
+			return this->queries.size();
+		}
+
+		/*
+			sends every query not yet asked to the terminal on `fd` in
+			one write, then reads until they're all settled, handing
+			what isn't a reply to `passthrough`.
+		*/
+		template <typename Callback>
+		void exchange(int fd, Callback passthrough) {
+			string out = this->request();
+			for (size_t off = 0; off < out.length();) {
+				ssize_t n = ::write(fd, out.data() + off, out.length() - off);
+				if (n >= 0) {
+					off += static_cast<size_t>(n);
+				} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+					struct pollfd p = {fd, POLLOUT, 0};
+					if (::poll(&p, 1, this->timeout()) == 0) {
+						break;
+					}
+				} else if (errno != EINTR) {
+					throw PrttyError(string("write failed: ") + strerror(errno));
+				}
+			}
+
+			char buf[4096];
+			while (!this->done()) {
+				struct pollfd p = {fd, POLLIN, 0};
+				int ready = ::poll(&p, 1, this->timeout());
+				if (ready < 0 && errno != EINTR) {
+					throw PrttyError(string("poll failed: ") + strerror(errno));
+				}
+				if (ready > 0) {
+					ssize_t n = ::read(fd, buf, sizeof(buf));
+					if (n > 0) {
+						this->feed(buf, static_cast<size_t>(n), passthrough);
+					} else if (n == 0 || (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)) {
+						// the terminal's gone; nothing more will be answered
+						this->giveUp(probe_result::State::UNANSWERED, this->queries.size());
+					}
+				}
+				this->expire(passthrough);
+			}
+		}
+
+	private:
+		enum Kind {
+			POSITION,
+			ATTRIBUTES,
+			CAPABILITY,
+			KINDS
+		};
+
+		struct Query {
+			Kind kind;
+			string ask;
+			string name;
+			chrono::milliseconds timeout;
+			bool sent;
+			chrono::steady_clock::time_point sentAt;
+			probe_result result;
+		};
+
+		size_t add(Kind kind, const string &ask, const string &name, chrono::milliseconds timeout) {
+			Query q;
+			q.kind = kind;
+			q.ask = ask;
+			q.name = name;
+			q.timeout = timeout;
+			q.sent = false;
+			q.result.state = ask.empty() ? probe_result::State::UNSUPPORTED : probe_result::State::PENDING;
+			q.result.nargs = 0;
+			for (int &a : q.result.args) {
+				a = 0;
+			}
+			q.result.latency = chrono::steady_clock::duration::zero();
+			this->queries.push_back(move(q));
+			return this->queries.size() - 1;
+		}
+
+		bool awaiting(Kind kind = KINDS) const {
+			for (auto &q : this->queries) {
+				if (q.sent && q.result.state == probe_result::State::PENDING && (kind == KINDS || q.kind == kind)) {
+					return true;
+				}
+			}
+			return false;
+		}
+
+		// settles the still pending queries asked before `before`
+		void giveUp(probe_result::State state, size_t before) {
+			for (size_t i = 0; i < before && i < this->queries.size(); i++) {
+				Query &q = this->queries[i];
+				if (q.sent && q.result.state == probe_result::State::PENDING) {
+					q.result.state = state;
+				}
+			}
+		}
+
+		template <typename Callback>
+		void decode(Callback &passthrough, bool flush) {
+			const char *begin = this->held.data();
+			const char *end = begin + this->held.length();
+			const char *text = begin;
+			const char *p = begin;
+
+			while (p != end) {
+				if (!this->starts[static_cast<unsigned char>(*p)]) {
+					++p;
+					continue;
+				}
+
+				size_t length = 0;
+				bool partial = false;
+				for (int kind = 0; kind < KINDS && length == 0; kind++) {
+					impl::ReplyPattern::Match m;
+					if (this->patterns[kind].empty() || !this->awaiting(static_cast<Kind>(kind))) {
+						continue;
+					}
+					switch (this->patterns[kind].match(p, end, m)) {
+					case impl::ReplyPattern::Result::MATCH:
+						this->answer(static_cast<Kind>(kind), m);
+						length = m.length;
+						break;
+					case impl::ReplyPattern::Result::PARTIAL:
+						partial = true;
+						break;
+					case impl::ReplyPattern::Result::NONE:
+						break;
+					}
+				}
+
+				if (length > 0) {
+					if (p != text) {
+						passthrough(text, static_cast<size_t>(p - text));
+					}
+					p += length;
+					text = p;
+				} else if (partial && !flush) {
+					break;
+				} else {
+					++p;
+				}
+			}
+
+			if (p != text) {
+				passthrough(text, static_cast<size_t>(p - text));
+			}
+			this->held.erase(0, static_cast<size_t>(p - begin));
+		}
+
+		void answer(Kind kind, const impl::ReplyPattern::Match &m) {
+			// the first query waiting on this kind of reply, or for XTGETTCAP the one named
+			string name;
+			bool known = true;
+			if (kind == CAPABILITY) {
+				string hex(m.texts[1], m.textLengths[1]);
+				name = impl::hexDecode(hex.data(), min(hex.length(), hex.find('=')));
+				known = m.textLengths[0] == 1 && m.texts[0][0] == '1';
+			}
+
+			size_t i = 0;
+			for (; i < this->queries.size(); i++) {
+				const Query &q = this->queries[i];
+				if (q.sent && q.result.state == probe_result::State::PENDING && q.kind == kind
+						&& (kind != CAPABILITY || name.empty() || q.name == name)) {
+					break;
+				}
+			}
+			if (i == this->queries.size()) {
+				return; // a reply to a query already given up on
+			}
+
+			probe_result &r = this->queries[i].result;
+			r.state = known ? probe_result::State::ANSWERED : probe_result::State::UNSUPPORTED;
+			r.latency = chrono::steady_clock::now() - this->queries[i].sentAt;
+
+			if (kind == POSITION) {
+				copy(&m.args[0], &m.args[9], &r.args[0]);
+				r.nargs = m.nargs;
+			} else if (kind == ATTRIBUTES) {
+				r.text.assign(m.ntexts > 0 ? m.texts[0] : "", m.ntexts > 0 ? m.textLengths[0] : 0);
+				vector<string> params;
+				impl::split(r.text, ';', params);
+				for (auto &param : params) {
+					if (r.nargs < 9 && !param.empty()) {
+						r.args[r.nargs++] = atoi(param.c_str());
+					}
+				}
+
+				// terminals answer in order, so nothing before this will be
+				this->giveUp(probe_result::State::UNANSWERED, i);
+			} else if (known) {
+				size_t eq = string(m.texts[1], m.textLengths[1]).find('=');
+				if (eq != string::npos) {
+					r.text = impl::hexDecode(m.texts[1] + eq + 1, m.textLengths[1] - eq - 1);
+				}
+			}
+		}
+
+		impl::ReplyPattern patterns[KINDS];
+		string asks[KINDS];
+		bitset<256> starts;
+		vector<Query> queries;
+		string held;
+	};
+}
+
+#endif
@@ -0,0 +1,582 @@
+#ifndef PRTTY_RECOGNIZER_H
+#define PRTTY_RECOGNIZER_H
+#pragma once
+
+/*
+	Maps an output stream - what an application wrote to a
+	terminal described by a given `term` - back to the string
+	capabilities, and their arguments, that produced it.
+
+	Each capability's compiled program becomes a pattern.
+	Straight-line programs are inverted symbolically: a %d or
+	%c of a parameter (after any %i or constant %+/%-) turns into
+	a number or byte matcher that recovers the argument. Programs
+	with conditionals (setaf, sgr, ...) are instead evaluated over
+	their likely domain - 0-255 for single-parameter capabilities,
+	0/1 for flag-style ones - and matched literally.
+
+	All patterns are compiled into one trie that is walked with a
+	little backtracking, for the spots where a digit could either
+	be literal or the start of a number. Runs of text between
+	sequences are found with the same vectorized scan as `input`.
+
+	Input capabilities (key_*) are left out. Bytes that don't
+	form a known sequence are handed back as text.
+*/
+
+#include "./prtty.hpp"
+
+#include <algorithm>
+#include <map>
+#include <typeinfo>
+
+namespace prtty {
+	struct output_event {
+		enum class Type {
+			TEXT,
+			CAPABILITY
+		};
+
+		Type type;
+
+		// the raw bytes; only valid for the duration of the callback.
+		const char *bytes;
+		size_t length;
+
+		// CAPABILITY events only: index into the string capability
+		// list (prtty-strings.inc), its long name, and the arguments
+		// it was evaluated with.
+		size_t capability;
+		const char *name;
+		int nargs;
+		int args[9];
+	};
+
+	class recognizer {
+	public:
+		explicit recognizer(const term &term)
+				: maxLength(0)
+				, controlOnly(true)
+				, pendingLength(0) {
+			Tree tree(1);
+
+			size_t index = 0;
+#			define PRTTY_DO_STRING(name) this->add(tree, index++, #name, term.name);
+#			include "./prtty-strings.inc"
+
+			this->compile(tree);
+			this->held.resize(this->maxLength * 2 + 1);
+		}
+
+		/*
+			recognizes `len` bytes, calling `callback(const output_event &)`
+			for every text run and capability found. a trailing partial
+			sequence is kept until more output arrives or `flush()`.
+		*/
+		template <typename Callback>
+		void feed(const char *buf, size_t len, Callback callback) {
+			const char *end = buf + len;
+
+			if (this->pendingLength > 0) {
+				size_t take = min(len, this->maxLength);
+				memcpy(&this->held[this->pendingLength], buf, take);
+
+				const char *sbegin = this->held.data();
+				const char *send = sbegin + this->pendingLength + take;
+				const char *stop = this->decode(sbegin, send, sbegin + this->pendingLength, callback, false);
+				size_t used = static_cast<size_t>(stop - sbegin);
+
+				if (used < this->pendingLength) {
+					this->pendingLength = static_cast<size_t>(send - stop);
+					memmove(&this->held[0], stop, this->pendingLength);
+					return;
+				}
+
+				buf += used - this->pendingLength;
+				this->pendingLength = 0;
+			}
+
+			const char *stop = this->decode(buf, end, end, callback, false);
+			if (stop != end) {
+				this->pendingLength = static_cast<size_t>(end - stop);
+				memcpy(&this->held[0], stop, this->pendingLength);
+			}
+		}
+
+		// resolves a held-back partial sequence as-is (e.g. at end of stream)
+		template <typename Callback>
+		void flush(Callback callback) {
+			const char *begin = this->held.data();
+			const char *end = begin + this->pendingLength;
+			this->pendingLength = 0;
+			this->decode(begin, end, end, callback, true);
+		}
+
+		bool pending() const {
+			return this->pendingLength > 0;
+		}
+
+		// number of distinct sequences/patterns that can be recognized
+		size_t patterns() const {
+			return this->accepts.size();
+		}
+
+	private:
+		enum class TokenKind {
+			LITERAL,
+			NUMBER,
+			CHAR
+		};
+
+		struct Token {
+			TokenKind kind;
+			unsigned char byte;
+			int param;
+			int offset;
+		};
+
+		struct BuildNode {
+			BuildNode() : accept(-1) {}
+
+			map<unsigned char, uint32_t> bytes;
+			map<tuple<int, int, int>, uint32_t> captures; // (kind, param, offset)
+			int32_t accept;
+		};
+
+		typedef vector<BuildNode> Tree;
+
+		struct Accept {
+			size_t capability;
+			const char *name;
+			int nargs;
+			int32_t fixed; // offset of the fixed args in `fixedArgs`, or -1 if captured
+		};
+
+		struct Node {
+			uint32_t edges;
+			uint32_t edgeCount;
+			uint32_t captures;
+			uint32_t captureCount;
+			int32_t accept;
+		};
+
+		struct Edge {
+			unsigned char byte;
+			uint32_t next;
+		};
+
+		struct Capture {
+			TokenKind kind;
+			int param;
+			int offset;
+			uint32_t next;
+		};
+
+		struct Match {
+			size_t length;
+			int32_t accept;
+			bool partial;
+			int args[9];
+		};
+
+		static const size_t maxDigits = 10;
+
+		/*
+			symbolically executes a straight-line program. every
+			stack value is either a constant or a parameter plus a
+			constant offset; anything else can't be inverted.
+		*/
+		static bool invert(const impl::Sequence &seq, vector<Token> &tokens) {
+			using namespace impl;
+
+			struct Sym {
+				bool param;
+				int value;
+				int offset;
+			};
+
+			vector<Sym> stk;
+			int inc[9] = {0};
+
+			auto pop = [&](Sym &sym) -> bool {
+				if (stk.empty()) {
+					return false;
+				}
+				sym = stk.back();
+				stk.pop_back();
+				return true;
+			};
+
+			auto literal = [&](const string &str) {
+				for (char c : str) {
+					tokens.push_back(Token{TokenKind::LITERAL, static_cast<unsigned char>(c), 0, 0});
+				}
+			};
+
+			for (auto &opp : seq.ops) {
+				const Operation &o = *opp;
+				const type_info &type = typeid(o);
+				Sym l, r;
+
+				if (type == typeid(op::StringLiteral)) {
+					literal(static_cast<const op::StringLiteral &>(o).literal);
+				} else if (type == typeid(op::Pad)) {
+					// nothing a terminal sends has delays in it
+				} else if (type == typeid(op::PushArg)) {
+					unsigned int arg = static_cast<const op::PushArg &>(o).arg;
+					stk.push_back(Sym{true, static_cast<int>(arg), inc[arg]});
+				} else if (type == typeid(op::PushLiteralInt)) {
+					stk.push_back(Sym{false, static_cast<const op::PushLiteralInt &>(o).literal, 0});
+				} else if (type == typeid(op::PushLiteralChar)) {
+					stk.push_back(Sym{false, static_cast<const op::PushLiteralChar &>(o).literal, 0});
+				} else if (type == typeid(op::IncrementFirstTwo)) {
+					inc[0]++;
+					inc[1]++;
+				} else if (type == typeid(op::ArithAdd) || type == typeid(op::ArithSub)) {
+					if (!pop(r) || !pop(l) || r.param) {
+						return false;
+					}
+					int v = type == typeid(op::ArithAdd) ? r.value : -r.value;
+					if (l.param) {
+						l.offset += v;
+					} else {
+						l.value += v;
+					}
+					stk.push_back(l);
+				} else if (type == typeid(op::PopWriteInt)) {
+					const op::PopWriteInt &w = static_cast<const op::PopWriteInt &>(o);
+					if (!w.plain() || !pop(l)) {
+						return false;
+					}
+					if (l.param) {
+						tokens.push_back(Token{TokenKind::NUMBER, 0, l.value, l.offset});
+					} else {
+						literal(to_string(l.value));
+					}
+				} else if (type == typeid(op::PopWriteChar)) {
+					if (!pop(l)) {
+						return false;
+					}
+					if (l.param) {
+						tokens.push_back(Token{TokenKind::CHAR, 0, l.value, l.offset});
+					} else {
+						literal(string(1, op::PopWriteChar::byte(l.value)));
+					}
+				} else {
+					return false;
+				}
+			}
+
+			return true;
+		}
+
+		// (patterns that start with a %d/%c are never reached from the root, so
+		// capabilities like that simply aren't recognized.)
+		int32_t insert(Tree &tree, const vector<Token> &tokens) {
+			if (tokens.empty()) {
+				return -1;
+			}
+
+			uint32_t node = 0;
+			size_t length = 0;
+			for (const Token &t : tokens) {
+				uint32_t next;
+				if (t.kind == TokenKind::LITERAL) {
+					auto itr = tree[node].bytes.find(t.byte);
+					if (itr != tree[node].bytes.end()) {
+						node = itr->second;
+						++length;
+						continue;
+					}
+					next = static_cast<uint32_t>(tree.size());
+					tree[node].bytes[t.byte] = next;
+					++length;
+				} else {
+					auto key = make_tuple(static_cast<int>(t.kind), t.param, t.offset);
+					auto itr = tree[node].captures.find(key);
+					if (itr != tree[node].captures.end()) {
+						node = itr->second;
+						length += maxDigits;
+						continue;
+					}
+					next = static_cast<uint32_t>(tree.size());
+					tree[node].captures[key] = next;
+					length += t.kind == TokenKind::NUMBER ? maxDigits : 1;
+				}
+
+				tree.emplace_back();
+				node = next;
+			}
+
+			this->maxLength = max(this->maxLength, length);
+
+			// the first capability to claim a sequence keeps it
+			if (tree[node].accept >= 0) {
+				return -1;
+			}
+
+			tree[node].accept = static_cast<int32_t>(this->accepts.size());
+			return tree[node].accept;
+		}
+
+		void add(Tree &tree, size_t capability, const char *name, const impl::SequenceStreamer &cap) {
+			if (strncmp(name, "key_", 4) == 0 || !cap) {
+				return;
+			}
+
+			const impl::Sequence &seq = cap.sequence();
+			vector<Token> tokens;
+
+			if (invert(seq, tokens)) {
+				if (this->insert(tree, tokens) >= 0) {
+					this->accepts.push_back(Accept{capability, name, seq.nargs, -1});
+				}
+				return;
+			}
+
+			// enumerate the likely argument space instead
+			size_t combinations;
+			if (seq.nargs == 1) {
+				combinations = 256;
+			} else if (seq.nargs >= 2 && seq.nargs <= 9) {
+				combinations = size_t(1) << seq.nargs;
+			} else {
+				combinations = 1;
+			}
+
+			// with state of its own, leaving the term's (statics included) alone
+			impl::Data data;
+			string out;
+			impl::StringBuf buf(out);
+			ostream os(&buf);
+
+			for (size_t i = 0; i < combinations; i++) {
+				int a[9] = {0};
+				if (seq.nargs == 1) {
+					a[0] = static_cast<int>(i);
+				} else {
+					for (int bit = 0; bit < seq.nargs; bit++) {
+						a[bit] = (i >> bit) & 1;
+					}
+				}
+
+				out.clear();
+				try {
+					cap.evaluate(data, os, a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7], a[8]);
+				} catch (const PrttyError &) {
+					continue;
+				}
+
+				tokens.clear();
+				for (char c : out) {
+					tokens.push_back(Token{TokenKind::LITERAL, static_cast<unsigned char>(c), 0, 0});
+				}
+
+				if (this->insert(tree, tokens) >= 0) {
+					this->accepts.push_back(Accept{capability, name, seq.nargs, static_cast<int32_t>(this->fixedArgs.size())});
+					this->fixedArgs.insert(this->fixedArgs.end(), &a[0], &a[9]);
+				}
+			}
+		}
+
+		void compile(const Tree &tree) {
+			fill(&this->root[0], &this->root[256], 0u);
+
+			this->nodes.resize(tree.size());
+			for (size_t i = 0; i < tree.size(); i++) {
+				Node &node = this->nodes[i];
+				node.edges = static_cast<uint32_t>(this->edges.size());
+				node.edgeCount = static_cast<uint32_t>(tree[i].bytes.size());
+				node.captures = static_cast<uint32_t>(this->captures.size());
+				node.captureCount = static_cast<uint32_t>(tree[i].captures.size());
+				node.accept = tree[i].accept;
+
+				for (auto &kv : tree[i].bytes) {
+					this->edges.push_back(Edge{kv.first, kv.second});
+				}
+				for (auto &kv : tree[i].captures) {
+					this->captures.push_back(Capture{static_cast<TokenKind>(std::get<0>(kv.first)), std::get<1>(kv.first), std::get<2>(kv.first), kv.second});
+				}
+			}
+
+			for (auto &kv : tree[0].bytes) {
+				this->root[kv.first] = kv.second;
+				if (kv.first >= 0x20 && kv.first != 0x7F) {
+					this->controlOnly = false;
+				}
+			}
+		}
+
+		const char * scan(const char *p, const char *end) const {
+			if (!this->controlOnly) {
+				while (p != end && !this->root[static_cast<unsigned char>(*p)]) {
+					++p;
+				}
+				return p;
+			}
+
+			for (;;) {
+				p = impl::findControl(p, end);
+				if (p == end || this->root[static_cast<unsigned char>(*p)]) {
+					return p;
+				}
+				++p;
+			}
+		}
+
+		/*
+			depth-first search for the longest match. returns true once
+			a match has run into a leaf, at which point the sequence is
+			unambiguously complete and the remaining alternatives (the
+			number/char matchers, which are tried after literal bytes)
+			aren't worth exploring.
+		*/
+		bool walk(uint32_t node, const char *start, const char *q, const char *end, int *args, unsigned int assigned, Match &best) const {
+			const Node &n = this->nodes[node];
+			size_t length = static_cast<size_t>(q - start);
+
+			if (n.accept >= 0 && length > best.length) {
+				best.length = length;
+				best.accept = n.accept;
+				memcpy(best.args, args, sizeof(best.args));
+			}
+
+			if (n.edgeCount == 0 && n.captureCount == 0) {
+				return n.accept >= 0;
+			}
+
+			if (q == end) {
+				best.partial = true;
+				return false;
+			}
+
+			unsigned char b = static_cast<unsigned char>(*q);
+
+			const Edge *e = &this->edges[n.edges];
+			const Edge *eend = e + n.edgeCount;
+			for (; e != eend; ++e) {
+				if (e->byte == b) {
+					if (this->walk(e->next, start, q + 1, end, args, assigned, best)) {
+						return true;
+					}
+					break;
+				}
+			}
+
+			const Capture *c = &this->captures[n.captures];
+			const Capture *cend = c + n.captureCount;
+			for (; c != cend; ++c) {
+				const char *r = q;
+				int value;
+
+				if (c->kind == TokenKind::NUMBER) {
+					if (b < '0' || b > '9') {
+						continue;
+					}
+
+					value = 0;
+					for (; r != end && *r >= '0' && *r <= '9' && r - q < 9; ++r) {
+						value = value * 10 + (*r - '0');
+					}
+					if (r == end) {
+						best.partial = true;
+						continue;
+					}
+					value -= c->offset;
+				} else {
+					value = impl::op::PopWriteChar::argument(b, c->offset);
+					++r;
+				}
+
+				unsigned int bit = 1u << c->param;
+				if ((assigned & bit) && args[c->param] != value) {
+					continue;
+				}
+
+				int saved = args[c->param];
+				args[c->param] = value;
+				bool done = this->walk(c->next, start, r, end, args, assigned | bit, best);
+				args[c->param] = saved;
+				if (done) {
+					return true;
+				}
+			}
+
+			return false;
+		}
+
+		static output_event makeEvent(output_event::Type type, const char *bytes, size_t length) {
+			output_event ev;
+			memset(&ev, 0, sizeof(ev));
+			ev.type = type;
+			ev.bytes = bytes;
+			ev.length = length;
+			return ev;
+		}
+
+		template <typename Callback>
+		const char * decode(const char *begin, const char *end, const char *limit, Callback &callback, bool flush) const {
+			const char *p = begin;
+			const char *text = begin;
+
+			while (p < limit) {
+				p = this->scan(p, end);
+				if (p == end) {
+					break;
+				}
+
+				Match m;
+				m.length = 0;
+				m.accept = -1;
+				m.partial = false;
+				int args[9] = {0};
+				this->walk(this->root[static_cast<unsigned char>(*p)], p, p + 1, end, args, 0, m);
+
+				if (m.partial && !flush && static_cast<size_t>(end - p) < this->maxLength) {
+					break;
+				}
+
+				if (m.accept < 0) {
+					++p; // not a known sequence; keep it in the text run
+					continue;
+				}
+
+				if (p != text) {
+					callback(makeEvent(output_event::Type::TEXT, text, static_cast<size_t>(p - text)));
+				}
+
+				const Accept &a = this->accepts[static_cast<size_t>(m.accept)];
+				output_event ev = makeEvent(output_event::Type::CAPABILITY, p, m.length);
+				ev.capability = a.capability;
+				ev.name = a.name;
+				ev.nargs = a.nargs;
+				memcpy(ev.args, a.fixed < 0 ? m.args : &this->fixedArgs[static_cast<size_t>(a.fixed)], sizeof(ev.args));
+				callback(ev);
+
+				p += m.length;
+				text = p;
+			}
+
+			if (p != text) {
+				callback(makeEvent(output_event::Type::TEXT, text, static_cast<size_t>(p - text)));
+			}
+
+			return p;
+		}
+
+		size_t maxLength;
+
+		uint32_t root[256];
+		vector<Node> nodes;
+		vector<Edge> edges;
+		vector<Capture> captures;
+		vector<Accept> accepts;
+		vector<int> fixedArgs;
+		bool controlOnly;
+
+		vector<char> held;
+		size_t pendingLength;
+	};
+}
+
+#endif
@@ -0,0 +1,395 @@
+#ifndef PRTTY_RELOAD_H
+#define PRTTY_RELOAD_H
+#pragma once
+
+/*
+	Terms that follow their entries on disk, for long-running
+	processes that shouldn't need a restart to pick up updated
+	terminfo packages.
+
+	A live_term loads an entry the way `prtty::get` would and
+	then watches, with inotify, the directories it was (or could
+	have been) found in. When the entry is rewritten, replaced
+	or shadowed by one earlier in the search path, it's reloaded
+	in the background and published as a new version; one that
+	doesn't parse, or has gone, leaves the current version as it
+	is (and counts in `failures()`).
+
+		prtty::live_term live("xterm-256color");
+
+		// on each thread
+		prtty::live_term::reader r = live.read();
+		for (;;) {
+			const prtty::term &t = r.get();
+			out << t.cursor_address(y, x);
+			...
+		}
+
+	`get()` is a single atomic load while nothing has changed;
+	after a reload it copies the new version (once per reader),
+	so everything already holding the old term carries on with
+	it undisturbed. Neither takes a lock, nor waits on the
+	watcher. A version goes once no reader is still on it.
+
+	A reader keeps its own term, so it's for one thread at a
+	time, and its evaluation state (padding, static variables)
+	starts over with each version. Readers mustn't outlive the
+	live_term they're reading. Linux only.
+*/
+
+#include "./prtty.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <thread>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace prtty {
+	class live_term {
+		struct Version {
+			Version(const term &t, const string &bytes, uint64_t number)
+					: t(t)
+					, bytes(bytes)
+					, number(number) {
+			}
+
+			const term t;
+			const string bytes;
+			const uint64_t number;
+		};
+
+		// what a reader has hold of while it copies the current version
+		struct Slot {
+			atomic<Version *> hazard{nullptr};
+		};
+
+	public:
+		class reader {
+		public:
+			reader(reader &&other)
+					: owner(other.owner)
+					, slot(other.slot)
+					, local(move(other.local))
+					, seen(other.seen) {
+				other.slot = nullptr;
+			}
+
+			reader(const reader &) = delete;
+			reader & operator =(const reader &) = delete;
+
+			~reader() {
+				if (this->slot) {
+					this->owner->leave(this->slot);
+				}
+			}
+
+			// the latest version; references to it stay good until the next call
+			const term & get() {
+				if (this->owner->generation.load(memory_order_acquire) != this->seen) {
+					this->refresh();
+				}
+				return *this->local;
+			}
+
+			// the version get() last returned
+			uint64_t version() const noexcept(true) {
+				return this->seen;
+			}
+
+		private:
+			friend class live_term;
+
+			explicit reader(live_term *owner)
+					: owner(owner)
+					, slot(owner->enter())
+					, seen(0) {
+				this->refresh();
+			}
+
+			void refresh() {
+				// a hazard pointer: published, then checked to still be current
+				Version *v = this->owner->head.load(memory_order_acquire);
+				for (;;) {
+					this->slot->hazard.store(v, memory_order_seq_cst);
+					Version *again = this->owner->head.load(memory_order_seq_cst);
+					if (again == v) {
+						break;
+					}
+					v = again;
+				}
+
+				if (v->number != this->seen) {
+					this->local.reset(new term(v->t));
+					this->seen = v->number;
+				}
+
+				this->slot->hazard.store(nullptr, memory_order_release);
+			}
+
+			live_term *owner;
+			Slot *slot;
+			unique_ptr<term> local;
+			uint64_t seen;
+		};
+
+		// looked up along search_path(), as `prtty::get(termname)` does
+		explicit live_term(const string &termname)
+				: live_term(termname, search_path()) {
+		}
+
+		live_term(const string &termname, const string &basePath)
+				: live_term(termname, vector<string>{basePath}) {
+		}
+
+		live_term(const live_term &) = delete;
+		live_term & operator =(const live_term &) = delete;
+
+		~live_term() {
+			if (this->watcher.joinable()) {
+				char stop = 0;
+				ssize_t n;
+				do {
+					n = ::write(this->wake[1], &stop, 1);
+				} while (n < 0 && errno == EINTR);
+				this->watcher.join();
+			}
+			for (int fd : {this->inotify, this->wake[0], this->wake[1]}) {
+				if (fd >= 0) {
+					::close(fd);
+				}
+			}
+
+			delete this->head.load();
+			for (Version *v : this->retired) {
+				delete v;
+			}
+		}
+
+		reader read() {
+			return reader(this);
+		}
+
+		const string & name() const noexcept(true) {
+			return this->termname;
+		}
+
+		// counts up from 1 with each reload that changed the entry
+		uint64_t version() const noexcept(true) {
+			return this->generation.load(memory_order_acquire);
+		}
+
+		// reloads that found nothing, or nothing that would load
+		size_t failures() const noexcept(true) {
+			return this->failureCount.load(memory_order_relaxed);
+		}
+
+		// old versions not freed yet, as a reader was still copying them
+		size_t unreclaimed() const {
+			lock_guard<mutex> guard(this->writeLock);
+			return this->retired.size();
+		}
+
+		// whether changes are picked up by themselves; if not, call reload()
+		bool watching() const noexcept(true) {
+			return this->watcher.joinable();
+		}
+
+		/*
+			looks the entry up again and publishes it if it's changed,
+			returning whether it did. the watcher calls this; it's also
+			there for when inotify isn't (or on a SIGHUP).
+		*/
+		bool reload() {
+			lock_guard<mutex> guard(this->writeLock);
+			this->reclaim();
+
+			string bytes;
+			Version *current = this->head.load(memory_order_relaxed);
+			try {
+				if (!this->fetch(bytes)) {
+					throw PrttyError("could not load database for terminal: " + this->termname);
+				}
+				if (bytes == current->bytes) {
+					return false;
+				}
+				this->publish(new Version(load(this->termname, bytes), bytes, current->number + 1));
+			} catch (const PrttyError &) {
+				this->failureCount.fetch_add(1, memory_order_relaxed);
+				return false;
+			}
+			return true;
+		}
+
+	private:
+		live_term(const string &termname, const vector<string> &dirs)
+				: termname(termname)
+				, dirs(dirs) {
+			if (impl::validName(termname)) {
+				char first = termname[0];
+				this->subdirs[0] = string(1, first);
+				this->subdirs[1] = string{impl::hashCharacter((first & 0xF0) >> 4), impl::hashCharacter(first & 0x0F)};
+			}
+
+			string bytes;
+			if (!impl::validName(termname) || !this->fetch(bytes)) {
+				string list;
+				for (auto &dir : dirs) {
+					list += (list.empty() ? "" : ":") + dir;
+				}
+				throw PrttyError("could not load database for terminal: " + termname + " (from search path: " + list + ")");
+			}
+			this->head.store(new Version(load(termname, bytes), bytes, 1));
+			this->generation.store(1);
+
+			// without inotify (or past its limits) this is still a term, reloaded by hand
+			this->inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+			if (this->inotify < 0 || ::pipe2(this->wake, O_CLOEXEC) != 0) {
+				return;
+			}
+			this->watch();
+			this->watcher = thread([this]() {
+				this->run();
+			});
+		}
+
+		// where get() would find the entry now, bypassing the lookup cache
+		string resolve() const {
+			struct stat st;
+			for (auto &dir : this->dirs) {
+				for (auto &sub : this->subdirs) {
+					string path = dir + "/" + sub + "/" + this->termname;
+					if (::stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+						return path;
+					}
+				}
+			}
+			return "";
+		}
+
+		bool fetch(string &bytes) const {
+			string path = this->resolve();
+			if (path.empty()) {
+				return false;
+			}
+			ifstream in(path, ios::binary);
+			if (!in) {
+				return false;
+			}
+			bytes.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+			return true;
+		}
+
+		// every directory the entry could appear in; watching one twice is harmless
+		void watch() {
+			const uint32_t mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE;
+			for (auto &dir : this->dirs) {
+				inotify_add_watch(this->inotify, dir.c_str(), mask | IN_ONLYDIR);
+				for (auto &sub : this->subdirs) {
+					inotify_add_watch(this->inotify, (dir + "/" + sub).c_str(), mask | IN_ONLYDIR);
+				}
+			}
+		}
+
+		void run() {
+			alignas(inotify_event) char buf[4096];
+			for (;;) {
+				pollfd fds[2] = {{this->inotify, POLLIN, 0}, {this->wake[0], POLLIN, 0}};
+				if (::poll(fds, 2, -1) < 0) {
+					if (errno == EINTR) {
+						continue;
+					}
+					return;
+				}
+				if (fds[1].revents) {
+					return;
+				}
+
+				// read the whole burst (a package update is many events), then reload once
+				bool relevant = false;
+				ssize_t n;
+				while ((n = ::read(this->inotify, buf, sizeof buf)) > 0) {
+					for (char *p = buf; p < buf + n;) {
+						inotify_event *ev = reinterpret_cast<inotify_event *>(p);
+						if (ev->len) {
+							const char *name = ev->name;
+							relevant = relevant || name == this->termname || name == this->subdirs[0] || name == this->subdirs[1];
+						}
+						p += sizeof(inotify_event) + ev->len;
+					}
+				}
+
+				if (relevant) {
+					this->watch(); // in case a subdirectory just appeared
+					this->reload();
+				}
+			}
+		}
+
+		Slot * enter() {
+			lock_guard<mutex> guard(this->slotLock);
+			this->slots.emplace_back(new Slot());
+			return this->slots.back().get();
+		}
+
+		void leave(Slot *slot) {
+			lock_guard<mutex> guard(this->slotLock);
+			for (auto it = this->slots.begin(); it != this->slots.end(); ++it) {
+				if (it->get() == slot) {
+					this->slots.erase(it);
+					return;
+				}
+			}
+		}
+
+		// with writeLock held
+		void publish(Version *fresh) {
+			Version *old = this->head.exchange(fresh, memory_order_seq_cst);
+			this->generation.store(fresh->number, memory_order_release);
+			this->retired.push_back(old);
+			this->reclaim();
+		}
+
+		// frees retired versions no reader is copying; with writeLock held
+		void reclaim() {
+			lock_guard<mutex> guard(this->slotLock);
+			for (size_t i = 0; i < this->retired.size();) {
+				bool held = false;
+				for (auto &slot : this->slots) {
+					held = held || slot->hazard.load(memory_order_seq_cst) == this->retired[i];
+				}
+				if (held) {
+					++i;
+				} else {
+					delete this->retired[i];
+					this->retired[i] = this->retired.back();
+					this->retired.pop_back();
+				}
+			}
+		}
+
+		const string termname;
+		const vector<string> dirs;
+		string subdirs[2];
+
+		atomic<Version *> head{nullptr};
+		atomic<uint64_t> generation{0};
+		atomic<size_t> failureCount{0};
+
+		mutable mutex writeLock;
+		vector<Version *> retired;
+
+		mutex slotLock;
+		vector<unique_ptr<Slot>> slots;
+
+		int inotify = -1;
+		int wake[2] = {-1, -1};
+		thread watcher;
+	};
+}
+
+#endif
@@ -0,0 +1,197 @@
+#ifndef PRTTY_RENDER_H
+#define PRTTY_RENDER_H
+#pragma once
+
+/*
+	Builds a frame on several threads at once, for screens big
+	enough (or multiplexers with enough panes) that doing it on
+	one becomes the bottleneck.
+
+	The screen is split into regions - row bands or panes - each
+	rendered into its own buffer by a pool of threads that steal
+	work from each other. Every region's output starts with an
+	absolute `cursor_address` to its top-left corner, so regions
+	don't depend on where the previous one left the cursor, and
+	the buffers are stitched back together in region order with
+	writev(2). The result is byte-for-byte what rendering the
+	regions one after another on a single thread gives.
+
+	Capabilities must be evaluated through `region_output::put`
+	(or streamed into it without arguments): each region has its
+	own evaluation state, whereas streaming a term's capability
+	with arguments into an ostream goes through the term's own,
+	which isn't safe to share between threads.
+*/
+
+#include "./prtty.hpp"
+#include "./prtty-pool.hpp"
+
+#include <cerrno>
+#include <climits>
+
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace prtty {
+	struct region {
+		int row;
+		int col;
+		int rows;
+		int cols;
+	};
+
+	class region_output {
+		friend class parallel_renderer;
+
+	public:
+		// text, numbers, etc.
+		template <typename T>
+		region_output & operator <<(const T &value) {
+			this->os << value;
+			return *this;
+		}
+
+		region_output & operator <<(const impl::SequenceStreamer &cap) {
+			return this->put(cap);
+		}
+
+		// evaluates a capability of this region's term
+		template <typename... Args>
+		region_output & put(const impl::SequenceStreamer &cap, Args... args) {
+			cap.evaluate(this->data, this->os, args...);
+			return *this;
+		}
+
+		// moves the cursor relative to the region's top-left corner
+		region_output & moveTo(int row, int col) {
+			return this->put(this->t.cursor_address, this->area.row + row, this->area.col + col);
+		}
+
+		const region & bounds() const {
+			return this->area;
+		}
+
+		const term & terminal() const {
+			return this->t;
+		}
+
+	private:
+		explicit region_output(const term &t)
+				: t(t)
+				, sb(buf)
+				, os(&sb) {
+		}
+
+		void begin(const region &r) {
+			this->area = r;
+			this->buf.clear();
+			this->moveTo(0, 0);
+		}
+
+		const term &t;
+		region area;
+		impl::Data data;
+		string buf;
+		impl::StringBuf sb;
+		ostream os;
+	};
+
+	class parallel_renderer {
+	public:
+		// `threads` of 0 means one per core
+		explicit parallel_renderer(const term &t, unsigned threads = 0)
+				: t(t)
+				, pool(threads > 0 ? threads : max(1u, thread::hardware_concurrency())) {
+		}
+
+		/*
+			renders every region with `render(region_output &)`, which
+			is called concurrently for different regions.
+		*/
+		template <typename Render>
+		void render(const vector<region> &regions, Render render) {
+#			ifdef PRTTY_TRACE
+			impl::TraceSpan span("parallel_renderer::render", "eval");
+			span.note("regions", regions.size());
+#			endif
+			while (this->outputs.size() < regions.size()) {
+				this->outputs.emplace_back(new region_output(this->t));
+			}
+			this->count = regions.size();
+
+			function<void(size_t)> task = [&](size_t i) {
+				region_output &out = *this->outputs[i];
+				out.begin(regions[i]);
+				render(out);
+			};
+			this->pool.run(regions.size(), task);
+		}
+
+		// the frame's length and, for tests and small outputs, its bytes
+		size_t length() const {
+			size_t n = 0;
+			for (size_t i = 0; i < this->count; i++) {
+				n += this->outputs[i]->buf.length();
+			}
+			return n;
+		}
+
+		string str() const {
+			string s;
+			s.reserve(this->length());
+			for (size_t i = 0; i < this->count; i++) {
+				s += this->outputs[i]->buf;
+			}
+			return s;
+		}
+
+		// writes the whole frame to a blocking fd, gathered with writev
+		void write(int fd) const {
+#			ifdef PRTTY_TRACE
+			impl::TraceSpan span("parallel_renderer::write", "output");
+			span.note("bytes", this->length());
+#			endif
+			vector<struct iovec> iov;
+			iov.reserve(this->count);
+			for (size_t i = 0; i < this->count; i++) {
+				const string &b = this->outputs[i]->buf;
+				if (!b.empty()) {
+					iov.push_back({const_cast<char *>(b.data()), b.length()});
+				}
+			}
+
+			size_t first = 0;
+			while (first < iov.size()) {
+				int n = static_cast<int>(min(iov.size() - first, static_cast<size_t>(IOV_MAX)));
+				ssize_t written = ::writev(fd, &iov[first], n);
+				if (written < 0) {
+					if (errno == EINTR) {
+						continue;
+					}
+					throw PrttyError(string("write failed: ") + strerror(errno));
+				}
+
+				size_t left = static_cast<size_t>(written);
+				while (left > 0 && left >= iov[first].iov_len) {
+					left -= iov[first++].iov_len;
+				}
+				if (left > 0) {
+					iov[first].iov_base = static_cast<char *>(iov[first].iov_base) + left;
+					iov[first].iov_len -= left;
+				}
+			}
+		}
+
+		unsigned threads() const {
+			return this->pool.size();
+		}
+
+	private:
+		const term &t;
+		impl::WorkPool pool;
+		vector<unique_ptr<region_output>> outputs;
+		size_t count = 0;
+	};
+}
+
+#endif
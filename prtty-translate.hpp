@@ -0,0 +1,284 @@
+#ifndef PRTTY_TRANSLATE_H
+#define PRTTY_TRANSLATE_H
+#pragma once
+
+/*
+	Rewrites an output stream written for one terminal into the
+	equivalent bytes for another, e.g. what a client application
+	sends for xterm-256color into what a linux console expects.
+
+	The stream is run through a `recognizer` for the source
+	terminal. Text, and capabilities whose definitions are the
+	same on both sides, are handed to the sink as pointers into
+	the caller's buffer - they're never copied. Everything else
+	is re-evaluated for the target, with colors mapped down to
+	the target's `max_colors` (or dropped), set_attributes split
+	into the individual attribute capabilities when the target
+	has no sgr, and attributes the target can't show dropped.
+
+	Memory use is bounded: only a partial escape sequence at the
+	end of a read is held back (see `recognizer`) and translated
+	bytes are handed over at least every `flushThreshold` bytes.
+
+	A translator evaluates with state of its own, so several can
+	share one target term across threads; each one, though, is
+	only for one thread at a time.
+*/
+
+#include "./prtty.hpp"
+#include "./prtty-color.hpp"
+#include "./prtty-recognizer.hpp"
+
+namespace prtty {
+	class translator {
+	public:
+		static const size_t flushThreshold = 64 * 1024;
+
+		translator(const term &from, const term &to)
+				: rec(from)
+				, to(to)
+				, buf(out)
+				, os(&buf)
+				, rawBegin(nullptr)
+				, rawEnd(nullptr)
+				, inBegin(nullptr)
+				, inEnd(nullptr) {
+#			define PRTTY_DO_STRING(name) this->add(from, to, from.name, to.name);
+#			include "./prtty-strings.inc"
+
+			int fromColors = from.max_colors;
+			int toColors = to.max_colors;
+			for (int i = 0; i < 256; i++) {
+				if (toColors <= 0) {
+					this->colors[i] = -1;
+				} else if (i < toColors) {
+					this->colors[i] = i;
+				} else {
+					this->colors[i] = impl::nearestColor(toColors, impl::paletteColor(fromColors > 16 ? fromColors : 256, i));
+				}
+			}
+			this->out.reserve(flushThreshold);
+		}
+
+		/*
+			translates `len` bytes, calling `sink(const char *, size_t)`
+			with the output. everything but a trailing partial sequence
+			has been handed to the sink by the time this returns.
+		*/
+		template <typename Sink>
+		void feed(const char *data, size_t len, Sink sink) {
+			this->inBegin = data;
+			this->inEnd = data + len;
+
+			this->rec.feed(data, len, [&](const output_event &ev) {
+				this->translate(ev, sink);
+			});
+
+			this->flushRaw(sink);
+			this->flushOut(sink);
+			this->inBegin = this->inEnd = nullptr;
+		}
+
+		// translates a held-back partial sequence as-is (e.g. at end of stream)
+		template <typename Sink>
+		void flush(Sink sink) {
+			this->rec.flush([&](const output_event &ev) {
+				this->translate(ev, sink);
+			});
+			this->flushRaw(sink);
+			this->flushOut(sink);
+		}
+
+	private:
+		enum class Kind {
+			PASS,
+			EVAL,
+			DROP,
+			FOREGROUND,
+			BACKGROUND,
+			ATTRIBUTES,
+			REPEAT
+		};
+
+		struct Action {
+			Kind kind;
+			const impl::SequenceStreamer *target;
+		};
+
+		// ANSI (setaf) and "standard" (setf) color orders differ in red/blue
+		static int swapRedBlue(int color) {
+			return color < 8 ? ((color & 2) | ((color & 1) << 2) | ((color & 4) >> 2)) : color;
+		}
+
+		void add(const term &from, const term &to, const impl::SequenceStreamer &source, const impl::SequenceStreamer &target) {
+			Action action{Kind::DROP, &target};
+
+			bool fg = &source == &from.set_a_foreground || &source == &from.set_foreground;
+			bool bg = &source == &from.set_a_background || &source == &from.set_background;
+			bool colorsFit = to.max_colors >= from.max_colors;
+
+			if (fg || bg) {
+				bool ansi = &source == &from.set_a_foreground || &source == &from.set_a_background;
+				if (target && source.source() == target.source() && colorsFit && ansi == (to.set_a_foreground || !to.set_foreground)) {
+					action.kind = Kind::PASS;
+				} else {
+					action.kind = fg ? Kind::FOREGROUND : Kind::BACKGROUND;
+				}
+				this->ansiSource.push_back(ansi);
+				this->actions.push_back(action);
+				return;
+			}
+			this->ansiSource.push_back(false);
+
+			if (target) {
+				action.kind = source.source() == target.source() ? Kind::PASS : Kind::EVAL;
+			} else if (&source == &from.set_attributes) {
+				action.kind = Kind::ATTRIBUTES;
+			} else if (&source == &from.parm_right_cursor && to.cursor_right) {
+				action = Action{Kind::REPEAT, &to.cursor_right};
+			} else if (&source == &from.parm_left_cursor && to.cursor_left) {
+				action = Action{Kind::REPEAT, &to.cursor_left};
+			} else if (&source == &from.parm_up_cursor && to.cursor_up) {
+				action = Action{Kind::REPEAT, &to.cursor_up};
+			} else if (&source == &from.parm_down_cursor && to.cursor_down) {
+				action = Action{Kind::REPEAT, &to.cursor_down};
+			}
+
+			this->actions.push_back(action);
+		}
+
+		template <typename Sink>
+		void flushRaw(Sink &sink) {
+			if (this->rawBegin != this->rawEnd) {
+				sink(this->rawBegin, static_cast<size_t>(this->rawEnd - this->rawBegin));
+			}
+			this->rawBegin = this->rawEnd = nullptr;
+		}
+
+		template <typename Sink>
+		void flushOut(Sink &sink) {
+			if (!this->out.empty()) {
+				sink(this->out.data(), this->out.size());
+				this->out.clear();
+			}
+		}
+
+		template <typename Sink>
+		void raw(const char *bytes, size_t length, Sink &sink) {
+			// bytes the recognizer held back between reads live in its
+			// own buffer, which won't outlive this call; copy those.
+			if (bytes < this->inBegin || bytes >= this->inEnd) {
+				this->flushRaw(sink);
+				this->out.append(bytes, length);
+				return;
+			}
+
+			this->flushOut(sink);
+			if (this->rawEnd != bytes) {
+				this->flushRaw(sink);
+				this->rawBegin = bytes;
+			}
+			this->rawEnd = bytes + length;
+		}
+
+		template <typename Sink>
+		void translate(const output_event &ev, Sink &sink) {
+			if (ev.type == output_event::Type::TEXT) {
+				this->raw(ev.bytes, ev.length, sink);
+				return;
+			}
+
+			const Action &action = this->actions[ev.capability];
+			if (action.kind == Kind::PASS) {
+				this->raw(ev.bytes, ev.length, sink);
+				return;
+			}
+
+			this->flushRaw(sink);
+
+			const int *a = ev.args;
+			switch (action.kind) {
+			case Kind::PASS:
+			case Kind::DROP:
+				break;
+			case Kind::EVAL:
+				action.target->evaluate(this->data, this->os, a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7], a[8]);
+				break;
+			case Kind::FOREGROUND:
+			case Kind::BACKGROUND:
+				this->color(action.kind == Kind::FOREGROUND, this->ansiSource[ev.capability] ? a[0] : swapRedBlue(a[0]));
+				break;
+			case Kind::ATTRIBUTES:
+				this->attributes(a);
+				break;
+			case Kind::REPEAT:
+				for (int i = 0; i < a[0] && i < 1024; i++) {
+					action.target->evaluate(this->data, this->os);
+				}
+				break;
+			}
+
+			if (this->out.size() >= flushThreshold) {
+				this->flushOut(sink);
+			}
+		}
+
+		void color(bool foreground, int color) {
+			if (color < 0 || color > 255 || this->colors[color] < 0) {
+				return;
+			}
+
+			int c = this->colors[color];
+			const impl::SequenceStreamer &ansi = foreground ? this->to.set_a_foreground : this->to.set_a_background;
+			const impl::SequenceStreamer &standard = foreground ? this->to.set_foreground : this->to.set_background;
+			if (ansi) {
+				ansi.evaluate(this->data, this->os, c);
+			} else if (standard) {
+				standard.evaluate(this->data, this->os, swapRedBlue(c));
+			}
+		}
+
+		// set_attributes for a target without sgr
+		void attributes(const int *a) {
+			const term &t = this->to;
+			const impl::SequenceStreamer *modes[9] = {
+				&t.enter_standout_mode, &t.enter_underline_mode, &t.enter_reverse_mode,
+				&t.enter_blink_mode, &t.enter_dim_mode, &t.enter_bold_mode,
+				&t.enter_secure_mode, &t.enter_protected_mode, &t.enter_alt_charset_mode
+			};
+
+			if (t.exit_attribute_mode) {
+				t.exit_attribute_mode.evaluate(this->data, this->os);
+			}
+
+			for (int i = 0; i < 9; i++) {
+				if (a[i] && *modes[i]) {
+					modes[i]->evaluate(this->data, this->os);
+				}
+			}
+
+			if (!a[8] && t.exit_alt_charset_mode) {
+				t.exit_alt_charset_mode.evaluate(this->data, this->os);
+			}
+		}
+
+		recognizer rec;
+		const term &to;
+		impl::Data data;
+
+		vector<Action> actions;
+		vector<bool> ansiSource;
+		int colors[256];
+
+		string out;
+		impl::StringBuf buf;
+		ostream os;
+
+		const char *rawBegin;
+		const char *rawEnd;
+		const char *inBegin;
+		const char *inEnd;
+	};
+}
+
+#endif
@@ -0,0 +1,224 @@
+#ifndef PRTTY_WRITER_H
+#define PRTTY_WRITER_H
+#pragma once
+
+/*
+	Nonblocking output for rendered frames, so that a slow
+	consumer (an SSH client whose pty buffer is full) never
+	blocks the thread doing the rendering.
+
+	Frames are queued and written with writev(2) as fast as the
+	fd takes them; a short write or EAGAIN just leaves the rest
+	for the next `pump()`. Either call `pump()` whenever your
+	event loop sees the fd writable (`pending()` says whether to
+	ask for POLLOUT), or `flush()` to wait it out with poll(2).
+
+	When the consumer lags, frames are coalesced rather than
+	queued up: a full frame (a complete repaint) supersedes
+	everything still waiting, and once `maxFrames` incremental
+	frames are waiting they're all dropped and `needsFull()`
+	stays true - further increments are dropped too - until a
+	full frame arrives. A frame that's already partly out is
+	always finished first, so the stream never gets cut inside
+	an escape sequence.
+
+	POSIX only. The fd is switched to O_NONBLOCK but isn't
+	closed by the writer.
+*/
+
+#include "./prtty.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <deque>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace prtty {
+	class writer {
+	public:
+		typedef shared_ptr<const string> frame;
+
+		explicit writer(int fd, size_t maxFrames = 8)
+				: out(fd)
+				, maxFrames(maxFrames) {
+			int flags = fcntl(fd, F_GETFL);
+			if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+				throw PrttyError(string("could not make fd nonblocking: ") + strerror(errno));
+			}
+		}
+
+		/*
+			queues a frame and writes what it can right away. `full`
+			frames repaint everything; incremental ones only make sense
+			on top of what came before them.
+		*/
+		void write(frame f, bool full = true) {
+			if (full) {
+				this->drop();
+				this->awaitingFull = false;
+			} else if (this->awaitingFull) {
+				++this->droppedFrames;
+				return;
+			} else if (this->depth() >= this->maxFrames) {
+				this->drop();
+				++this->droppedFrames;
+				this->awaitingFull = true;
+				return;
+			}
+
+			this->queuedBytes += f->length();
+			this->queue.push_back(move(f));
+			this->maxDepth = max(this->maxDepth, this->queue.size());
+			this->pump();
+		}
+
+		void write(string bytes, bool full = true) {
+			this->write(std::make_shared<const string>(move(bytes)), full);
+		}
+
+		/*
+			writes as much as the fd will take without blocking.
+			returns true once the queue is empty.
+		*/
+		bool pump() {
+#			ifdef PRTTY_TRACE
+			impl::TraceSpan span("writer::pump", "output");
+			span.note("bytes", this->queued());
+#			endif
+			while (!this->queue.empty()) {
+				struct iovec iov[64];
+				int n = 0;
+				for (auto it = this->queue.begin(); it != this->queue.end() && n < 64; ++it, ++n) {
+					size_t skip = n == 0 ? this->offset : 0;
+					iov[n].iov_base = const_cast<char *>((*it)->data() + skip);
+					iov[n].iov_len = (*it)->length() - skip;
+				}
+
+				ssize_t written = ::writev(this->out, iov, n);
+				if (written < 0) {
+					if (errno == EINTR) {
+						continue;
+					}
+					if (errno == EAGAIN || errno == EWOULDBLOCK) {
+						return false;
+					}
+					throw PrttyError(string("write failed: ") + strerror(errno));
+				}
+
+				this->consume(static_cast<size_t>(written));
+			}
+
+			return true;
+		}
+
+		/*
+			waits up to `timeout` for the queue to drain. returns
+			whether it did.
+		*/
+		bool flush(chrono::milliseconds timeout) {
+#			ifdef PRTTY_TRACE
+			impl::TraceSpan span("writer::flush", "output");
+			span.note("bytes", this->queued());
+#			endif
+			auto deadline = chrono::steady_clock::now() + timeout;
+			while (!this->pump()) {
+				auto left = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now());
+				if (left.count() <= 0) {
+					return false;
+				}
+
+				struct pollfd p = {this->out, POLLOUT, 0};
+				int r = ::poll(&p, 1, static_cast<int>(left.count()));
+				if (r < 0 && errno != EINTR) {
+					throw PrttyError(string("poll failed: ") + strerror(errno));
+				}
+				if (r > 0 && (p.revents & (POLLERR | POLLHUP | POLLNVAL))) {
+					throw PrttyError("output closed");
+				}
+			}
+
+			return true;
+		}
+
+		int fd() const {
+			return this->out;
+		}
+
+		// whether there's anything left to write (i.e. wait for POLLOUT)
+		bool pending() const {
+			return !this->queue.empty();
+		}
+
+		// frames and bytes still queued
+		size_t depth() const {
+			return this->queue.size();
+		}
+
+		size_t queued() const {
+			return this->queuedBytes - this->offset;
+		}
+
+		// the most frames that were ever queued at once
+		size_t highWater() const {
+			return this->maxDepth;
+		}
+
+		// frames discarded unwritten (superseded or over the limit)
+		size_t dropped() const {
+			return this->droppedFrames;
+		}
+
+		// whether incremental frames are being dropped until a full one
+		bool needsFull() const {
+			return this->awaitingFull;
+		}
+
+	private:
+		// discards every frame that hasn't started going out
+		void drop() {
+			size_t keep = this->offset > 0 ? 1 : 0;
+			while (this->queue.size() > keep) {
+				this->queuedBytes -= this->queue.back()->length();
+				this->queue.pop_back();
+				++this->droppedFrames;
+			}
+		}
+
+		void consume(size_t written) {
+			while (written > 0) {
+				size_t left = this->queue.front()->length() - this->offset;
+				if (written < left) {
+					this->offset += written;
+					return;
+				}
+
+				written -= left;
+				this->queuedBytes -= this->queue.front()->length();
+				this->queue.pop_front();
+				this->offset = 0;
+			}
+
+			// empty frames never show up as progress from writev
+			while (!this->queue.empty() && this->queue.front()->empty()) {
+				this->queue.pop_front();
+			}
+		}
+
+		int out;
+		size_t maxFrames;
+
+		deque<frame> queue;
+		size_t offset = 0;
+		size_t queuedBytes = 0;
+
+		size_t maxDepth = 0;
+		size_t droppedFrames = 0;
+		bool awaitingFull = false;
+	};
+}
+
+#endif
@@ -3,9 +3,9 @@
 #pragma once
 
 /*
-	Please note that this library does NOT support
-	delays (millisecond delays). Please, stop using
-	outdated technology and let's move on.
+	Delays ($<..> padding) are dropped unless asked
+	for with term::use_padding, for the serial lines
+	that still need them.
 
 	This library assumes compiled files are the
 	ncurses extended compiled formats. If they're not,
@@ -13,23 +13,51 @@
 	move on.
 */
 
+#include <algorithm>
+#include <array>
+#include <chrono>
 #include <cstdint>
+#include <cstdlib>
 #include <cstring>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <stack>
 #include <stdexcept>
+#include <thread>
+#include <tuple>
+#include <typeinfo>
 #include <sstream>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include <sys/stat.h>
+
+#ifdef __SSE2__
+#	include <emmintrin.h>
+#endif
+
+#if defined(PRTTY_METRICS) || defined(PRTTY_TRACE)
+#	include <atomic>
+#	include <chrono>
+#endif
+
 namespace prtty {
 	using namespace std;
 
 	struct term;
 	term get(string termname, string basePath);
+	term load(string termname, const string &compiled);
+	vector<string> search_path();
+	string locate(const string &termname);
 
 	class PrttyError : public runtime_error {
 	public:
@@ -40,6 +68,142 @@ namespace prtty {
 	};
 
 	namespace impl {
+#		ifdef PRTTY_TRACE
+		/*
+			timeline tracing, only compiled in with PRTTY_TRACE defined
+			and only recording between enable_tracing(true) and false.
+			spans go into a ring per thread, written by that thread
+			alone: the oldest are overwritten once it's full, and
+			write_trace() reads them without stopping the writer,
+			leaving out any slot it might have been caught rewriting.
+			fields are relaxed atomics so that reading is race-free.
+		*/
+		struct TraceEvent {
+			atomic<const char *> name;
+			atomic<const char *> category;
+			atomic<const char *> argName;
+			atomic<uint64_t> arg;
+			atomic<uint64_t> start; // ns, steady_clock
+			atomic<uint64_t> duration;
+		};
+
+		struct TraceRing {
+			static const uint64_t capacity = 8192;
+
+			explicit TraceRing(uint32_t tid)
+					: tid(tid) {
+			}
+
+			void push(const char *name, const char *category, const char *argName, uint64_t arg, uint64_t start, uint64_t duration) {
+				uint64_t h = this->head.load(memory_order_relaxed);
+				// orders the overwrite after the head that says the slot is being reused
+				atomic_thread_fence(memory_order_release);
+				TraceEvent &e = this->events[h & (capacity - 1)];
+				e.name.store(name, memory_order_relaxed);
+				e.category.store(category, memory_order_relaxed);
+				e.argName.store(argName, memory_order_relaxed);
+				e.arg.store(arg, memory_order_relaxed);
+				e.start.store(start, memory_order_relaxed);
+				e.duration.store(duration, memory_order_relaxed);
+				this->head.store(h + 1, memory_order_release);
+			}
+
+			const uint32_t tid;
+			atomic<uint64_t> head{0};
+			atomic<uint64_t> from{0}; // where clear_trace() left it
+			atomic<bool> finished{false}; // its thread has exited
+			TraceEvent events[capacity];
+		};
+
+		// static members of a template, so that a header can define them
+		template <typename T = void>
+		struct Tracing {
+			struct Local {
+				~Local() {
+					if (this->ring) {
+						this->ring->finished.store(true);
+					}
+				}
+
+				shared_ptr<TraceRing> ring;
+			};
+
+			static atomic<bool> on;
+			static mutex lock;
+			static vector<shared_ptr<TraceRing>> rings;
+			static uint32_t nextTid;
+			static thread_local Local local;
+			static thread_local uint64_t clockReads; // by this thread, for tests
+
+			static uint64_t now() {
+				++clockReads;
+				return static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count());
+			}
+
+			static TraceRing & ring() {
+				Local &l = local;
+				if (!l.ring) {
+					lock_guard<mutex> guard(lock);
+					l.ring = make_shared<TraceRing>(++nextTid);
+					rings.push_back(l.ring);
+				}
+				return *l.ring;
+			}
+		};
+
+		template <typename T> atomic<bool> Tracing<T>::on(false);
+		template <typename T> mutex Tracing<T>::lock;
+		template <typename T> vector<shared_ptr<TraceRing>> Tracing<T>::rings;
+		template <typename T> uint32_t Tracing<T>::nextTid = 0;
+		template <typename T> thread_local typename Tracing<T>::Local Tracing<T>::local;
+		template <typename T> thread_local uint64_t Tracing<T>::clockReads = 0;
+
+		/*
+			records the span from its construction to its destruction.
+			while tracing is off, that's the one branch on the flag.
+			names are kept by pointer, so they must be literals.
+		*/
+		class TraceSpan {
+		public:
+			TraceSpan(const char *name, const char *category)
+					: name(nullptr)
+					, category(nullptr)
+					, argName(nullptr)
+					, arg(0)
+					, start(0) {
+				if (Tracing<>::on.load(memory_order_relaxed)) {
+					this->name = name;
+					this->category = category;
+					this->start = Tracing<>::now();
+				}
+			}
+
+			TraceSpan(const TraceSpan &) = delete;
+			TraceSpan & operator =(const TraceSpan &) = delete;
+
+			~TraceSpan() {
+				if (this->name) {
+					uint64_t end = Tracing<>::now();
+					Tracing<>::ring().push(this->name, this->category, this->argName, this->arg, this->start, end - this->start);
+				}
+			}
+
+			// a number to show with the span (bytes, records, ...)
+			void note(const char *argName, uint64_t arg) {
+				if (this->name) {
+					this->argName = argName;
+					this->arg = arg;
+				}
+			}
+
+		private:
+			const char *name;
+			const char *category;
+			const char *argName;
+			uint64_t arg;
+			uint64_t start;
+		};
+#		endif
 
 		struct Any {
 			enum class Type {
@@ -90,6 +254,53 @@ namespace prtty {
 			}
 		};
 
+		/*
+			the evaluation stack. programs are checked when they're
+			parsed (see Shape), so it's sized for the one about to run
+			and nothing is bounds-checked while it does. ncurses pops 0
+			off an empty stack; a program that would do that starts
+			out with enough 0s already on it instead.
+		*/
+		struct Stack {
+			Stack()
+					: size(0)
+					, base(0) {
+			}
+
+			// for a program needing `depth` slots, the first `zeros` of them 0
+			void reset(size_t depth, size_t zeros) {
+				if (this->items.size() < depth) {
+					this->items.resize(depth);
+				}
+				for (size_t i = 0; i < zeros; i++) {
+					this->items[i] = Any(0);
+				}
+				this->size = zeros;
+				this->base = zeros;
+			}
+
+			void push(const Any &v) noexcept {
+				this->items[this->size++] = v;
+			}
+
+			Any & top() noexcept {
+				return this->items[this->size - 1];
+			}
+
+			void pop() noexcept {
+				--this->size;
+			}
+
+			void clear() noexcept {
+				this->size = 0;
+				this->base = 0;
+			}
+
+			vector<Any> items;
+			size_t size;
+			size_t base; // where the program's own values start
+		};
+
 		struct Data {
 			/*
 				we create data structs to avoid re-allocation
@@ -98,25 +309,83 @@ namespace prtty {
 			*/
 
 			Data() {
-				this->dparm.reserve(26);
-				this->sparm.reserve(26);
-				fill(this->dparm.begin(), this->dparm.end(), Any(0));
-				fill(this->sparm.begin(), this->sparm.end(), Any(0));
+				this->dparm.fill(Any(0));
+				this->sparm.fill(Any(0));
+			}
+
+			/*
+				a copy starts out where the original's static variables
+				are, and with a stack of its own (allocated when first
+				used), so making one never allocates.
+			*/
+			Data(const Data &other)
+					: sparm(other.sparm)
+					, padding(other.padding) {
+				this->dparm.fill(Any(0));
+			}
+
+			Data & operator =(const Data &other) {
+				this->sparm = other.sparm;
+				this->padding = other.padding;
+				return *this;
 			}
 
 			template <typename... Args>
 			void session(Args... args) {
-				stack<Any>().swap(this->stk);
-				this->dparm.clear();
-				this->params = vector<Any>(9, Any());
-				this->params.insert(this->params.begin(), {args...});
+				this->stk.clear();
+				this->dparm.fill(Any(0));
+
+				// the first is a placeholder, for calls without arguments
+				const Any given[] = {Any(), args...};
+				const size_t count = sizeof(given) / sizeof(given[0]) - 1;
+				for (size_t i = 0; i < 9; i++) {
+					this->params[i] = i < count ? given[i + 1] : Any();
+				}
+			}
+
+			// session() for int arguments
+			void bind(const int *args, size_t count) {
+				this->stk.clear();
+				this->dparm.fill(Any(0));
+				for (size_t i = 0; i < 9; i++) {
+					this->params[i] = i < count ? Any(args[i]) : Any();
+				}
+			}
+
+			// counts output for PRTTY_METRICS; compiled out otherwise
+			void wrote(size_t n) {
+#				ifdef PRTTY_METRICS
+				this->written += n;
+#				else
+				(void) n;
+#				endif
 			}
 
-			stack<Any> stk;
-			vector<Any> params;
-			vector<Any> dparm;
+			// how $<..> delays are honored (see term::use_padding); not at all by default
+			struct Padding {
+				Padding()
+						: baud(0)
+						, pad('\0')
+						, wait(false)
+						, normal(false) {
+				}
+
+				int baud; // of the line; 0 drops all padding
+				char pad; // sent to fill a delay
+				bool wait; // flush and sleep instead, for terminals without a pad character
+				bool normal; // whether delays that aren't mandatory apply too
+			};
+
+			Stack stk;
+			array<Any, 9> params;
+			array<Any, 26> dparm;
+
+			array<Any, 26> sparm;
+			Padding padding;
 
-			vector<Any> sparm;
+#			ifdef PRTTY_METRICS
+			uint64_t written = 0;
+#			endif
 		};
 
 
@@ -126,29 +395,26 @@ namespace prtty {
 
 			virtual ~Operation() = default;
 
-			virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) = 0;
-
-			virtual bool isControlOp() const {
-				return false;
-			}
-
-			virtual bool isControlTerminal() const {
-				return false;
-			}
+			virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) noexcept = 0;
 		};
 
 		namespace op {
+			// arithmetic overflows wrap around, as it does in practice in tparm
+			inline int wrap(int64_t v) noexcept {
+				return static_cast<int>(static_cast<uint32_t>(v));
+			}
+
 			struct StringLiteral : public Operation {
 				const string literal;
 
 				StringLiteral(string literal) : literal(literal) {}
 				virtual ~StringLiteral() = default;
 
-				virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) {
+				virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) noexcept {
 					(void) citr;
 					(void) cend;
-					(void) data;
 					stream << this->literal;
+					data.wrote(this->literal.length());
 				}
 			};
 
@@ -162,7 +428,7 @@ namespace prtty {
 				}
 				virtual ~PushArg() = default;
 
-				virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) {
+				virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) noexcept {
 					(void) citr;
 					(void) cend;
 					(void) stream;
@@ -173,7 +439,7 @@ namespace prtty {
 			struct PushStrlen : public Operation {
 				virtual ~PushStrlen() = default;
 
-				virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) {
+				virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) noexcept {
 					(void) citr;
 					(void) cend;
 					(void) stream;
@@ -201,7 +467,7 @@ namespace prtty {
 				PushLiteralInt(int literal) : literal(literal) {}
 				virtual ~PushLiteralInt() = default;
 
-				virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) {
+				virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) noexcept {
 					(void) citr;
 					(void) cend;
 					(void) stream;
@@ -215,7 +481,7 @@ namespace prtty {
 				PushLiteralChar(char literal) : literal(literal) {}
 				virtual ~PushLiteralChar() = default;
 
-				virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) {
+				virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) noexcept {
 					(void) citr;
 					(void) cend;
 					(void) stream;
@@ -233,7 +499,7 @@ namespace prtty {
 				}
 				virtual ~PopSetDynamic() = default;
 
-				virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) {
+				virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) noexcept {
 					(void) citr;
 					(void) cend;
 					(void) stream;
@@ -252,7 +518,7 @@ namespace prtty {
 				}
 				virtual ~PopSetStatic() = default;
 
-				virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) {
+				virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) noexcept {
 					(void) citr;
 					(void) cend;
 					(void) stream;
@@ -271,7 +537,7 @@ namespace prtty {
 				}
 				virtual ~PushDynamic() = default;
 
-				virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) {
+				virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) noexcept {
 					(void) citr;
 					(void) cend;
 					(void) stream;
@@ -289,7 +555,7 @@ namespace prtty {
 				}
 				virtual ~PushStatic() = default;
 
-				virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) {
+				virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) noexcept {
 					(void) citr;
 					(void) cend;
 					(void) stream;
@@ -310,7 +576,7 @@ namespace prtty {
 
 				virtual ~PopWriteString() = default;
 
-				virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) {
+				virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) noexcept {
 					(void) citr;
 					(void) cend;
 
@@ -345,179 +611,320 @@ namespace prtty {
 
 					stream << result;
 					stream.flags(f);
+					data.wrote(max(result.length(), static_cast<size_t>(this->width > 0 ? this->width : 0)));
 				}
 			};
 
-			struct PopWriteInt : public Operation {
+			// printf's flags, field width and precision for %d, %o, %x and %X
+			struct IntFormat {
+				IntFormat()
+						: left(false)
+						, sign(false)
+						, space(false)
+						, alternate(false)
+						, zero(false)
+						, width(-1)
+						, precision(-1) {
+				}
+
 				bool left;
-				int width;
 				bool sign;
+				bool space;
+				bool alternate;
+				bool zero;
+				int width;
+				int precision;
+			};
 
-				PopWriteInt(bool left=false, int width=-1, bool sign=false)
-						: left(left)
-						, width(width)
-						, sign(sign) {
+			/*
+				formats with snprintf, as tparm does, so that padding and
+				precision come out the same. plain %d skips it. widths and
+				precisions past `maxField` are held to it, so that whatever
+				comes out fits the buffer write() formats into.
+			*/
+			struct PopWriteInt : public Operation {
+				static const int maxField = 60; // plus a sign or 0x, under 64
+
+				const IntFormat fmt;
+				const char conversion;
+				char spec[32];
+
+				PopWriteInt(const IntFormat &fmt = IntFormat(), char conversion = 'd')
+						: fmt(fitted(fmt))
+						, conversion(conversion) {
+					string s = "%";
+					if (fmt.left) s += '-';
+					if (fmt.sign) s += '+';
+					if (fmt.space) s += ' ';
+					if (fmt.alternate) s += '#';
+					if (fmt.zero) s += '0';
+					if (this->fmt.width > -1) s += to_string(this->fmt.width);
+					if (this->fmt.precision > -1) s += "." + to_string(this->fmt.precision);
+					s += conversion;
+					strncpy(this->spec, s.c_str(), sizeof(this->spec) - 1);
+					this->spec[sizeof(this->spec) - 1] = 0;
 				}
 
 				virtual ~PopWriteInt() = default;
 
-				virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) {
+				static IntFormat fitted(IntFormat fmt) {
+					if (fmt.width > maxField) {
+						fmt.width = maxField;
+					}
+					if (fmt.precision > maxField) {
+						fmt.precision = maxField;
+					}
+					return fmt;
+				}
+
+				// nothing to format beyond the digits
+				bool plain() const {
+					return this->conversion == 'd' && this->fmt.width < 0 && this->fmt.precision < 0
+						&& !this->fmt.sign && !this->fmt.space;
+				}
+
+				virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) noexcept {
 					(void) citr;
 					(void) cend;
 
 					Any &v = data.stk.top();
-
-					ios::fmtflags f(stream.flags());
-
-					if (this->width > -1) {
-						stream << std::setw(this->width);
-					}
-					if (this->left) {
-						stream << std::left;
-					}
-					if (this->sign) {
-						stream << std::showpos;
-					}
-
+					int value = 0;
 					switch (v.type) {
 					case Any::Type::INT:
-						stream << v.tint;
+						value = v.tint;
 						break;
 					case Any::Type::CHAR:
-						stream << static_cast<int>(v.tchar);
+						value = static_cast<int>(v.tchar);
 						break;
 					case Any::Type::STRING:
-						stream << 0;
 						break;
 					}
 					data.stk.pop();
 
-					stream.flags(f);
+					this->write(stream, data, value);
+				}
+
+				void write(ostream &stream, Data &data, int value) const {
+					// plain %d is by far the most common
+					if (this->plain()) {
+						char digits[12];
+						char *end = digits + sizeof(digits);
+						char *p = end;
+						unsigned int u = value < 0 ? 0u - static_cast<unsigned int>(value) : static_cast<unsigned int>(value);
+						do {
+							*--p = static_cast<char>('0' + u % 10);
+							u /= 10;
+						} while (u != 0);
+						if (value < 0) {
+							*--p = '-';
+						}
+						stream.write(p, end - p);
+						data.wrote(static_cast<size_t>(end - p));
+						return;
+					}
+
+#					ifdef __clang__
+#						pragma clang diagnostic push
+#						pragma clang diagnostic ignored "-Wformat-nonliteral"
+#					endif
+					char buf[64];
+					int n = this->conversion == 'd'
+						? snprintf(buf, sizeof(buf), this->spec, value)
+						: snprintf(buf, sizeof(buf), this->spec, static_cast<unsigned int>(value));
+					// maxField keeps n under sizeof(buf)
+					if (n < 0) {
+						return;
+					}
+					stream.write(buf, n);
+#					ifdef __clang__
+#						pragma clang diagnostic pop
+#					endif
+					data.wrote(static_cast<size_t>(n));
 				}
 			};
 
 			struct PopWriteOct : public PopWriteInt {
-				bool exmode;
-
-				PopWriteOct(bool left=false, int width=-1, bool sign=false, bool exmode=false)
-						: PopWriteInt(left, width, sign)
-						, exmode(exmode) {
+				PopWriteOct(const IntFormat &fmt = IntFormat())
+						: PopWriteInt(fmt, 'o') {
 				}
 
 				virtual ~PopWriteOct() = default;
-
-				virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) {
-					(void) citr;
-					(void) cend;
-
-					ios::fmtflags f(stream.flags());
-					stream << oct;
-					if (this->exmode) {
-						stream << std::showbase;
-					}
-					this->PopWriteInt::operator()(stream, data, citr, cend);
-					stream.flags(f);
-				}
 			};
 
 			struct PopWriteHex : public PopWriteInt {
-				bool exmode;
-
-				PopWriteHex(bool left=false, int width=-1, bool sign=false, bool exmode=false)
-						: PopWriteInt(left, width, sign)
-						, exmode(exmode) {
+				PopWriteHex(const IntFormat &fmt = IntFormat())
+						: PopWriteInt(fmt, 'x') {
 				}
 
 				virtual ~PopWriteHex() = default;
-
-				virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) {
-					(void) citr;
-					(void) cend;
-
-					ios::fmtflags f(stream.flags());
-					stream << hex;
-					if (this->exmode) {
-						stream << std::showbase;
-					}
-					this->PopWriteInt::operator()(stream, data, citr, cend);
-					stream.flags(f);
-				}
 			};
 
-			struct PopWriteUHex : public PopWriteHex {
-				PopWriteUHex(bool left=false, int width=-1, bool sign=false, bool exmode=false)
-						: PopWriteHex(left, width, sign, exmode) {
+			struct PopWriteUHex : public PopWriteInt {
+				PopWriteUHex(const IntFormat &fmt = IntFormat())
+						: PopWriteInt(fmt, 'X') {
 				}
 
 				virtual ~PopWriteUHex() = default;
-
-				virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) {
-					(void) citr;
-					(void) cend;
-
-					ios::fmtflags f(stream.flags());
-					stream << uppercase;
-					this->PopWriteHex::operator()(stream, data, citr, cend);
-					stream.flags(f);
-				}
 			};
 
 			struct PopWriteChar : public Operation {
 				virtual ~PopWriteChar() = default;
 
-				virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) {
+				// like tparm, which can't return a NUL; terminals that care read 0200 as one
+				static char byte(int value) {
+					return static_cast<char>(value == 0 ? 0200 : value & 0xFF);
+				}
+
+				static void put(ostream &stream, int value) {
+					stream.put(byte(value));
+				}
+
+				/*
+					the argument that, with `offset` added, byte() turned
+					into `b`. 0200 is both 0 and 128, so it's 0 unless
+					that would make the argument negative.
+				*/
+				static int argument(unsigned char b, int offset) {
+					return (b == 0200 && offset <= 0 ? 0 : b) - offset;
+				}
+
+				virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) noexcept {
 					(void) citr;
 					(void) cend;
 					Any &v = data.stk.top();
 					switch (v.type) {
 					case Any::Type::INT:
-						stream << string(1, static_cast<char>(v.tint & 0xFF));
+						put(stream, v.tint);
 						break;
 					case Any::Type::CHAR:
-						stream << string(1, v.tchar);
+						stream.put(v.tchar);
 						break;
 					case Any::Type::STRING:
-						stream << string(1, v.tstring[0]);
+						stream.put(v.tstring[0]);
 						break;
 					}
 					data.stk.pop();
+					data.wrote(1);
 				}
 			};
 
 			struct IncrementFirstTwo : public Operation {
+				// in termcap-style strings the arguments are already on the stack
+				const bool stacked;
+
+				IncrementFirstTwo(bool stacked = false) : stacked(stacked) {}
 				virtual ~IncrementFirstTwo() = default;
 
-				virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) {
+				virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) noexcept {
 					(void) citr;
 					(void) cend;
 					(void) stream;
-					if (data.params[0].type == Any::Type::INT) data.params[0].tint++;
-					if (data.params[1].type == Any::Type::INT) data.params[1].tint++;
+					if (data.params[0].type == Any::Type::INT) data.params[0].tint = wrap(data.params[0].tint + int64_t(1));
+					if (data.params[1].type == Any::Type::INT) data.params[1].tint = wrap(data.params[1].tint + int64_t(1));
+
+					// and are overwritten from the bottom up, as tparm does
+					if (this->stacked) {
+						for (size_t i = 0; i < 2 && data.stk.base + i < data.stk.size; i++) {
+							data.stk.items[data.stk.base + i] = data.params[i];
+						}
+					}
 				}
 			};
 
-			struct Cond : public Operation {
-				virtual ~Cond() = default;
+			/*
+				a $<..> delay, worked out to milliseconds when parsed.
+				it sends nothing unless padding is turned on, and then
+				does as tputs does: pad characters enough to fill the
+				delay at the line's speed (9 bits to a character), or
+				a flush and a sleep on terminals with no_pad_char.
+			*/
+			struct Pad : public Operation {
+				const int ms;
+				const bool mandatory; // $<../>, even with xon_xoff or below padding_baud_rate
+				bool always; // set for bell and flash_screen, which tputs always delays
+
+				Pad(int ms, bool mandatory)
+						: ms(ms)
+						, mandatory(mandatory)
+						, always(false) {
+				}
 
-				virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) {
-					(void) stream;
+				virtual ~Pad() = default;
+
+				virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) noexcept {
+					(void) citr;
+					(void) cend;
+					this->delay(stream, data);
+				}
+
+				void delay(ostream &stream, Data &data) const noexcept {
+					const Data::Padding &p = data.padding;
+					if (p.baud <= 0 || this->ms <= 0 || !(this->mandatory || this->always || p.normal)) {
+						return;
+					}
+
+					if (p.wait) {
+						stream.flush();
+						this_thread::sleep_for(chrono::milliseconds(this->ms));
+						return;
+					}
+
+					int64_t count = int64_t(this->ms) * p.baud / 9000;
+					for (int64_t i = 0; i < count; i++) {
+						stream.put(p.pad);
+					}
+					data.wrote(static_cast<size_t>(count));
+				}
+			};
+
+			/*
+				termcap-style strings have no %p; their %d and %c pop the
+				arguments in order, so those are pushed up front with the
+				first on top.
+			*/
+			struct PushArgs : public Operation {
+				const unsigned int count;
+
+				PushArgs(unsigned int count) : count(count) {}
+				virtual ~PushArgs() = default;
 
-					++citr;
-					for (; citr != cend && !(*citr)->isControlOp(); citr++) {
-						(**citr)(stream, data, citr, cend);
+				virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) noexcept {
+					(void) citr;
+					(void) cend;
+					(void) stream;
+					for (unsigned int i = this->count; i-- > 0;) {
+						data.stk.push(data.params[i]);
 					}
 				}
+			};
+
+			/*
+				conditionals are resolved into jumps when parsing:
+				%t skips to just past its matching %e (or to the %;)
+				when false, and reaching an %e means the preceding
+				branch was taken, so it skips to the matching %;.
+				`skip` is the number of ops to jump over.
+			*/
+			struct Cond : public Operation {
+				virtual ~Cond() = default;
 
-				virtual bool isControlOp() const {
-					return true;
+				virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) noexcept {
+					(void) stream;
+					(void) data;
+					(void) citr;
+					(void) cend;
 				}
 			};
 
-			struct CondThen : public Cond {
+			struct CondThen : public Operation {
+				ptrdiff_t skip;
+
+				CondThen() : skip(0) {}
 				virtual ~CondThen() = default;
 
-				virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) {
+				virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) noexcept {
 					(void) stream;
+					(void) cend;
 
 					bool enable = false;
 					Any &val = data.stk.top();
@@ -534,41 +941,36 @@ namespace prtty {
 					}
 					data.stk.pop();
 
-					if (enable) {
-						this->Cond::operator()(stream, data, citr, cend);
-					} else {
-						while (citr != cend && !(*citr)->isControlTerminal()) {
-							++citr;
-						}
+					if (!enable) {
+						citr += this->skip;
 					}
 				}
 			};
 
-			struct CondEnd : public Operation {
-				virtual ~CondEnd() = default;
+			struct CondElse : public Operation {
+				ptrdiff_t skip;
 
-				virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) {
+				CondElse() : skip(0) {}
+				virtual ~CondElse() = default;
+
+				virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) noexcept {
 					(void) stream;
-					(void) citr;
+					(void) data;
 					(void) cend;
 
-					// Can't tell if this is necessary.
-					data.stk.pop();
-				}
-
-				virtual bool isControlOp() const {
-					return true;
+					citr += this->skip;
 				}
+			};
 
-				virtual bool isControlTerminal() const {
-					return true;
-				}
+			struct CondEnd : public Cond {
+				virtual ~CondEnd() = default;
 			};
 
-#			define BinOp(name, verb, operand) struct name : public Operation { \
+			// tparm reads a string operand as 0
+#			define BinOp(name, operand) struct name : public Operation { \
 				virtual ~name() = default; \
 				\
-				virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) { \
+				virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) noexcept { \
 					(void) stream; \
 					(void) citr; \
 					(void) cend; \
@@ -588,46 +990,47 @@ namespace prtty {
 						result = lop.tchar; \
 						break; \
 					case Any::Type::STRING: \
-					nostrings: \
-						throw prtty::PrttyError("cannot " verb " a string operand: " + lop.toString() + " " #operand " " + rop.toString()); \
+						break; \
 					} \
 					\
+					int right = 0; \
 					switch (rop.type) { \
 					case Any::Type::INT: \
-						result = result operand rop.tint; \
+						right = rop.tint; \
 						break; \
 					case Any::Type::CHAR: \
-						result = result operand rop.tchar; \
+						right = rop.tchar; \
 						break; \
 					case Any::Type::STRING: \
-						goto nostrings; \
+						break; \
 					} \
 					\
-					data.stk.push(result); \
+					/* tparm makes dividing by zero give 0 */ \
+					data.stk.push(right == 0 && (#operand[0] == '/' || #operand[0] == '%') ? 0 : wrap(int64_t(result) operand right)); \
 				} \
 			}
 
-			BinOp(ArithAdd, "add", +);
-			BinOp(ArithSub, "subtract", -);
-			BinOp(ArithMul, "multiply", *);
-			BinOp(ArithDiv, "divide", /);
-			BinOp(ArithMod, "modulo (find the remainder of)", %);
+			BinOp(ArithAdd, +);
+			BinOp(ArithSub, -);
+			BinOp(ArithMul, *);
+			BinOp(ArithDiv, /);
+			BinOp(ArithMod, %);
 
-			BinOp(BitOr, "bitwise-or", |);
-			BinOp(BitAnd, "bitwise-and", &);
-			BinOp(BitXor, "bitwise-xor", ^);
+			BinOp(BitOr, |);
+			BinOp(BitAnd, &);
+			BinOp(BitXor, ^);
 
-			BinOp(BoolGt, "perform greater-than conditionals on", >);
-			BinOp(BoolLt, "perform less-than conditionals on", <);
-			BinOp(BoolAnd, "perform boolean-and conditionals on", &&);
-			BinOp(BoolOr, "perform boolean-or conditionals on", ||);
+			BinOp(BoolGt, >);
+			BinOp(BoolLt, <);
+			BinOp(BoolAnd, &&);
+			BinOp(BoolOr, ||);
 
 #			undef BinOp
 
 			struct BoolEq : public Operation {
 				virtual ~BoolEq() = default;
 
-				virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) {
+				virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) noexcept {
 					(void) stream;
 					(void) citr;
 					(void) cend;
@@ -637,41 +1040,44 @@ namespace prtty {
 					Any &lop = data.stk.top();
 					data.stk.pop();
 
-					int result = 0;
+					// two strings compare by content; otherwise a string reads as 0, as in tparm
+					if (lop.type == Any::Type::STRING && rop.type == Any::Type::STRING) {
+						data.stk.push(static_cast<int>(strcmp(lop.tstring, rop.tstring) == 0));
+						return;
+					}
 
+					int left = 0;
 					switch (lop.type) {
 					case Any::Type::INT:
-						result = lop.tint;
+						left = lop.tint;
 						break;
 					case Any::Type::CHAR:
-						result = lop.tchar;
+						left = lop.tchar;
 						break;
 					case Any::Type::STRING:
-						if (rop.type != Any::Type::STRING) {
-							throw prtty::PrttyError("cannot determine equality of mixed string/integral operands: " + lop.toString() + " == " + rop.toString());
-						}
+						break;
 					}
 
+					int right = 0;
 					switch (rop.type) {
 					case Any::Type::INT:
-						result = result == rop.tint;
+						right = rop.tint;
 						break;
 					case Any::Type::CHAR:
-						result = result == rop.tchar;
+						right = rop.tchar;
 						break;
 					case Any::Type::STRING:
-						result = strcmp(lop.tstring, rop.tstring) == 0;
 						break;
 					}
 
-					data.stk.push(result);
+					data.stk.push(static_cast<int>(left == right));
 				}
 			};
 
 			struct BoolNot : public Operation {
 				virtual ~BoolNot() = default;
 
-				virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) {
+				virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) noexcept {
 					(void) stream;
 					(void) citr;
 					(void) cend;
@@ -697,7 +1103,7 @@ namespace prtty {
 			struct BitNegate : public Operation {
 				virtual ~BitNegate() = default;
 
-				virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) {
+				virtual void operator()(ostream &stream, Data &data, OpItr &citr, OpItr &cend) noexcept {
 					(void) stream;
 					(void) citr;
 					(void) cend;
@@ -713,68 +1119,646 @@ namespace prtty {
 						data.stk.push(~val.tchar);
 						break;
 					case Any::Type::STRING:
-						throw prtty::PrttyError("cannot bitwise negate a string: ~" + val.toString());
+						data.stk.push(~0);
+						break;
 					}
 				}
 			};
 		}
 
-		template <typename T, typename... Args>
-		shared_ptr<T> mkunique(Args... args) {
-			return shared_ptr<T>(new T(args...));
-		}
+		/*
+			what a program does with the stack and the variables,
+			worked out once it's parsed by following every path
+			through it (jumps only go forward, so one pass does). it's
+			what lets evaluation go without any checks: the stack is
+			sized to `depth`, and a program that would pop more than
+			it pushed on some path (which tparm answers with 0s) gets
+			`zeros` 0s under its own values to pop instead. programs
+			whose jumps don't land inside them are rejected.
+		*/
+		struct Shape {
+			Shape()
+					: depth(0)
+					, zeros(0)
+					, params(0)
+					, staticsRead(0)
+					, staticsWritten(0)
+					, dynamics(0) {
+			}
 
-		struct Sequence {
-			Sequence() = default;
+			static Shape of(const vector<shared_ptr<Operation>> &ops) {
+				Shape shape;
+				const size_t n = ops.size();
 
-			Sequence(const Sequence &other)
-					: nargs(other.nargs)
-					, ops(other.ops) {
-			}
+				// the least and most on the stack on reaching each op, relative to the start
+				const int unreached = numeric_limits<int>::min();
+				vector<pair<int, int>> at(n + 1, make_pair(unreached, unreached));
+				at[0] = make_pair(0, 0);
+				int lowest = 0;
+				int highest = 0;
 
-			Sequence & operator =(const Sequence &other) {
-				this->nargs = other.nargs;
-				this->ops = other.ops;
-				return *this;
-			}
+				auto reach = [&](size_t target, int lo, int hi) {
+					if (target > n) {
+						throw prtty::PrttyError("conditional jumps past the end of the program");
+					}
+					pair<int, int> &range = at[target];
+					if (range.first == unreached) {
+						range = make_pair(lo, hi);
+					} else {
+						range.first = min(range.first, lo);
+						range.second = max(range.second, hi);
+					}
+				};
 
-			template <typename... Args>
-			void operator ()(Data &data, ostream &stream, Args... args) const {
-				data.session(args...);
+				for (size_t i = 0; i < n; i++) {
+					if (at[i].first == unreached) {
+						continue;
+					}
 
-				ios::fmtflags f(stream.flags());
-				stream << dec;
-				Operation::OpItr citr = this->ops.cbegin();
-				Operation::OpItr cend = this->ops.cend();
-				for (; citr != cend; citr++) {
-					(**citr)(stream, data, citr, cend);
+					const Operation *p = ops[i].get();
+					const type_info &type = typeid(*p);
+					int pops = 0;
+					int pushes = 0;
+					ptrdiff_t skip = 0;
+					bool jumps = false;
+					bool falls = true;
+
+#					define PRTTY_IS(T) (type == typeid(op::T))
+					if (PRTTY_IS(PushArg)) {
+						shape.params |= static_cast<uint16_t>(1u << static_cast<const op::PushArg *>(p)->arg);
+						pushes = 1;
+					} else if (PRTTY_IS(PushArgs)) {
+						unsigned int count = static_cast<const op::PushArgs *>(p)->count;
+						shape.params |= static_cast<uint16_t>((1u << count) - 1);
+						pushes = static_cast<int>(count);
+					} else if (PRTTY_IS(PushLiteralInt) || PRTTY_IS(PushLiteralChar)) {
+						pushes = 1;
+					} else if (PRTTY_IS(PushDynamic)) {
+						shape.dynamics |= 1u << static_cast<const op::PushDynamic *>(p)->arg;
+						pushes = 1;
+					} else if (PRTTY_IS(PushStatic)) {
+						shape.staticsRead |= 1u << static_cast<const op::PushStatic *>(p)->arg;
+						pushes = 1;
+					} else if (PRTTY_IS(PopSetDynamic)) {
+						shape.dynamics |= 1u << static_cast<const op::PopSetDynamic *>(p)->arg;
+						pops = 1;
+					} else if (PRTTY_IS(PopSetStatic)) {
+						shape.staticsWritten |= 1u << static_cast<const op::PopSetStatic *>(p)->arg;
+						pops = 1;
+					} else if (PRTTY_IS(IncrementFirstTwo)) {
+						shape.params |= 3;
+					} else if (PRTTY_IS(CondThen)) {
+						pops = 1;
+						skip = static_cast<const op::CondThen *>(p)->skip;
+						jumps = true;
+					} else if (PRTTY_IS(CondElse)) {
+						skip = static_cast<const op::CondElse *>(p)->skip;
+						jumps = true;
+						falls = false;
+					} else if (PRTTY_IS(PushStrlen) || PRTTY_IS(BoolNot) || PRTTY_IS(BitNegate)) {
+						pops = 1;
+						pushes = 1;
+					} else if (dynamic_cast<const op::PopWriteInt *>(p) || PRTTY_IS(PopWriteString) || PRTTY_IS(PopWriteChar)) {
+						pops = 1;
+					} else if (PRTTY_IS(ArithAdd) || PRTTY_IS(ArithSub) || PRTTY_IS(ArithMul) || PRTTY_IS(ArithDiv)
+							|| PRTTY_IS(ArithMod) || PRTTY_IS(BitOr) || PRTTY_IS(BitAnd) || PRTTY_IS(BitXor)
+							|| PRTTY_IS(BoolEq) || PRTTY_IS(BoolGt) || PRTTY_IS(BoolLt) || PRTTY_IS(BoolAnd)
+							|| PRTTY_IS(BoolOr)) {
+						pops = 2;
+						pushes = 1;
+					} else if (!PRTTY_IS(StringLiteral) && !PRTTY_IS(Cond) && !PRTTY_IS(CondEnd) && !PRTTY_IS(Pad)) {
+						throw prtty::PrttyError(string("cannot verify operation: ") + type.name());
+					}
+#					undef PRTTY_IS
+
+					int lo = at[i].first - pops;
+					int hi = at[i].second - pops;
+					lowest = min(lowest, lo);
+					lo += pushes;
+					hi += pushes;
+					highest = max(highest, hi);
+
+					if (falls) {
+						reach(i + 1, lo, hi);
+					}
+					if (jumps) {
+						if (skip < 0) {
+							throw prtty::PrttyError("conditional jumps backwards");
+						}
+						reach(i + 1 + static_cast<size_t>(skip), lo, hi);
+					}
 				}
-				stream.flags(f);
+
+				shape.zeros = static_cast<unsigned int>(-lowest);
+				shape.depth = static_cast<unsigned int>(highest - lowest);
+				return shape;
 			}
 
-			int nargs;
-			vector<shared_ptr<Operation>> ops;
+			unsigned int depth; // the most the stack ever holds, zeros included
+			unsigned int zeros;
+			uint16_t params; // arguments read (or, for %i, written), a bit each
+			uint32_t staticsRead; // a bit per variable
+			uint32_t staticsWritten;
+			uint32_t dynamics;
+		};
 
-			static Sequence parse(const string fmt) {
-				Sequence seq;
+		/*
+			a program's integer-only form. given numeric arguments,
+			nothing but numbers ever reaches the stack of almost every
+			capability: strings only get in through the arguments or
+			the static variables, and only %s and %l have any use for
+			them. so those programs are compiled once more into
+			opcodes that run on a plain int stack, without the Any
+			dispatch, and Sequence::run takes that path whenever the
+			arguments (and any static variables read) are numbers.
+		*/
+		struct IntProgram {
+			enum class Code : uint8_t {
+				NOP,
+				LITERAL,
+				ARG,
+				ARGS,
+				PUSH,
+				SET_DYNAMIC,
+				SET_STATIC,
+				GET_DYNAMIC,
+				GET_STATIC,
+				INCREMENT,
+				ADD,
+				SUB,
+				MUL,
+				DIV,
+				MOD,
+				OR,
+				AND,
+				XOR,
+				EQ,
+				GT,
+				LT,
+				LAND,
+				LOR,
+				NOT,
+				NEGATE,
+				WRITE_INT,
+				WRITE_CHAR,
+				THEN,
+				ELSE,
+				PAD
+			};
 
-				size_t len = fmt.length();
-				if (len == 0) {
-					return seq;
-				}
+			struct Instr {
+				Code code;
+				int arg;
+				const Operation *op; // for literals and formats
+			};
 
-				seq.nargs = 0;
+			// programs needing a deeper stack stay generic
+			static const unsigned int maxDepth = 64;
 
-				unique_ptr<char[]> literal(new char[len]);
-				size_t lc = 0;
+			IntProgram()
+					: depth(0)
+					, zeros(0)
+					, args(0)
+					, statics(0)
+					, dynamics(false)
+					, valid(false) {
+			}
+
+			/*
+				compiles `ops`, as verified into `shape`, one opcode per op
+				so conditional jumps carry over as they are. false (and
+				the program is left unusable) if they aren't integer-only.
+			*/
+			bool compile(const vector<shared_ptr<Operation>> &ops, const Shape &shape) {
+				this->code.clear();
+				this->valid = false;
+				bool chars = false;
+				bool stores = false;
+
+				for (auto &o : ops) {
+					const Operation *p = o.get();
+					const type_info &type = typeid(*p);
+					Instr in = {Code::NOP, 0, p};
+
+#					define PRTTY_IS(T) (type == typeid(op::T))
+					if (PRTTY_IS(StringLiteral)) {
+						in.code = Code::LITERAL;
+					} else if (PRTTY_IS(PushArg)) {
+						in = {Code::ARG, static_cast<int>(static_cast<const op::PushArg *>(p)->arg), p};
+					} else if (PRTTY_IS(PushArgs)) {
+						in = {Code::ARGS, static_cast<int>(static_cast<const op::PushArgs *>(p)->count), p};
+					} else if (PRTTY_IS(PushLiteralInt)) {
+						in = {Code::PUSH, static_cast<const op::PushLiteralInt *>(p)->literal, p};
+					} else if (PRTTY_IS(PushLiteralChar)) {
+						in = {Code::PUSH, static_cast<const op::PushLiteralChar *>(p)->literal, p};
+						chars = true;
+					} else if (PRTTY_IS(PopSetDynamic)) {
+						in = {Code::SET_DYNAMIC, static_cast<int>(static_cast<const op::PopSetDynamic *>(p)->arg), p};
+					} else if (PRTTY_IS(PopSetStatic)) {
+						in = {Code::SET_STATIC, static_cast<int>(static_cast<const op::PopSetStatic *>(p)->arg), p};
+						stores = true;
+					} else if (PRTTY_IS(PushDynamic)) {
+						in = {Code::GET_DYNAMIC, static_cast<int>(static_cast<const op::PushDynamic *>(p)->arg), p};
+					} else if (PRTTY_IS(PushStatic)) {
+						in = {Code::GET_STATIC, static_cast<int>(static_cast<const op::PushStatic *>(p)->arg), p};
+					} else if (PRTTY_IS(IncrementFirstTwo)) {
+						in = {Code::INCREMENT, static_cast<const op::IncrementFirstTwo *>(p)->stacked ? 1 : 0, p};
+					} else if (PRTTY_IS(PopWriteInt) || PRTTY_IS(PopWriteOct) || PRTTY_IS(PopWriteHex) || PRTTY_IS(PopWriteUHex)) {
+						in.code = Code::WRITE_INT;
+					} else if (PRTTY_IS(PopWriteChar)) {
+						in.code = Code::WRITE_CHAR;
+					} else if (PRTTY_IS(CondThen)) {
+						in = {Code::THEN, static_cast<int>(static_cast<const op::CondThen *>(p)->skip), p};
+					} else if (PRTTY_IS(CondElse)) {
+						in = {Code::ELSE, static_cast<int>(static_cast<const op::CondElse *>(p)->skip), p};
+					} else if (PRTTY_IS(Cond) || PRTTY_IS(CondEnd)) {
+						in.code = Code::NOP;
+					} else if (PRTTY_IS(Pad)) {
+						in.code = Code::PAD;
+					} else if (PRTTY_IS(BoolNot) || PRTTY_IS(BitNegate)) {
+						in.code = PRTTY_IS(BoolNot) ? Code::NOT : Code::NEGATE;
+					} else {
+						static const struct {
+							const type_info &type;
+							Code code;
+						} binary[] = {
+							{typeid(op::ArithAdd), Code::ADD},
+							{typeid(op::ArithSub), Code::SUB},
+							{typeid(op::ArithMul), Code::MUL},
+							{typeid(op::ArithDiv), Code::DIV},
+							{typeid(op::ArithMod), Code::MOD},
+							{typeid(op::BitOr), Code::OR},
+							{typeid(op::BitAnd), Code::AND},
+							{typeid(op::BitXor), Code::XOR},
+							{typeid(op::BoolEq), Code::EQ},
+							{typeid(op::BoolGt), Code::GT},
+							{typeid(op::BoolLt), Code::LT},
+							{typeid(op::BoolAnd), Code::LAND},
+							{typeid(op::BoolOr), Code::LOR}
+						};
+
+						bool found = false;
+						for (auto &b : binary) {
+							if (type == b.type) {
+								in.code = b.code;
+								found = true;
+								break;
+							}
+						}
+
+						// %s, %l and anything else that might meet a string
+						if (!found) {
+							this->code.clear();
+							return false;
+						}
+					}
+#					undef PRTTY_IS
+
+					this->code.push_back(in);
+				}
+
+				/*
+					statics are stored as plain ints here, so a char
+					couldn't be told from its code by a later %s
+				*/
+				if (shape.depth > maxDepth || (chars && stores)) {
+					this->code.clear();
+					return false;
+				}
+
+				this->depth = shape.depth;
+				this->zeros = shape.zeros;
+				this->args = 0;
+				for (int i = 0; i < 9; i++) {
+					if (shape.params & (1u << i)) {
+						this->args = i + 1;
+					}
+				}
+				this->statics = shape.staticsRead;
+				this->dynamics = shape.dynamics != 0;
+
+				this->valid = true;
+				return true;
+			}
+
+			explicit operator bool() const {
+				return this->valid;
+			}
+
+			// whether `data` holds nothing but ints where the program looks
+			bool accepts(const Data &data) const {
+				for (size_t i = 0; i < static_cast<size_t>(this->args); i++) {
+					if (data.params[i].type != Any::Type::INT) {
+						return false;
+					}
+				}
+				for (uint32_t m = this->statics, i = 0; m != 0; m >>= 1, i++) {
+					if ((m & 1) && data.sparm[i].type != Any::Type::INT) {
+						return false;
+					}
+				}
+				return true;
+			}
+
+			void run(Data &data, ostream &stream) const noexcept {
+				int stk[maxDepth];
+				unsigned int sp = this->zeros;
+				fill(stk, stk + sp, 0);
+				int dynamic[26];
+				if (this->dynamics) {
+					fill(dynamic, dynamic + 26, 0);
+				}
+
+				// verified not to underflow, as for Stack
+#				define PRTTY_POP() (stk[--sp])
+#				define PRTTY_BINARY(expr) { int r = PRTTY_POP(); int l = PRTTY_POP(); stk[sp++] = (expr); break; }
+
+				const Instr *code = this->code.data();
+				size_t n = this->code.size();
+				for (size_t pc = 0; pc < n; pc++) {
+					const Instr &in = code[pc];
+					switch (in.code) {
+					case Code::NOP:
+						break;
+					case Code::LITERAL: {
+						const string &literal = static_cast<const op::StringLiteral *>(in.op)->literal;
+						stream.write(literal.data(), static_cast<streamsize>(literal.length()));
+						data.wrote(literal.length());
+						break;
+					}
+					case Code::ARG:
+						stk[sp++] = data.params[static_cast<size_t>(in.arg)].tint;
+						break;
+					case Code::ARGS:
+						for (int i = in.arg; i-- > 0;) {
+							stk[sp++] = data.params[static_cast<size_t>(i)].tint;
+						}
+						break;
+					case Code::PUSH:
+						stk[sp++] = in.arg;
+						break;
+					case Code::SET_DYNAMIC:
+						dynamic[in.arg] = PRTTY_POP();
+						break;
+					case Code::SET_STATIC:
+						data.sparm[static_cast<size_t>(in.arg)] = Any(PRTTY_POP());
+						break;
+					case Code::GET_DYNAMIC:
+						stk[sp++] = dynamic[in.arg];
+						break;
+					case Code::GET_STATIC: {
+						stk[sp++] = data.sparm[static_cast<size_t>(in.arg)].tint;
+						break;
+					}
+					case Code::INCREMENT:
+						data.params[0].tint = op::wrap(data.params[0].tint + int64_t(1));
+						data.params[1].tint = op::wrap(data.params[1].tint + int64_t(1));
+						if (in.arg) {
+							for (unsigned int i = 0; i < 2 && this->zeros + i < sp; i++) {
+								stk[this->zeros + i] = data.params[i].tint;
+							}
+						}
+						break;
+					case Code::ADD: PRTTY_BINARY(op::wrap(int64_t(l) + r))
+					case Code::SUB: PRTTY_BINARY(op::wrap(int64_t(l) - r))
+					case Code::MUL: PRTTY_BINARY(op::wrap(int64_t(l) * r))
+					case Code::DIV: PRTTY_BINARY(r == 0 ? 0 : op::wrap(int64_t(l) / r))
+					case Code::MOD: PRTTY_BINARY(r == 0 ? 0 : op::wrap(int64_t(l) % r))
+					case Code::OR: PRTTY_BINARY(l | r)
+					case Code::AND: PRTTY_BINARY(l & r)
+					case Code::XOR: PRTTY_BINARY(l ^ r)
+					case Code::EQ: PRTTY_BINARY(l == r)
+					case Code::GT: PRTTY_BINARY(l > r)
+					case Code::LT: PRTTY_BINARY(l < r)
+					case Code::LAND: PRTTY_BINARY(l && r)
+					case Code::LOR: PRTTY_BINARY(l || r)
+					case Code::NOT: {
+						int v = PRTTY_POP();
+						stk[sp++] = v == 0;
+						break;
+					}
+					case Code::NEGATE: {
+						int v = PRTTY_POP();
+						stk[sp++] = ~v;
+						break;
+					}
+					case Code::WRITE_INT:
+						static_cast<const op::PopWriteInt *>(in.op)->write(stream, data, PRTTY_POP());
+						break;
+					case Code::WRITE_CHAR:
+						op::PopWriteChar::put(stream, PRTTY_POP());
+						data.wrote(1);
+						break;
+					case Code::THEN:
+						if (PRTTY_POP() == 0) {
+							pc += static_cast<size_t>(in.arg);
+						}
+						break;
+					case Code::ELSE:
+						pc += static_cast<size_t>(in.arg);
+						break;
+					case Code::PAD:
+						static_cast<const op::Pad *>(in.op)->delay(stream, data);
+						break;
+					}
+				}
+
+#				undef PRTTY_BINARY
+#				undef PRTTY_POP
+			}
+
+			vector<Instr> code;
+			unsigned int depth; // the most the stack can hold
+			unsigned int zeros; // 0s under the program's own values (see Stack)
+			int args; // how many arguments it reads
+			uint32_t statics; // static variables read, a bit each
+			bool dynamics;
+			bool valid;
+		};
+
+		template <typename T, typename... Args>
+		shared_ptr<T> mkunique(Args... args) {
+			return shared_ptr<T>(new T(args...));
+		}
+
+		struct Sequence {
+			Sequence()
+					: nargs(0) {
+			}
+
+			Sequence(const Sequence &other)
+					: nargs(other.nargs)
+					, ops(other.ops)
+					, shape(other.shape)
+					, ints(other.ints) {
+			}
+
+			Sequence & operator =(const Sequence &other) {
+				this->nargs = other.nargs;
+				this->ops = other.ops;
+				this->shape = other.shape;
+				this->ints = other.ints;
+				return *this;
+			}
+
+			template <typename... Args>
+			void operator ()(Data &data, ostream &stream, Args... args) const {
+				data.session(args...);
+
+				ios::fmtflags f(stream.flags());
+				stream << dec;
+				this->run(data, stream);
+				stream.flags(f);
+			}
+
+			/*
+				runs the program against an already set up `data`, into
+				a stream already in decimal mode. for callers evaluating
+				many sequences back to back (see prtty::evaluator).
+			*/
+			void run(Data &data, ostream &stream) const noexcept {
+				if (this->ints && this->ints.accepts(data)) {
+					this->ints.run(data, stream);
+				} else {
+					this->interpret(data, stream);
+				}
+			}
+
+			// run() without the integer-only path
+			void interpret(Data &data, ostream &stream) const noexcept {
+				data.stk.reset(this->shape.depth, this->shape.zeros);
+
+				Operation::OpItr citr = this->ops.cbegin();
+				Operation::OpItr cend = this->ops.cend();
+				for (; citr != cend; citr++) {
+					(**citr)(stream, data, citr, cend);
+				}
+			}
+
+			// whether run() can take the integer-only path (given numeric arguments)
+			bool integral() const {
+				return bool(this->ints);
+			}
+
+			// to be called once `ops` is complete; throws if it doesn't verify
+			void analyze() {
+				this->shape = Shape::of(this->ops);
+				this->ints.compile(this->ops, this->shape);
+			}
+
+			int nargs;
+			vector<shared_ptr<Operation>> ops;
+			Shape shape;
+			IntProgram ints;
+
+			/*
+				where the $<ms[.tenth][*][/]> delay starting at `i` ends
+				(its '>'), read as tputs does, or npos if it isn't one:
+				`*` (per line affected) counts as one line, and anything
+				else before the '>' leaves the lot as literal text.
+			*/
+			static size_t delay(const string &fmt, size_t i, int &ms, bool &mandatory) {
+				auto at = [&](size_t j) {
+					return j < fmt.length() ? fmt[j] : '\0';
+				};
+
+				if (at(i) != '$' || at(i + 1) != '<' || !((at(i + 2) >= '0' && at(i + 2) <= '9') || at(i + 2) == '.')) {
+					return static_cast<size_t>(-1);
+				}
+
+				i += 2;
+				int tenths = 0;
+				for (; at(i) >= '0' && at(i) <= '9'; i++) {
+					tenths = min(tenths * 10 + (at(i) - '0'), 1000000);
+				}
+				tenths *= 10;
+				if (at(i) == '.') {
+					if (at(++i) >= '0' && at(i) <= '9') {
+						tenths += at(i) - '0';
+					}
+					while (at(i) >= '0' && at(i) <= '9') {
+						++i;
+					}
+				}
+				mandatory = false;
+				for (; at(i) == '*' || at(i) == '/'; i++) {
+					mandatory = mandatory || at(i) == '/';
+				}
+
+				ms = tenths / 10;
+				return at(i) == '>' ? i : static_cast<size_t>(-1);
+			}
+
+			static Sequence parse(const string fmt) {
+#				ifdef PRTTY_TRACE
+				TraceSpan span("Sequence::parse", "parse");
+				span.note("length", fmt.length());
+#				endif
+				using op::CondThen;
+				using op::CondElse;
+				static const size_t npos = static_cast<size_t>(-1);
+
+				Sequence seq;
+
+				size_t len = fmt.length();
+				if (len == 0) {
+					return seq;
+				}
+
+				seq.nargs = 0;
+
+				// reads past the end as NUL, for malformed strings that stop mid-escape
+				auto at = [&](size_t j) {
+					return j < len ? fmt[j] : '\0';
+				};
+
+				unique_ptr<char[]> literal(new char[len]);
+				size_t lc = 0;
 				char c = 0;
 				int arg = 0;
+				size_t delayEnd = npos;
+				int ms = 0;
+				bool mandatory = false;
+
+				// for telling termcap-style strings (no %p) apart
+				bool pushes = false;
+				unsigned int pops = 0;
+
+				// open %? ... %; blocks whose jumps haven't been resolved yet
+				struct CondFrame {
+					CondFrame() : then(npos) {}
+					size_t then;
+					vector<size_t> elses;
+				};
+				vector<CondFrame> conds;
+
+				auto jump = [&](size_t &from, size_t to) {
+					if (from == npos) {
+						return;
+					}
+					ptrdiff_t skip = static_cast<ptrdiff_t>(to) - static_cast<ptrdiff_t>(from) - 1;
+					if (CondThen *then = dynamic_cast<CondThen *>(seq.ops[from].get())) {
+						then->skip = skip;
+					} else {
+						static_cast<CondElse *>(seq.ops[from].get())->skip = skip;
+					}
+					from = npos;
+				};
+
+				auto endCond = [&](size_t to) {
+					CondFrame &frame = conds.back();
+					jump(frame.then, to);
+					for (size_t &e : frame.elses) {
+						jump(e, to);
+					}
+					conds.pop_back();
+				};
 
 				for (size_t i = 0; i < len; i++) {
 					c = fmt[i];
 
 					if (c == '%') {
-						c = fmt[++i];
+						c = at(++i);
 
 						if (c == '%') {
 							goto addLiteral;
@@ -795,35 +1779,41 @@ namespace prtty {
 						case '.':
 							goto fieldParse;
 						case 'c':
+							++pops;
 							seq.ops.push_back(mkunique<op::PopWriteChar>());
 							break;
 						case 's':
 							seq.ops.push_back(mkunique<op::PopWriteString>());
 							break;
 						case 'd':
+							++pops;
 							seq.ops.push_back(mkunique<op::PopWriteInt>());
 							break;
 						case 'x':
+							++pops;
 							seq.ops.push_back(mkunique<op::PopWriteHex>());
 							break;
 						case 'X':
+							++pops;
 							seq.ops.push_back(mkunique<op::PopWriteUHex>());
 							break;
 						case 'o':
+							++pops;
 							seq.ops.push_back(mkunique<op::PopWriteOct>());
 							break;
 						case 'p':
-							c = fmt[++i];
+							c = at(++i);
 							if (c < '1' || c > '9') {
 								throw prtty::PrttyError("push argument escape (%p) must be followed by a number between 1-9 (inclusive): %p" + string(1, c));
 							}
 
 							arg = c - '0';
+							pushes = true;
 							seq.nargs = seq.nargs > arg ? seq.nargs : arg;
 							seq.ops.push_back(mkunique<op::PushArg>(static_cast<unsigned int>(arg - 1)));
 							break;
 						case 'P':
-							c = fmt[++i];
+							c = at(++i);
 							if (c >= 'a' && c<= 'z') {
 								seq.ops.push_back(mkunique<op::PopSetDynamic>(static_cast<unsigned int>(c - 'a')));
 							} else if (c >= 'A' && c <= 'Z') {
@@ -833,7 +1823,7 @@ namespace prtty {
 							}
 							break;
 						case 'g':
-							c = fmt[++i];
+							c = at(++i);
 							if (c >= 'a' && c<= 'z') {
 								seq.ops.push_back(mkunique<op::PushDynamic>(static_cast<unsigned int>(c - 'a')));
 							} else if (c >= 'A' && c <= 'Z') {
@@ -843,8 +1833,8 @@ namespace prtty {
 							}
 							break;
 						case '\'':
-							c = fmt[++i];
-							if (fmt[++i] != '\'') {
+							c = at(++i);
+							if (at(++i) != '\'') {
 								throw prtty::PrttyError("character literal was unterminated (expected '): %'" + string(1, c) + "'");
 							}
 
@@ -852,13 +1842,14 @@ namespace prtty {
 							break;
 						case '{': {
 							++i;
-							if (fmt[i] == '}') break;
+							if (at(i) == '}') break;
 
 							arg = 0;
 
 							int sign = 1;
-							if (fmt[i] == '-') {
+							if (at(i) == '-') {
 								sign = -1;
+								++i;
 							}
 
 							for (; i < len && fmt[i] != '}'; i++) {
@@ -866,11 +1857,11 @@ namespace prtty {
 								if (c < '0' || c > '9') {
 									throw prtty::PrttyError("found invalid number literal");
 								}
-								arg *= 10;
-								arg += fmt[i] - '0';
+								// overflowing wraps around, as it does in tparm (but defined)
+								arg = static_cast<int>(static_cast<unsigned int>(arg) * 10u + static_cast<unsigned int>(c - '0'));
 							}
 
-							seq.ops.push_back(mkunique<op::PushLiteralInt>(arg * sign));
+							seq.ops.push_back(mkunique<op::PushLiteralInt>(sign < 0 ? static_cast<int>(0u - static_cast<unsigned int>(arg)) : arg));
 							break;
 						}
 						case 'l':
@@ -881,13 +1872,27 @@ namespace prtty {
 							seq.ops.push_back(mkunique<op::IncrementFirstTwo>());
 							break;
 						case '?':
-						case 'e': // these are handled identically - though I admit the docs don't define these well.
+							conds.push_back(CondFrame());
 							seq.ops.push_back(mkunique<op::Cond>());
 							break;
 						case 't':
+							if (!conds.empty()) {
+								conds.back().then = seq.ops.size();
+							}
 							seq.ops.push_back(mkunique<op::CondThen>());
 							break;
+						case 'e':
+							if (!conds.empty()) {
+								// a false %t continues with whatever follows the %e (an else-if, usually)
+								jump(conds.back().then, seq.ops.size() + 1);
+								conds.back().elses.push_back(seq.ops.size());
+							}
+							seq.ops.push_back(mkunique<op::CondElse>());
+							break;
 						case ';':
+							if (!conds.empty()) {
+								endCond(seq.ops.size());
+							}
 							seq.ops.push_back(mkunique<op::CondEnd>());
 							break;
 						case '+':
@@ -935,6 +1940,11 @@ namespace prtty {
 						case '~':
 							seq.ops.push_back(mkunique<op::BitNegate>());
 							break;
+						case '[':
+							// the start of a reply pattern's character class
+							// (ncurses 6.3+); tparm drops the escape and
+							// emits the rest as text
+							break;
 						default:
 #							ifdef __clang__
 #								pragma clang diagnostic push
@@ -949,29 +1959,31 @@ namespace prtty {
 						goto afterFieldParse;
 					fieldParse:
 						{
-							bool exmode = false;
-							bool sign = false;
-							bool left = false;
-							int width = -1;
+							op::IntFormat f;
 							bool usePrecision = false;
-							int precision = -1;
 
 							// parses extended flag notation for field width/precision
 							for (; i < len; i++) {
 								c = fmt[i];
 
+								// a leading 0 pads with zeroes, as with printf
+								if (c == '0' && !usePrecision && f.width < 0) {
+									f.zero = true;
+									continue;
+								}
+
 								if (c >= '0' && c <= '9') {
-									int *target = usePrecision ? &precision : &width;
+									int *target = usePrecision ? &f.precision : &f.width;
 									*target = 0;
 
 									// this is some gross logic. might be nice to figure out
 									// a better way to do this.
 									for (; i < len && (c = fmt[i]) >= '0' && c <= '9'; i++) {
 										c = fmt[i];
-										*target *= 10;
-										*target += c - '0';
+										// absurd widths are held to something printable
+										*target = min(*target * 10 + (c - '0'), 9999);
 
-										if ((c = fmt[i + 1]) < '0' || c > '9') {
+										if ((c = at(i + 1)) < '0' || c > '9') {
 											break;
 										}
 									}
@@ -981,30 +1993,42 @@ namespace prtty {
 
 								switch (c) {
 								case ':': continue;
-								case '-': left = true; break;
-								case '+': sign = true; break;
-								case '#': exmode = true; break;
-								case '.': usePrecision = true; break;
+								case '-': f.left = true; break;
+								case '+': f.sign = true; break;
+								case ' ': f.space = true; break;
+								case '#': f.alternate = true; break;
+								case '.': usePrecision = true; f.precision = 0; break;
 								case 's':
-									seq.ops.push_back(mkunique<op::PopWriteString>(left, width, precision));
+									seq.ops.push_back(mkunique<op::PopWriteString>(f.left, f.width, f.precision));
 									goto afterFieldParse;
 								case 'd':
-									seq.ops.push_back(mkunique<op::PopWriteInt>(left, width, sign));
+									++pops;
+									seq.ops.push_back(mkunique<op::PopWriteInt>(f));
 									goto afterFieldParse;
 								case 'x':
-									seq.ops.push_back(mkunique<op::PopWriteHex>(left, width, sign, exmode));
+									++pops;
+									seq.ops.push_back(mkunique<op::PopWriteHex>(f));
 									goto afterFieldParse;
 								case 'X':
-									seq.ops.push_back(mkunique<op::PopWriteUHex>(left, width, sign, exmode));
+									++pops;
+									seq.ops.push_back(mkunique<op::PopWriteUHex>(f));
 									goto afterFieldParse;
 								case 'o':
-									seq.ops.push_back(mkunique<op::PopWriteOct>(left, width, sign, exmode));
+									++pops;
+									seq.ops.push_back(mkunique<op::PopWriteOct>(f));
 									goto afterFieldParse;
 								}
 							}
 						}
 
 					afterFieldParse: (void)0;
+					} else if (c == '$' && (delayEnd = delay(fmt, i, ms, mandatory)) != npos) {
+						if (lc > 0) {
+							seq.ops.push_back(mkunique<op::StringLiteral>(string(literal.get(), lc)));
+							lc = 0;
+						}
+						i = delayEnd;
+						seq.ops.push_back(mkunique<op::Pad>(ms, mandatory));
 					} else {
 					addLiteral:
 						literal[lc++] = c;
@@ -1015,6 +2039,25 @@ namespace prtty {
 					seq.ops.push_back(mkunique<op::StringLiteral>(string(literal.get(), lc)));
 				}
 
+				// unterminated conditionals run to the end
+				while (!conds.empty()) {
+					endCond(seq.ops.size());
+				}
+
+				// jumps are relative, so putting an op in front doesn't move them
+				if (!pushes && pops > 0) {
+					unsigned int count = min(pops, 9u);
+					for (auto &o : seq.ops) {
+						if (dynamic_cast<op::IncrementFirstTwo *>(o.get())) {
+							o = mkunique<op::IncrementFirstTwo>(true);
+						}
+					}
+					seq.ops.insert(seq.ops.begin(), mkunique<op::PushArgs>(count));
+					seq.nargs = max(seq.nargs, static_cast<int>(count));
+				}
+
+				seq.analyze();
+
 				return seq;
 			}
 		};
@@ -1027,12 +2070,76 @@ namespace prtty {
 			}
 		}
 
-		inline void toLE(uint16_t v) {
-			volatile uint32_t i = 0x01234567;
-			if ((*(reinterpret_cast<volatile uint8_t*>(&i))) == 0x01) {
-				v = static_cast<uint16_t>(((v >> 8) & 0xFF) | ((v & 0xFF) << 8));
+		/*
+			cursor over an in-memory compiled terminfo file.
+			all values are little-endian regardless of the host.
+		*/
+		struct Reader {
+			Reader(const string &buf)
+					: buf(buf)
+					, pos(0) {
 			}
-		}
+
+			void need(size_t n) const {
+				if (n > this->buf.length() - this->pos) {
+					throw prtty::PrttyError("terminal description file is truncated");
+				}
+			}
+
+			uint8_t u8() {
+				this->need(1);
+				return static_cast<uint8_t>(this->buf[this->pos++]);
+			}
+
+			int16_t s16() {
+				this->need(2);
+				const unsigned char *b = reinterpret_cast<const unsigned char *>(&this->buf[this->pos]);
+				this->pos += 2;
+				return static_cast<int16_t>(b[0] | (b[1] << 8));
+			}
+
+			int32_t s32() {
+				this->need(4);
+				const unsigned char *b = reinterpret_cast<const unsigned char *>(&this->buf[this->pos]);
+				this->pos += 4;
+				return static_cast<int32_t>(static_cast<uint32_t>(b[0]) | (static_cast<uint32_t>(b[1]) << 8)
+					| (static_cast<uint32_t>(b[2]) << 16) | (static_cast<uint32_t>(b[3]) << 24));
+			}
+
+			size_t count() {
+				int16_t v = this->s16();
+				return v < 0 ? 0 : static_cast<size_t>(v);
+			}
+
+			void skip(size_t n) {
+				this->need(n);
+				this->pos += n;
+			}
+
+			// sections following an odd number of bytes are padded
+			void align() {
+				if ((this->pos & 1) && this->pos < this->buf.length()) {
+					++this->pos;
+				}
+			}
+
+			size_t remaining() const {
+				return this->buf.length() - this->pos;
+			}
+
+			// NUL-terminated string at `offset` within a table of `size` bytes
+			static string tableString(const char *table, size_t size, int offset) {
+				if (offset < 0 || static_cast<size_t>(offset) >= size) {
+					return "";
+				}
+				const char *str = table + offset;
+				const void *nul = memchr(str, 0, size - static_cast<size_t>(offset));
+				return nul ? string(str) : string(str, size - static_cast<size_t>(offset));
+			}
+
+			const string &buf;
+			size_t pos;
+		};
 
 		inline void split(const string &s, char delim, vector<string> &elems) {
 			stringstream ss(s);
@@ -1042,220 +2149,1204 @@ namespace prtty {
 			}
 		}
 
-		class SequenceStreamer {
-			friend prtty::term prtty::get(string termname, string basePath);
+		/*
+			returns a pointer to the first control byte (< 0x20 or DEL)
+			in [p, end), or `end` if there is none. printable runs
+			(including UTF-8) are scanned 16 bytes at a time where SSE2
+			is available, or 8 bytes at a time otherwise.
+		*/
+		inline const char * findControl(const char *p, const char *end) {
+#			ifdef __SSE2__
+			const __m128i space = _mm_set1_epi8(0x1F);
+			const __m128i del = _mm_set1_epi8(0x7F);
+			while (end - p >= 16) {
+				__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+				__m128i ctl = _mm_cmpeq_epi8(_mm_max_epu8(v, space), space);
+				ctl = _mm_or_si128(ctl, _mm_cmpeq_epi8(v, del));
+				int mask = _mm_movemask_epi8(ctl);
+				if (mask) {
+					return p + __builtin_ctz(static_cast<unsigned int>(mask));
+				}
+				p += 16;
+			}
+#			else
+			const uint64_t ones = 0x0101010101010101ULL;
+			const uint64_t highs = 0x8080808080808080ULL;
+			while (end - p >= 8) {
+				uint64_t v;
+				memcpy(&v, p, 8);
+				uint64_t d = v ^ (ones * 0x7F);
+				if ((((v - ones * 0x20) & ~v) | ((d - ones) & ~d)) & highs) {
+					break;
+				}
+				p += 8;
+			}
+#			endif
 
-			class SeqStreamDeferredCall {
-				friend SequenceStreamer;
-			public:
-				SeqStreamDeferredCall(const SeqStreamDeferredCall &other) = default;
+			for (; p != end; p++) {
+				unsigned char c = static_cast<unsigned char>(*p);
+				if (c < 0x20 || c == 0x7F) {
+					break;
+				}
+			}
 
-				operator std::string() const noexcept(true) {
-					std::stringstream ss;
-					ss << *this;
-					return ss.str();
+			return p;
+		}
+
+		/*
+			a streambuf that appends to a string it doesn't own, so
+			capabilities can be evaluated straight into an output
+			buffer without going through a stringstream.
+		*/
+		class StringBuf : public streambuf {
+		public:
+			explicit StringBuf(string &target)
+					: target(&target) {
+			}
+
+			void retarget(string &target) {
+				this->target = &target;
+			}
+
+		protected:
+			virtual int_type overflow(int_type c) {
+				if (c != traits_type::eof()) {
+					this->target->push_back(static_cast<char>(c));
 				}
+				return c;
+			}
 
-			private:
-				SeqStreamDeferredCall(function<ostream&(ostream&)> callback)
-						: callback(callback) {
+			virtual streamsize xsputn(const char *s, streamsize n) {
+				this->target->append(s, static_cast<size_t>(n));
+				return n;
+			}
+
+		private:
+			string *target;
+		};
+
+#		ifdef PRTTY_METRICS
+		/*
+			per-capability counters, only compiled in with PRTTY_METRICS
+			defined. every evaluation is counted along with the bytes its
+			ops wrote (Data::wrote); one in `sampleEvery` is timed, into a histogram
+			of half-octave buckets from which the p99 is read.
+
+			a capability's counters are shared by every copy of its term
+			(see Entry), which are often on different threads, so they're
+			relaxed fetch_adds: exact, with no ordering to pay for.
+		*/
+		class Metrics {
+		public:
+			static const uint64_t sampleEvery = 64;
+			static const int buckets = 48;
+
+			Metrics() {
+				this->reset();
+			}
+
+			Metrics(const Metrics &other) {
+				this->evaluations.store(other.evaluations.load(memory_order_relaxed), memory_order_relaxed);
+				this->bytes.store(other.bytes.load(memory_order_relaxed), memory_order_relaxed);
+				this->sampled.store(other.sampled.load(memory_order_relaxed), memory_order_relaxed);
+				this->nanos.store(other.nanos.load(memory_order_relaxed), memory_order_relaxed);
+				for (int i = 0; i < buckets; i++) {
+					this->histogram[i].store(other.histogram[i].load(memory_order_relaxed), memory_order_relaxed);
 				}
+			}
 
-				friend ostream & operator <<(ostream &stream, const SeqStreamDeferredCall &defcall) {
-					return defcall.callback(stream);
+			void reset() {
+				this->evaluations.store(0, memory_order_relaxed);
+				this->bytes.store(0, memory_order_relaxed);
+				this->sampled.store(0, memory_order_relaxed);
+				this->nanos.store(0, memory_order_relaxed);
+				for (int i = 0; i < buckets; i++) {
+					this->histogram[i].store(0, memory_order_relaxed);
 				}
+			}
 
-				function<ostream&(ostream&)> callback;
-			};
+			// calls `run()`, which evaluates with `data`
+			template <typename Run>
+			void measure(Data &data, Run run) {
+				uint64_t n = this->evaluations.fetch_add(1, memory_order_relaxed);
+				uint64_t before = data.written;
+
+				if (n % sampleEvery != 0) {
+					run();
+				} else {
+					auto start = chrono::steady_clock::now();
+					run();
+					uint64_t ns = static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
+					this->sampled.fetch_add(1, memory_order_relaxed);
+					this->nanos.fetch_add(ns, memory_order_relaxed);
+					this->histogram[bucket(ns)].fetch_add(1, memory_order_relaxed);
+				}
 
-		public:
-			SequenceStreamer(Data &data)
-					: isSet(false)
-					, data(data) {
+				this->bytes.fetch_add(data.written - before, memory_order_relaxed);
 			}
 
-			explicit operator bool() const noexcept(true) {
-				return this->isSet;
+			uint64_t count() const {
+				return this->evaluations.load(memory_order_relaxed);
 			}
 
-			operator std::string() const noexcept(true) {
-				std::stringstream ss;
-				ss << *this;
-				return ss.str();
+			uint64_t totalBytes() const {
+				return this->bytes.load(memory_order_relaxed);
 			}
 
-			bool operator !() const noexcept(true) {
-				return !this->isSet;
+			// estimated from the sampled evaluations
+			double totalSeconds() const {
+				uint64_t s = this->sampled.load(memory_order_relaxed);
+				if (s == 0) {
+					return 0;
+				}
+				double mean = static_cast<double>(this->nanos.load(memory_order_relaxed)) / static_cast<double>(s);
+				return mean * static_cast<double>(this->count()) / 1e9;
 			}
 
-			template <typename... Args>
-			SeqStreamDeferredCall operator()(Args... args) const {
-				return function<ostream&(ostream&)>([&, args...](ostream &stream) -> ostream & {
-					this->seq(this->data, stream, args...);
-					return stream;
-				});
+			// upper bound of the bucket holding the 99th percentile
+			double p99Seconds() const {
+				uint64_t s = this->sampled.load(memory_order_relaxed);
+				if (s == 0) {
+					return 0;
+				}
+
+				uint64_t target = s - s / 100;
+				uint64_t seen = 0;
+				for (int i = 0; i < buckets; i++) {
+					seen += this->histogram[i].load(memory_order_relaxed);
+					if (seen >= target) {
+						return static_cast<double>(upperBound(i)) / 1e9;
+					}
+				}
+				return static_cast<double>(upperBound(buckets - 1)) / 1e9;
 			}
 
 		private:
-			friend ostream & operator <<(ostream &stream, const SequenceStreamer &seqstream) {
-				seqstream.seq(seqstream.data, stream);
-				return stream;
+			static int bucket(uint64_t ns) {
+				if (ns < 2) {
+					return static_cast<int>(ns);
+				}
+				int e = 63 - __builtin_clzll(ns);
+				int i = 2 * e + static_cast<int>((ns >> (e - 1)) & 1);
+				return i < buckets ? i : buckets - 1;
+			}
+
+			static uint64_t upperBound(int i) {
+				if (i < 2) {
+					return static_cast<uint64_t>(i) + 1;
+				}
+				int e = i / 2;
+				return (static_cast<uint64_t>(2 + i % 2) << (e - 1)) + (uint64_t(1) << (e - 1));
+			}
+
+			atomic<uint64_t> evaluations;
+			atomic<uint64_t> bytes;
+			atomic<uint64_t> sampled;
+			atomic<uint64_t> nanos;
+			atomic<uint32_t> histogram[buckets];
+		};
+#		endif
+
+		/*
+			a string capability as parsed out of an entry. it's shared,
+			read-only, by every copy of the term it came from (see
+			Entry); SequenceStreamer pairs it with a term's own state.
+		*/
+		struct Capability {
+			Capability()
+					: isSet(false) {
 			}
 
-			void operator =(const string &seqstr) {
+			void compile(const string &seqstr) {
 				if (seqstr.empty()) {
 					return;
 				}
 
-				this->seq = Sequence::parse(seqstr);
+				this->src = seqstr;
+				try {
+					this->seq = Sequence::parse(seqstr);
+				} catch (const PrttyError &) {
+					// a format we don't understand (e.g. the %[...] reply
+					// patterns in newer entries) shouldn't make the whole
+					// entry unusable, nor go out to the terminal as is;
+					// the capability's left unset, with only its source.
+					this->seq = Sequence();
+					return;
+				}
 				this->isSet = true;
 			}
 
 			bool isSet;
-			Data &data;
 			Sequence seq;
+			string src;
+
+#			ifdef PRTTY_METRICS
+			// shared by the term's copies, as the capability is
+			mutable Metrics stats;
+#			endif
 		};
+
+		class SequenceStreamer {
+			class SeqStreamDeferredCall {
+				friend SequenceStreamer;
+			public:
+				SeqStreamDeferredCall(const SeqStreamDeferredCall &other) = default;
+
+				operator std::string() const noexcept(true) {
+					std::stringstream ss;
+					ss << *this;
+					return ss.str();
+				}
+
+			private:
+				SeqStreamDeferredCall(function<ostream&(ostream&)> callback)
+						: callback(callback) {
+				}
+
+				friend ostream & operator <<(ostream &stream, const SeqStreamDeferredCall &defcall) {
+					return defcall.callback(stream);
+				}
+
+				function<ostream&(ostream&)> callback;
+			};
+
+		public:
+			// evaluates `cap` with `data` unless told otherwise
+			SequenceStreamer(const Capability &cap, Data &data)
+					: cap(&cap)
+					, data(&data) {
+			}
+
+			SequenceStreamer(const SequenceStreamer &) = default;
+
+			// it's bound to its term's state, which assigning another would undo
+			SequenceStreamer & operator =(const SequenceStreamer &) = delete;
+
+			explicit operator bool() const noexcept(true) {
+				return this->cap->isSet;
+			}
+
+			operator std::string() const noexcept(true) {
+				std::stringstream ss;
+				ss << *this;
+				return ss.str();
+			}
+
+			bool operator !() const noexcept(true) {
+				return !this->cap->isSet;
+			}
+
+			// the compiled program, for the analyses done by the other prtty headers
+			const Sequence & sequence() const noexcept(true) {
+				return this->cap->seq;
+			}
+
+			// the capability as it appears in the terminfo entry
+			const string & source() const noexcept(true) {
+				return this->cap->src;
+			}
+
+			// evaluates straight into `stream`, without a deferred call object
+			template <typename... Args>
+			void eval(ostream &stream, Args... args) const {
+				this->evaluate(*this->data, stream, args...);
+			}
+
+			/*
+				evaluates with someone else's state instead of the term's,
+				e.g. one per thread (see prtty::region_output).
+			*/
+			template <typename... Args>
+			void evaluate(Data &with, ostream &stream, Args... args) const {
+#				ifdef PRTTY_METRICS
+				this->cap->stats.measure(with, [&]() { this->cap->seq(with, stream, args...); });
+#				else
+				this->cap->seq(with, stream, args...);
+#				endif
+			}
+
+			// runs against state already set up with Data::bind (see prtty::evaluator)
+			void run(Data &with, ostream &stream) const {
+#				ifdef PRTTY_METRICS
+				this->cap->stats.measure(with, [&]() { this->cap->seq.run(with, stream); });
+#				else
+				this->cap->seq.run(with, stream);
+#				endif
+			}
+
+#			ifdef PRTTY_METRICS
+			Metrics & metrics() const noexcept(true) {
+				return this->cap->stats;
+			}
+#			endif
+
+			template <typename... Args>
+			SeqStreamDeferredCall operator()(Args... args) const {
+				return function<ostream&(ostream&)>([&, args...](ostream &stream) -> ostream & {
+					this->evaluate(*this->data, stream, args...);
+					return stream;
+				});
+			}
+
+		private:
+			friend struct prtty::term;
+
+			friend ostream & operator <<(ostream &stream, const SequenceStreamer &seqstream) {
+				seqstream.evaluate(*seqstream.data, stream);
+				return stream;
+			}
+
+			const Capability *cap;
+			Data *data;
+		};
+
+		/*
+			one of an Entry's fields as a term sees it: read-only, and
+			used like the field itself, but held by pointer so that a
+			term can be assigned another entry.
+		*/
+		template <typename T>
+		class EntryField {
+		public:
+			typedef typename T::const_iterator const_iterator;
+
+			explicit EntryField(const T &value)
+					: value(&value) {
+			}
+
+			operator const T &() const noexcept(true) {
+				return *this->value;
+			}
+
+			const T & get() const noexcept(true) {
+				return *this->value;
+			}
+
+			const_iterator begin() const {
+				return this->value->begin();
+			}
+
+			const_iterator end() const {
+				return this->value->end();
+			}
+
+			size_t size() const {
+				return this->value->size();
+			}
+
+			bool empty() const {
+				return this->value->empty();
+			}
+
+			// whichever of these T has
+			template <typename U = T>
+			auto front() const -> decltype(declval<const U &>().front()) {
+				return this->value->front();
+			}
+
+			template <typename U = T>
+			auto back() const -> decltype(declval<const U &>().back()) {
+				return this->value->back();
+			}
+
+			template <typename U = T>
+			auto c_str() const -> decltype(declval<const U &>().c_str()) {
+				return this->value->c_str();
+			}
+
+			template <typename K, typename U = T>
+			auto operator [](const K &key) const -> decltype(declval<const U &>()[key]) {
+				return (*this->value)[key];
+			}
+
+			template <typename K, typename U = T>
+			auto at(const K &key) const -> decltype(declval<const U &>().at(key)) {
+				return this->value->at(key);
+			}
+
+			template <typename K, typename U = T>
+			auto find(const K &key) const -> decltype(declval<const U &>().find(key)) {
+				return this->value->find(key);
+			}
+
+			template <typename K, typename U = T>
+			auto count(const K &key) const -> decltype(declval<const U &>().count(key)) {
+				return this->value->count(key);
+			}
+
+			friend bool operator ==(const EntryField &a, const EntryField &b) {
+				return *a.value == *b.value;
+			}
+
+			friend bool operator ==(const EntryField &a, const T &b) {
+				return *a.value == b;
+			}
+
+			friend bool operator ==(const T &a, const EntryField &b) {
+				return a == *b.value;
+			}
+
+			friend bool operator !=(const EntryField &a, const EntryField &b) {
+				return !(a == b);
+			}
+
+			friend bool operator !=(const EntryField &a, const T &b) {
+				return !(a == b);
+			}
+
+			friend bool operator !=(const T &a, const EntryField &b) {
+				return !(a == b);
+			}
+
+			friend ostream & operator <<(ostream &stream, const EntryField &field) {
+				return stream << *field.value;
+			}
+
+		private:
+			const T *value;
+		};
+
+		/*
+			a term's extended string capabilities, looked at like a
+			map<string, SequenceStreamer>. its items are made on the
+			fly, so the streamers it gives out are only good while
+			the term is, and not to be held on to by address.
+		*/
+		class ExtendedStrings {
+		public:
+			struct value_type {
+				const string &first;
+				const SequenceStreamer second;
+			};
+
+			class const_iterator {
+				friend ExtendedStrings;
+
+			public:
+				typedef map<string, Capability>::const_iterator Base;
+
+				struct Arrow {
+					const value_type *operator ->() const {
+						return &this->value;
+					}
+
+					const value_type value;
+				};
+
+				const value_type operator *() const {
+					return value_type{this->itr->first, SequenceStreamer(this->itr->second, *this->data)};
+				}
+
+				Arrow operator ->() const {
+					return Arrow{**this};
+				}
+
+				const_iterator & operator ++() {
+					++this->itr;
+					return *this;
+				}
+
+				bool operator ==(const const_iterator &other) const {
+					return this->itr == other.itr;
+				}
+
+				bool operator !=(const const_iterator &other) const {
+					return this->itr != other.itr;
+				}
+
+			private:
+				const_iterator(Base itr, Data *data)
+						: itr(itr)
+						, data(data) {
+				}
+
+				Base itr;
+				Data *data;
+			};
+
+			ExtendedStrings(const map<string, Capability> &caps, Data &data)
+					: caps(&caps)
+					, data(&data) {
+			}
+
+			const_iterator begin() const {
+				return const_iterator(this->caps->begin(), this->data);
+			}
+
+			const_iterator end() const {
+				return const_iterator(this->caps->end(), this->data);
+			}
+
+			const_iterator find(const string &name) const {
+				return const_iterator(this->caps->find(name), this->data);
+			}
+
+			size_t count(const string &name) const {
+				return this->caps->count(name);
+			}
+
+			size_t size() const {
+				return this->caps->size();
+			}
+
+			bool empty() const {
+				return this->caps->empty();
+			}
+
+			// throws out_of_range, as map::at does
+			SequenceStreamer at(const string &name) const {
+				return SequenceStreamer(this->caps->at(name), *this->data);
+			}
+
+		private:
+			friend struct prtty::term;
+
+			const map<string, Capability> *caps;
+			Data *data;
+		};
+
+		/*
+			a loaded entry: everything about a terminal that's fixed
+			once it's parsed. terms share one, read-only, so copying
+			a term never copies (or re-parses) its capabilities.
+		*/
+		struct Entry {
+			string id;
+			vector<string> names;
+
+#			define PRTTY_DO_STRING(name) Capability name;
+#			include "./prtty-strings.inc"
+
+			map<string, bool> extendedBooleans;
+			map<string, int> extendedIntegers;
+			map<string, Capability> extendedStrings;
+		};
+	}
+
+	namespace impl {
+		/*
+			remembers where entries were (and weren't) found in each
+			directory searched, so that asking for an unknown TERM
+			again doesn't mean another round of failing lookups.
+
+			a directory's answers are dropped once its mtime, or that
+			of a subdirectory it was searched in, changes (which is
+			what installing or removing an entry does). that's checked
+			at most every `interval`, so a new entry can take that
+			long to be seen.
+		*/
+		class LookupCache {
+		public:
+			// the entry's file under `dir`, or "" if there isn't one
+			string locate(const string &dir, const string &name) {
+				lock_guard<mutex> guard(this->lock);
+
+				Dir &d = this->dirs[dir];
+				auto now = chrono::steady_clock::now();
+				if (d.stamps.empty() || now - d.checked >= this->interval) {
+					this->validate(d);
+					d.checked = now;
+				}
+
+				auto hit = d.names.find(name);
+				if (hit != d.names.end()) {
+					++this->hitCount;
+					return hit->second;
+				}
+
+				// unknown TERMs can come from anywhere; don't let them pile up
+				if (d.names.size() >= maxNames) {
+					d.names.clear();
+				}
+
+				++this->probeCount;
+				string path = this->probe(dir, name, d);
+				d.names.emplace(name, path);
+				return path;
+			}
+
+			// answered from the cache, and by looking at the filesystem
+			size_t hits() const {
+				lock_guard<mutex> guard(this->lock);
+				return this->hitCount;
+			}
+
+			size_t probes() const {
+				lock_guard<mutex> guard(this->lock);
+				return this->probeCount;
+			}
+
+			void clear() {
+				lock_guard<mutex> guard(this->lock);
+				this->dirs.clear();
+			}
+
+			chrono::steady_clock::duration interval = chrono::seconds(1);
+
+		private:
+			static const size_t maxNames = 4096;
+
+			// a directory's mtime, or {-1, -1} if it isn't one
+			typedef pair<long long, long long> Stamp;
+
+			struct Dir {
+				chrono::steady_clock::time_point checked;
+				map<string, Stamp> stamps;
+				unordered_map<string, string> names;
+			};
+
+			static Stamp stamp(const string &path) {
+				struct stat st;
+				if (::stat(path.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+					return Stamp(-1, -1);
+				}
+#				ifdef __APPLE__
+				return Stamp(st.st_mtimespec.tv_sec, st.st_mtimespec.tv_nsec);
+#				else
+				return Stamp(st.st_mtim.tv_sec, st.st_mtim.tv_nsec);
+#				endif
+			}
+
+			static bool isFile(const string &path) {
+				struct stat st;
+				return ::stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+			}
+
+			void validate(Dir &d) {
+				for (auto &s : d.stamps) {
+					if (stamp(s.first) != s.second) {
+						d.stamps.clear();
+						d.names.clear();
+						return;
+					}
+				}
+			}
+
+			// entries are filed under their first character, or (on some systems) its hex code
+			string probe(const string &dir, const string &name, Dir &d) {
+				if (!d.stamps.count(dir)) {
+					d.stamps[dir] = stamp(dir);
+				}
+
+				char first = name[0];
+				string hashed{hashCharacter((first & 0xF0) >> 4), hashCharacter(first & 0x0F)};
+				for (string sub : {string(1, first), hashed}) {
+					string subdir = dir + "/" + sub;
+					if (!d.stamps.count(subdir)) {
+						d.stamps[subdir] = stamp(subdir);
+					}
+					if (d.stamps[subdir].first >= 0 && isFile(subdir + "/" + name)) {
+						return subdir + "/" + name;
+					}
+				}
+
+				return "";
+			}
+
+			mutable mutex lock;
+			map<string, Dir> dirs;
+			size_t hitCount = 0;
+			size_t probeCount = 0;
+		};
+
+		// shared by every lookup in the process
+		inline LookupCache & lookups() {
+			static LookupCache cache;
+			return cache;
+		}
+
+		// names that can't be looked up (and mustn't be turned into paths)
+		inline bool validName(const string &name) {
+			return !name.empty() && name != "." && name != ".." && name.find('/') == string::npos;
+		}
 	}
 
+	/*
+		a standard capability, as its type and its place among that
+		type's (terminfo's order, as in prtty-*.inc), for code that
+		picks capabilities at runtime. see prtty-capnames.hpp to get
+		one from a long or short name.
+	*/
+	struct capability {
+		enum class Type : uint8_t {
+			NONE,
+			BOOLEAN,
+			INTEGER,
+			STRING
+		};
+
+		capability()
+				: type(Type::NONE)
+				, index(0) {
+		}
+
+		capability(Type type, uint16_t index)
+				: type(type)
+				, index(index) {
+		}
+
+		explicit operator bool() const noexcept(true) {
+			return this->type != Type::NONE;
+		}
+
+		bool operator ==(const capability &other) const noexcept(true) {
+			return this->type == other.type && this->index == other.index;
+		}
+
+		bool operator !=(const capability &other) const noexcept(true) {
+			return !(*this == other);
+		}
+
+		Type type;
+		uint16_t index;
+	};
+
+	/*
+		a handle on a loaded entry. the parsed capabilities live in
+		an impl::Entry shared by every copy; each copy has only its
+		own evaluation state (static variables included, which a
+		copy starts out with the original's of), so copies can be
+		handed to other threads and outlive the original. copying
+		or assigning one is a reference count and a fixed number of
+		plain stores, and never allocates.
+	*/
 	struct term {
-		const string id;
-		const vector<string> names;
+	private:
+		friend term load(string termname, const string &compiled);
 
-#		define PRTTY_DO_BOOLEAN(name) const bool name;
+		// declared first so that the members below can bind to them.
+		shared_ptr<const impl::Entry> entry;
+		impl::Data data;
+
+	public:
+		/*
+			the capabilities are only changed by assigning the whole
+			term; the values are this copy's own, and the strings
+			can't be assigned on their own.
+		*/
+		impl::EntryField<string> id;
+		impl::EntryField<vector<string>> names;
+
+#		define PRTTY_DO_BOOLEAN(name) bool name;
 #		include "./prtty-booleans.inc"
 
-#		define PRTTY_DO_INTEGER(name) const int name;
+		// -1 where the entry doesn't have them (or cancels them), as ncurses reports
+#		define PRTTY_DO_INTEGER(name) int name;
 #		include "./prtty-integers.inc"
 
-#		define PRTTY_DO_STRING(name) const impl::SequenceStreamer name;
+#		define PRTTY_DO_STRING(name) impl::SequenceStreamer name;
 #		include "./prtty-strings.inc"
 
-		term(string id, vector<string> &names)
-				: id(id)
-				, names(names)
+		// extended (user-defined) capabilities by their short names, e.g. "XM" or "kUP5"
+		impl::EntryField<map<string, bool>> extended_booleans;
+		impl::EntryField<map<string, int>> extended_integers;
+		impl::ExtendedStrings extended_strings;
+
+		explicit term(shared_ptr<const impl::Entry> entry)
+				: entry(entry)
+				, id(entry->id)
+				, names(entry->names)
 #		define PRTTY_DO_BOOLEAN(name) , name(false)
 #		include "./prtty-booleans.inc"
-#		define PRTTY_DO_INTEGER(name) , name(0)
+#		define PRTTY_DO_INTEGER(name) , name(-1)
+#		include "./prtty-integers.inc"
+#		define PRTTY_DO_STRING(name) , name(entry->name, this->data)
+#		include "./prtty-strings.inc"
+				, extended_booleans(entry->extendedBooleans)
+				, extended_integers(entry->extendedIntegers)
+				, extended_strings(entry->extendedStrings, this->data) {
+		}
+
+		term(const term &other)
+				: entry(other.entry)
+				, data(other.data)
+				, id(other.id)
+				, names(other.names)
+#		define PRTTY_DO_BOOLEAN(name) , name(other.name)
+#		include "./prtty-booleans.inc"
+#		define PRTTY_DO_INTEGER(name) , name(other.name)
 #		include "./prtty-integers.inc"
-#		define PRTTY_DO_STRING(name) , name(this->data)
+#		define PRTTY_DO_STRING(name) , name(*other.name.cap, this->data)
 #		include "./prtty-strings.inc"
-		{}
+				, extended_booleans(other.extended_booleans)
+				, extended_integers(other.extended_integers)
+				, extended_strings(*other.extended_strings.caps, this->data) {
+		}
+
+		term & operator =(const term &other) {
+			this->entry = other.entry;
+			this->data = other.data;
+			this->assignFrom(other);
+			return *this;
+		}
+
+		// as cheap as a move would be, and leaves `other` usable
+		term & operator =(term &&other) {
+			return *this = static_cast<const term &>(other);
+		}
+
+		// whether `other` is a copy of the same loaded entry (see prtty::fanout)
+		bool same_entry(const term &other) const noexcept(true) {
+			return this->entry == other.entry;
+		}
+
+		// the member `cap` stands for; throws if it isn't one of that type
+		bool get_boolean(capability cap) const {
+			if (cap.type != capability::Type::BOOLEAN || cap.index >= PRTTY_NUM_BOOLEANS) {
+				throw PrttyError("not a boolean capability");
+			}
+			return (&this->PRTTY_FIRST_BOOLEAN)[cap.index];
+		}
+
+		int get_integer(capability cap) const {
+			if (cap.type != capability::Type::INTEGER || cap.index >= PRTTY_NUM_INTEGERS) {
+				throw PrttyError("not an integer capability");
+			}
+			return (&this->PRTTY_FIRST_INTEGER)[cap.index];
+		}
+
+		const impl::SequenceStreamer & get_string(capability cap) const {
+			if (cap.type != capability::Type::STRING || cap.index >= PRTTY_NUM_STRINGS) {
+				throw PrttyError("not a string capability");
+			}
+			return (&this->PRTTY_FIRST_STRING)[cap.index];
+		}
+
+		/*
+			honors $<..> delays in this term's capabilities (not in
+			copies made before, nor in evaluations with other state)
+			for a line running at `baud`, as tputs would: padding is
+			only sent at or above padding_baud_rate (at any speed if
+			it's absent) and without xon_xoff, unless the delay is
+			mandatory ($<../>) or in bell or flash_screen. 0 drops it
+			again, the default.
+		*/
+		void use_padding(int baud) {
+			impl::Data::Padding &p = this->data.padding;
+			p.baud = baud;
+			p.pad = this->pad_char ? this->pad_char.source()[0] : '\0';
+			p.wait = this->no_pad_char;
+			p.normal = !this->xon_xoff && this->padding_baud_rate != 0 && baud >= this->padding_baud_rate;
+		}
 
 	private:
-		impl::Data data;
+		// everything but the entry and state, which stay bound to this term
+		void assignFrom(const term &other) {
+			this->id = other.id;
+			this->names = other.names;
+#			define PRTTY_DO_BOOLEAN(name) this->name = other.name;
+#			include "./prtty-booleans.inc"
+#			define PRTTY_DO_INTEGER(name) this->name = other.name;
+#			include "./prtty-integers.inc"
+#			define PRTTY_DO_STRING(name) this->name.cap = other.name.cap;
+#			include "./prtty-strings.inc"
+			this->extended_booleans = other.extended_booleans;
+			this->extended_integers = other.extended_integers;
+			this->extended_strings.caps = other.extended_strings.caps;
+		}
 	};
 
 	term get(string termname, string basePath)
 #	ifdef PRTTY_MAIN
 	{
-		ifstream dbf;
-		string dbPath = basePath + "/" + string(1, termname[0]) + "/" + termname;
-		dbf.open(dbPath, ios::binary);
-		if (!dbf) {
-			char hash[2];
-			char firstchar = termname[0];
-			hash[0] = impl::hashCharacter((firstchar & 0xF0) >> 4);
-			hash[1] = impl::hashCharacter(firstchar & 0x0F);
-
-			dbPath = basePath + "/" + string(&hash[0], 2) + "/" + termname;
-			dbf.open(dbPath, ios::binary);
-
+#		ifdef PRTTY_TRACE
+		impl::TraceSpan span("get", "load");
+#		endif
+		string file;
+		{
+#			ifdef PRTTY_TRACE
+			impl::TraceSpan opening("open", "load");
+#			endif
+			string dbPath = impl::validName(termname) ? impl::lookups().locate(basePath, termname) : "";
+			ifstream dbf;
+			if (!dbPath.empty()) {
+				dbf.open(dbPath, ios::binary);
+			}
 			if (!dbf) {
 				throw PrttyError("could not load database for terminal: " + termname + " (from base search path: " + basePath + ")");
 			}
-		}
-
-		uint8_t _u8;
-		uint16_t _u16;
 
-#		define READ_U8() dbf.read(reinterpret_cast<char *>(&_u8), 1)
-#		define READ_U16() dbf.read(reinterpret_cast<char *>(&_u16), 2); impl::toLE(_u16)
+			file.assign(istreambuf_iterator<char>(dbf), istreambuf_iterator<char>());
+#			ifdef PRTTY_TRACE
+			opening.note("bytes", file.length());
+#			endif
+		}
+		return load(termname, file);
+	}
+#	else
+	;
+#	endif
 
-		// magic number
-		READ_U16();
-		if (_u16 != 0x11A) {
+	// parses a compiled entry that's already in memory (see prtty::database)
+	term load(string termname, const string &file)
+#	ifdef PRTTY_MAIN
+	{
+#		ifdef PRTTY_TRACE
+		impl::TraceSpan span("decode", "load");
+		span.note("bytes", file.length());
+#		endif
+		impl::Reader rd(file);
+
+		// magic number; the extended format (ncurses 6.1+) stores numbers as 32-bit
+		int16_t magic = rd.s16();
+		if (magic != 0432 && magic != 01036) {
 			throw PrttyError("terminal description file has invalid magic number");
 		}
+		bool wide = magic == 01036;
+		auto readNumber = [&]() -> int {
+			int v = wide ? rd.s32() : rd.s16();
+			return v < 0 ? -1 : v; // absent (-1) or cancelled (-2)
+		};
 
-		READ_U16();
-		size_t nameSize = _u16;
-		READ_U16();
-		size_t boolSize = _u16;
-		READ_U16();
-		size_t numCount = _u16;
-		READ_U16();
-		size_t offCount = _u16;
-		dbf.ignore(2); // string (offset) count
+		size_t nameSize = rd.count();
+		size_t boolSize = rd.count();
+		size_t numCount = rd.count();
+		size_t offCount = rd.count();
+		size_t tableSize = rd.count();
 
 		vector<string> names;
 
-		unique_ptr<char[]> fullNameStr(new char[nameSize]);
-		dbf.read(fullNameStr.get(), static_cast<streamsize>(nameSize));
-		impl::split(string(fullNameStr.get(), nameSize - 1), '|', names);
+		rd.need(nameSize);
+		impl::split(string(&file[rd.pos], nameSize > 0 ? nameSize - 1 : 0), '|', names);
+		rd.skip(nameSize);
 
-		term result(termname, names);
+		shared_ptr<impl::Entry> entry = make_shared<impl::Entry>();
+		entry->id = termname;
+		entry->names = names;
+		term result(entry);
 
-		bool *bools = const_cast<bool *>(&(result.PRTTY_FIRST_BOOLEAN));
+		bool *bools = &(result.PRTTY_FIRST_BOOLEAN);
 #		undef PRTTY_FIRST_BOOLEAN
 		for (size_t i = 0; i < boolSize; i++) {
-			READ_U8();
-			bools[i] = static_cast<bool>(_u8);
-		}
-
-		// advance
-		if (boolSize > PRTTY_NUM_BOOLEANS) {
-			dbf.ignore(static_cast<streamsize>(boolSize - PRTTY_NUM_BOOLEANS));
+			uint8_t v = rd.u8();
+			if (i < PRTTY_NUM_BOOLEANS) {
+				bools[i] = v == 1;
+			}
 		}
 #		undef PRTTY_NUM_BOOLEANS
+		rd.align();
 
-		int *ints = const_cast<int *>(&(result.PRTTY_FIRST_INTEGER));
+		int *ints = &(result.PRTTY_FIRST_INTEGER);
 #		undef PRTTY_FIRST_INTEGER
 		for (size_t i = 0; i < numCount; i++) {
-			READ_U16();
-			ints[i] = static_cast<int>(_u16);
-		}
-
-		// advance
-		if (numCount > PRTTY_NUM_INTEGERS) {
-			dbf.ignore(static_cast<streamsize>((numCount - PRTTY_NUM_INTEGERS) * 2));
+			int v = readNumber();
+			if (i < PRTTY_NUM_INTEGERS) {
+				ints[i] = v;
+			}
 		}
 #		undef PRTTY_NUM_INTEGERS
 
-		char buf[4096];
-		size_t offset = offCount * 2;
-		auto loadString = [&]() -> string {
-			READ_U16();
-			offset -= 2;
-			if (_u16 == static_cast<uint16_t>(-1)) {
-				return "";
+		rd.need(offCount * 2 + tableSize);
+		const char *table = &file[rd.pos + offCount * 2];
+
+		impl::Capability *strings = &(entry->PRTTY_FIRST_STRING);
+		{
+#			ifdef PRTTY_TRACE
+			impl::TraceSpan parsing("parse", "load");
+			parsing.note("strings", offCount);
+#			endif
+			for (size_t i = 0; i < offCount; i++) {
+				int16_t offset = rd.s16();
+				if (i < PRTTY_NUM_STRINGS) {
+					strings[i].compile(impl::Reader::tableString(table, tableSize, offset));
+				}
 			}
-			auto curpos = dbf.tellg();
-			dbf.ignore(static_cast<streamsize>(offset + _u16));
-			dbf.getline(&buf[0], 4096, '\0');
-			dbf.seekg(curpos);
-			return string(&buf[0]);
-		};
-
-		impl::SequenceStreamer *strings = const_cast<impl::SequenceStreamer *>(&(result.PRTTY_FIRST_STRING));
-		for (size_t i = 0; i < PRTTY_NUM_STRINGS; i++) {
-			strings[i] = loadString();
 		}
+		rd.skip(tableSize);
 #		undef PRTTY_FIRST_STRING
 #		undef PRTTY_NUM_STRINGS
 
-#		undef READ_U8
-#		undef READ_U16
+		for (impl::Capability *cap : {&entry->bell, &entry->flash_screen}) {
+			for (auto &o : cap->seq.ops) {
+				if (impl::op::Pad *pad = dynamic_cast<impl::op::Pad *>(o.get())) {
+					pad->always = true;
+				}
+			}
+		}
+
+		// extended capabilities
+		rd.align();
+		if (rd.remaining() >= 10) {
+			size_t extBools = rd.count();
+			size_t extNums = rd.count();
+			size_t extStrs = rd.count();
+			rd.count(); // number of items in the string table
+			size_t extTableSize = rd.count();
+
+			vector<bool> extBoolValues;
+			for (size_t i = 0; i < extBools; i++) {
+				extBoolValues.push_back(rd.u8() == 1);
+			}
+			rd.align();
+
+			vector<int> extNumValues;
+			for (size_t i = 0; i < extNums; i++) {
+				extNumValues.push_back(readNumber());
+			}
+
+			vector<int> extStrOffsets;
+			for (size_t i = 0; i < extStrs; i++) {
+				extStrOffsets.push_back(rd.s16());
+			}
+
+			vector<int> extNameOffsets;
+			for (size_t i = 0; i < extBools + extNums + extStrs; i++) {
+				extNameOffsets.push_back(rd.s16());
+			}
+
+			rd.need(extTableSize);
+			const char *extTable = &file[rd.pos];
+
+			// names follow the last string value in the table
+			size_t base = 0;
+			for (int offset : extStrOffsets) {
+				if (offset >= 0) {
+					size_t end = static_cast<size_t>(offset) + impl::Reader::tableString(extTable, extTableSize, offset).length() + 1;
+					base = end > base ? end : base;
+				}
+			}
+
+			auto extName = [&](size_t i) -> string {
+				if (base >= extTableSize) {
+					return "";
+				}
+				return impl::Reader::tableString(extTable + base, extTableSize - base, extNameOffsets[i]);
+			};
+
+			auto &extBooleans = entry->extendedBooleans;
+			auto &extIntegers = entry->extendedIntegers;
+			auto &extStrings = entry->extendedStrings;
+
+			for (size_t i = 0; i < extBools; i++) {
+				extBooleans[extName(i)] = extBoolValues[i];
+			}
+			for (size_t i = 0; i < extNums; i++) {
+				extIntegers[extName(extBools + i)] = extNumValues[i];
+			}
+#			ifdef PRTTY_TRACE
+			impl::TraceSpan parsing("parse", "load");
+			parsing.note("strings", extStrs);
+#			endif
+			for (size_t i = 0; i < extStrs; i++) {
+				if (extStrOffsets[i] < 0) {
+					continue;
+				}
+
+				extStrings[extName(extBools + extNums + i)].compile(impl::Reader::tableString(extTable, extTableSize, extStrOffsets[i]));
+			}
+		}
+
 		return result;
 	}
 #	else
 	;
 #	endif
 
+	/*
+		the directories entries are looked for in, in order, as
+		ncurses does: $TERMINFO, ~/.terminfo, each of $TERMINFO_DIRS
+		(where an empty one means the system's) and then the
+		system's own.
+	*/
+	vector<string> search_path()
+#	ifdef PRTTY_MAIN
+	{
+		static const char *const system[] = {"/etc/terminfo", "/lib/terminfo", "/usr/share/terminfo"};
+
+		vector<string> dirs;
+		auto add = [&](const string &dir) {
+			if (!dir.empty() && find(dirs.begin(), dirs.end(), dir) == dirs.end()) {
+				dirs.push_back(dir);
+			}
+		};
+		auto addSystem = [&]() {
+			for (auto dir : system) {
+				add(dir);
+			}
+		};
+
+		if (const char *terminfo = getenv("TERMINFO")) {
+			add(terminfo);
+		}
+		if (const char *home = getenv("HOME")) {
+			if (*home) {
+				add(string(home) + "/.terminfo");
+			}
+		}
+		if (const char *dirsVar = getenv("TERMINFO_DIRS")) {
+			string list = dirsVar;
+			size_t start = 0;
+			for (;;) {
+				size_t end = list.find(':', start);
+				string dir = list.substr(start, end == string::npos ? string::npos : end - start);
+				if (dir.empty()) {
+					addSystem();
+				} else {
+					add(dir);
+				}
+				if (end == string::npos) {
+					break;
+				}
+				start = end + 1;
+			}
+		}
+		addSystem();
+
+		return dirs;
+	}
+#	else
+	;
+#	endif
+
+	// the file `get(termname)` would load, or "" if there's none
+	string locate(const string &termname)
+#	ifdef PRTTY_MAIN
+	{
+		if (!impl::validName(termname)) {
+			return "";
+		}
+		for (auto &dir : search_path()) {
+			string path = impl::lookups().locate(dir, termname);
+			if (!path.empty()) {
+				return path;
+			}
+		}
+		return "";
+	}
+#	else
+	;
+#	endif
+
 	term get(string termname)
 #	ifdef PRTTY_MAIN
 	{
-		char *termdb = getenv("TERMINFO");
-		return get(termname, termdb ? termdb : "/usr/share/terminfo");
+#		ifdef PRTTY_TRACE
+		impl::TraceSpan span("get", "load");
+#		endif
+		string file;
+		{
+#			ifdef PRTTY_TRACE
+			impl::TraceSpan opening("open", "load");
+#			endif
+			string path = locate(termname);
+			ifstream dbf;
+			if (!path.empty()) {
+				dbf.open(path, ios::binary);
+			}
+			if (!dbf) {
+				string dirs;
+				for (auto &dir : search_path()) {
+					dirs += (dirs.empty() ? "" : ":") + dir;
+				}
+				throw PrttyError("could not load database for terminal: " + termname + " (from search path: " + dirs + ")");
+			}
+
+			file.assign(istreambuf_iterator<char>(dbf), istreambuf_iterator<char>());
+#			ifdef PRTTY_TRACE
+			opening.note("bytes", file.length());
+#			endif
+		}
+		return load(termname, file);
 	}
 #	else
 	;
@@ -1271,6 +3362,137 @@ namespace prtty {
 	;
 #	endif
 
+#	ifdef PRTTY_METRICS
+	struct capability_metrics {
+		uint64_t evaluations;
+		uint64_t bytes;
+		double seconds; // estimated from the timed samples
+		double p99; // seconds, to within the histogram's resolution
+	};
+
+	/*
+		calls `f(const char *name, const capability_metrics &)` for
+		every string capability, in the order of prtty-strings.inc,
+		then for the extended ones by their short names. only with
+		PRTTY_METRICS defined.
+	*/
+	template <typename F>
+	void for_each_metric(const term &t, F f) {
+		auto visit = [&](const char *name, const impl::SequenceStreamer &cap) {
+			const impl::Metrics &m = cap.metrics();
+			f(name, capability_metrics{m.count(), m.totalBytes(), m.totalSeconds(), m.p99Seconds()});
+		};
+
+#		define PRTTY_DO_STRING(name) visit(#name, t.name);
+#		include "./prtty-strings.inc"
+
+		for (auto &ext : t.extended_strings) {
+			visit(ext.first.c_str(), ext.second);
+		}
+	}
+
+	inline void reset_metrics(const term &t) {
+#		define PRTTY_DO_STRING(name) t.name.metrics().reset();
+#		include "./prtty-strings.inc"
+
+		for (auto &ext : t.extended_strings) {
+			ext.second.metrics().reset();
+		}
+	}
+#	endif
+
+#	ifdef PRTTY_TRACE
+	/*
+		starts or stops recording spans (only with PRTTY_TRACE
+		defined). what's recorded stays until clear_trace().
+	*/
+	inline void enable_tracing(bool on) {
+		impl::Tracing<>::on.store(on);
+	}
+
+	inline bool tracing() {
+		return impl::Tracing<>::on.load(memory_order_relaxed);
+	}
+
+	// forgets the spans so far, along with the threads that have exited since
+	inline void clear_trace() {
+		typedef impl::Tracing<> T;
+		lock_guard<mutex> guard(T::lock);
+		for (size_t i = 0; i < T::rings.size();) {
+			impl::TraceRing &r = *T::rings[i];
+			if (r.finished.load()) {
+				T::rings.erase(T::rings.begin() + static_cast<ptrdiff_t>(i));
+			} else {
+				r.from.store(r.head.load(memory_order_acquire));
+				++i;
+			}
+		}
+	}
+
+	/*
+		the recorded spans as Chrome trace event JSON, which
+		chrome://tracing and ui.perfetto.dev open as a timeline
+		with a track per thread.
+	*/
+	inline void write_trace(ostream &os) {
+		typedef impl::Tracing<> T;
+		const uint64_t capacity = impl::TraceRing::capacity;
+
+		struct Span {
+			const char *name;
+			const char *category;
+			const char *argName;
+			uint64_t arg;
+			uint64_t start;
+			uint64_t duration;
+		};
+
+		auto micros = [&](uint64_t ns) {
+			os << ns / 1000 << '.' << static_cast<char>('0' + ns / 100 % 10) << static_cast<char>('0' + ns / 10 % 10) << static_cast<char>('0' + ns % 10);
+		};
+
+		lock_guard<mutex> guard(T::lock);
+		os << "{\"traceEvents\":[";
+		bool first = true;
+		for (auto &ring : T::rings) {
+			uint64_t head = ring->head.load(memory_order_acquire);
+			uint64_t from = max(ring->from.load(), head > capacity ? head - capacity : 0);
+
+			vector<Span> spans;
+			spans.reserve(head - from);
+			for (uint64_t i = from; i < head; i++) {
+				const impl::TraceEvent &e = ring->events[i & (capacity - 1)];
+				spans.push_back({
+					e.name.load(memory_order_relaxed), e.category.load(memory_order_relaxed),
+					e.argName.load(memory_order_relaxed), e.arg.load(memory_order_relaxed),
+					e.start.load(memory_order_relaxed), e.duration.load(memory_order_relaxed)
+				});
+			}
+
+			// slots the thread went on to reuse (or is reusing) while they were being read aren't to be trusted
+			atomic_thread_fence(memory_order_acquire);
+			uint64_t now = ring->head.load(memory_order_relaxed) + (ring->finished.load() ? 0 : 1);
+			size_t skip = now > capacity && now - capacity > from ? static_cast<size_t>(now - capacity - from) : 0;
+
+			os << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << ring->tid
+				<< ",\"args\":{\"name\":\"thread " << ring->tid << "\"}}";
+			first = false;
+			for (size_t i = skip; i < spans.size(); i++) {
+				const Span &s = spans[i];
+				os << ",\n{\"name\":\"" << s.name << "\",\"cat\":\"" << s.category << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << ring->tid << ",\"ts\":";
+				micros(s.start);
+				os << ",\"dur\":";
+				micros(s.duration);
+				if (s.argName) {
+					os << ",\"args\":{\"" << s.argName << "\":" << s.arg << "}";
+				}
+				os << "}";
+			}
+		}
+		os << "\n],\"displayTimeUnit\":\"ns\"}\n";
+	}
+#	endif
+
 }
 
 #endif
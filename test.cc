@@ -1,11 +1,1473 @@
 #define PRTTY_MAIN
 #include "./prtty.hpp" // include first so as to not shadow errors with missing header files
+#include "./prtty-batch.hpp"
+#include "./prtty-capnames.hpp"
+#include "./prtty-color.hpp"
+#include "./prtty-database.hpp"
+#include "./prtty-eval.hpp"
+#include "./prtty-fanout.hpp"
+#include "./prtty-frame.hpp"
+#include "./prtty-input.hpp"
+#include "./prtty-probe.hpp"
+#include "./prtty-recognizer.hpp"
+#include "./prtty-reload.hpp"
+#include "./prtty-render.hpp"
+#include "./prtty-translate.hpp"
+#include "./prtty-writer.hpp"
 
+#include <atomic>
+#include <chrono>
+#include <csignal>
 #include <iostream>
 #include <sstream>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
 
 using namespace std;
 
+static int failures = 0;
+
+static void check(bool ok, const string &what) {
+	if (!ok) {
+		cout << "FAIL: " << what << endl;
+		++failures;
+	}
+}
+
+static string decode(prtty::input &in, const string &bytes) {
+	string result;
+	in.feed(bytes.data(), bytes.length(), [&](const prtty::key_event &ev) {
+		if (ev.type == prtty::key_event::Type::KEY) {
+			result += string("<") + ev.name + ">";
+		} else {
+			result += string(ev.bytes, ev.length);
+		}
+	});
+	return result;
+}
+
+static vector<prtty::mouse_event> mice(prtty::input &in, const string &bytes) {
+	vector<prtty::mouse_event> result;
+	in.feed(bytes.data(), bytes.length(), [&](const prtty::key_event &ev) {
+		if (ev.type == prtty::key_event::Type::MOUSE) {
+			result.push_back(ev.mouse);
+		}
+	});
+	return result;
+}
+
+static void testMouse(const prtty::term &term) {
+	typedef prtty::mouse_event me;
+	prtty::input in(term);
+
+	auto x10 = mice(in, "\x1b[M !!\x1b[M#*+");
+	check(x10.size() == 2 && x10[0].type == me::Type::PRESS && x10[0].button == 0 && x10[0].x == 0 && x10[0].y == 0, "mouse: x10 press");
+	check(x10.size() == 2 && x10[1].type == me::Type::RELEASE && x10[1].x == 9 && x10[1].y == 10, "mouse: x10 release");
+
+	auto sgr = mice(in, "\x1b[<2;10;5M\x1b[<2;10;5m\x1b[<65;1;1M");
+	check(sgr.size() == 3 && sgr[0].type == me::Type::PRESS && sgr[0].button == 2 && sgr[0].x == 9 && sgr[0].y == 4, "mouse: sgr press");
+	check(sgr.size() == 3 && sgr[1].type == me::Type::RELEASE && sgr[1].button == 2, "mouse: sgr release");
+	check(sgr.size() == 3 && sgr[2].type == me::Type::WHEEL && sgr[2].button == 4, "mouse: sgr wheel");
+
+	auto urxvt = mice(in, "\x1b[48;3;4M");
+	check(urxvt.size() == 1 && urxvt[0].protocol == me::Protocol::URXVT && urxvt[0].control && urxvt[0].x == 2 && urxvt[0].y == 3, "mouse: urxvt");
+
+	check(mice(in, "\x1b[<0;12").empty() && in.pending(), "mouse: split report is held back");
+	auto split = mice(in, ";7M");
+	check(split.size() == 1 && split[0].x == 11 && split[0].y == 6, "mouse: split report completes");
+
+	string drag;
+	for (int i = 1; i <= 500; i++) {
+		drag += "\x1b[<32;" + to_string(i) + ";" + to_string(i % 50 + 1) + "M";
+	}
+	check(mice(in, drag).size() == 500, "mouse: motion is not coalesced by default");
+
+	in.coalesceMotion(true);
+	auto coalesced = mice(in, drag + "\x1b[<0;3;3m");
+	check(coalesced.size() == 2 && coalesced[0].type == me::Type::MOTION && coalesced[0].x == 499 && coalesced[0].y == 0, "mouse: motion run coalesces to the last report");
+	check(coalesced.size() == 2 && coalesced[1].type == me::Type::RELEASE, "mouse: release after coalesced motion");
+}
+
+static string recognize(prtty::recognizer &rec, const string &bytes) {
+	string result;
+	rec.feed(bytes.data(), bytes.length(), [&](const prtty::output_event &ev) {
+		if (ev.type == prtty::output_event::Type::CAPABILITY) {
+			result += string("<") + ev.name;
+			for (int i = 0; i < ev.nargs; i++) {
+				result += " " + to_string(ev.args[i]);
+			}
+			result += ">";
+		} else {
+			result += string(ev.bytes, ev.length);
+		}
+	});
+	return result;
+}
+
+static void testEvaluation(const prtty::term &term) {
+	check(string(term.set_a_foreground(1)) == "\x1b[31m", "eval: setaf 1");
+	check(string(term.set_a_foreground(9)) == "\x1b[91m", "eval: setaf 9 (else-if)");
+	check(string(term.set_a_foreground(100)) == "\x1b[38;5;100m", "eval: setaf 100 (else)");
+	check(string(term.set_attributes(0, 0, 0, 0, 0, 1, 0, 0, 0)) == "\x1b(B\x1b[0;1m", "eval: sgr bold");
+	check(string(term.cursor_address(3, 4)) == "\x1b[4;5H", "eval: cup");
+
+	// formats that have to come out as tparm's do
+	auto eval = [](const string &fmt, int a, int b) {
+		prtty::impl::Data data;
+		ostringstream os;
+		prtty::impl::Sequence::parse(fmt)(data, os, a, b);
+		return os.str();
+	};
+	check(eval("%p1%02x%p2%4.4X", 10, 0x1ca) == "0a01CA", "eval: zero padding and precision");
+	check(eval("%p1%99999999d", 7, 0) == string(59, ' ') + "7" && eval("%p1%:-70d|", 7, 0) == "7" + string(59, ' ') + "|",
+		"eval: absurd widths are held to 60");
+	check(eval("%p1%#.99x", 7, 0) == "0x" + string(59, '0') + "7" && eval("%p1%:+.99d", -7, 0) == "-" + string(59, '0') + "7",
+		"eval: absurd precisions are held to 60");
+	check(eval("%p1%:-4d|%p2%:+d", 7, 7) == "7   |+7", "eval: left-aligned and signed");
+	check(eval("%{-3}%p1%+%d", 10, 0) == "7", "eval: negative literal");
+	check(eval("%p1%c", 0, 0) == "\x80", "eval: %c of 0");
+	check(eval("\x1b[%i%d;%dR", 1, 7) == "\x1b[8;2R", "eval: termcap-style arguments");
+	check(eval("\x1b[?%[;0123456789]c", 0, 0) == "\x1b[?;0123456789]c", "eval: reply pattern");
+	check(eval("%p1%d%d", 5, 0) == "50", "eval: popping an empty stack gives 0");
+	check(eval("%{2147483647}%p1%+%d", 1, 0) == "-2147483648", "eval: overflow wraps");
+
+	// a format that can't be parsed is left unset rather than sent as is
+	prtty::impl::Capability unknown;
+	unknown.compile("\x1b[%p1%Q");
+	prtty::impl::Data unknownData;
+	prtty::impl::SequenceStreamer streamer(unknown, unknownData);
+	check(!streamer && string(streamer(1)).empty() && streamer.source() == "\x1b[%p1%Q", "eval: unparseable capability is unset");
+
+	// what the verifier works out
+	prtty::impl::Shape shape = prtty::impl::Sequence::parse("%p1%p2%+%d").shape;
+	check(shape.depth == 2 && shape.zeros == 0 && shape.params == 3, "verify: depth and arguments");
+	shape = prtty::impl::Sequence::parse("%?%p1%t%p2%p3%e%p4%;%+%d%gA%PB").shape;
+	check(shape.depth == 3 && shape.zeros == 1 && shape.staticsRead == 1 && shape.staticsWritten == 2,
+		"verify: branches of different depths");
+
+	prtty::impl::Data data;
+	ostringstream os;
+	prtty::impl::Sequence::parse("%p1%{1}%+%d")(data, os, "x");
+	check(os.str() == "1", "eval: a string operand reads as 0");
+}
+
+static void testCopy(const prtty::term &term) {
+	const string cup = term.cursor_address(3, 4);
+
+	unique_ptr<prtty::term> original(new prtty::term(term));
+	prtty::term copy(*original);
+	original.reset();
+	check(string(copy.cursor_address(3, 4)) == cup && copy.max_colors == term.max_colors
+		&& copy.names == term.names, "copy: outlives the term it's copied from");
+	check(&copy.cursor_address.sequence() == &term.cursor_address.sequence(), "copy: shares the parsed capabilities");
+	check(copy.extended_strings.size() == term.extended_strings.size()
+		&& (term.extended_strings.empty() || copy.extended_strings.begin()->first == term.extended_strings.begin()->first),
+		"copy: extended capabilities");
+
+	// containers move them around freely
+	vector<prtty::term> terms;
+	for (int i = 0; i < 20; i++) {
+		terms.push_back(i % 2 ? prtty::term(term) : copy);
+	}
+	bool same = true;
+	for (auto &t : terms) {
+		same = same && string(t.cursor_address(3, 4)) == cup;
+	}
+	check(same, "copy: in a vector");
+
+	// each copy has its own state, so they can be evaluated at once
+	atomic<int> wrong(0);
+	vector<thread> threads;
+	for (int i = 0; i < 4; i++) {
+		threads.emplace_back([&wrong, &cup](prtty::term t) {
+			for (int n = 0; n < 2000; n++) {
+				ostringstream os;
+				t.cursor_address.eval(os, 3, 4);
+				t.set_a_foreground.eval(os, n % 256);
+				if (os.str().compare(0, cup.length(), cup) != 0) {
+					++wrong;
+				}
+			}
+		}, terms[static_cast<size_t>(i)]);
+	}
+	for (auto &t : threads) {
+		t.join();
+	}
+	check(wrong == 0, "copy: evaluated on several threads");
+}
+
+// terms are assigned like any value, including to another entry
+static void testAssign(const prtty::term &term, const string &dir) {
+	const string cup = term.cursor_address(3, 4);
+
+	unique_ptr<prtty::term> other(new prtty::term(prtty::get("vt100", dir)));
+	const string otherCup = other->cursor_address(3, 4);
+	prtty::term assigned(term);
+	assigned = *other;
+	other.reset();
+	check(string(assigned.cursor_address(3, 4)) == otherCup && assigned.max_colors == -1
+		&& assigned.id == "vt100" && assigned.names.front() == "vt100", "assign: another entry");
+	assigned = prtty::term(term);
+	check(string(assigned.cursor_address(3, 4)) == cup && assigned.names == term.names && assigned.id == term.id, "assign: moved");
+
+	// what containers need
+	vector<prtty::term> terms(20, term);
+	swap(assigned, terms[0]);
+	terms.erase(terms.begin());
+	terms.insert(terms.begin() + 3, assigned);
+	bool same = terms.size() == 20;
+	for (auto &t : terms) {
+		same = same && string(t.cursor_address(3, 4)) == cup && &t.cursor_address.sequence() == &term.cursor_address.sequence();
+	}
+	check(same, "assign: swapped, erased and inserted");
+}
+
+static void testBatchEvaluation(const prtty::term &term) {
+	vector<prtty::eval_record> records = {
+		{&term.cursor_address, {3, 4}},
+		{&term.set_a_foreground, {100}},
+		{&term.enter_micro_mode, {}}, // not set: no bytes
+		{&term.set_attributes, {0, 0, 0, 0, 0, 1, 0, 0, 0}},
+		{&term.set_a_foreground, {1}},
+		{&term.parm_right_cursor, {12}},
+		{&term.exit_attribute_mode, {}}
+	};
+
+	vector<string> parts = {
+		term.cursor_address(3, 4),
+		term.set_a_foreground(100),
+		"",
+		term.set_attributes(0, 0, 0, 0, 0, 1, 0, 0, 0),
+		term.set_a_foreground(1),
+		term.parm_right_cursor(12),
+		term.exit_attribute_mode
+	};
+
+	prtty::evaluator ev;
+	for (int pass = 0; pass < 2; pass++) {
+		const string &out = ev.run(records);
+		const vector<size_t> &offsets = ev.offsets();
+
+		string expected;
+		bool split = offsets.size() == records.size() + 1;
+		for (size_t i = 0; i < parts.size(); i++) {
+			split = split && offsets[i] == expected.length() && out.compare(offsets[i], offsets[i + 1] - offsets[i], parts[i]) == 0;
+			expected += parts[i];
+		}
+
+		check(out == expected, "batch eval: output matches separate calls");
+		check(split && offsets.back() == out.length(), "batch eval: per-record offsets");
+	}
+}
+
+static void testCapabilityNames(const prtty::term &term) {
+	prtty::capability fg = prtty::find_capability("setaf");
+	check(fg && fg == prtty::find_capability("set_a_foreground") && fg.type == prtty::capability::Type::STRING,
+		"capnames: long and short names");
+	check(&term.get_string(fg) == &term.set_a_foreground && string(term.get_string(fg)(100)) == "\x1b[38;5;100m",
+		"capnames: string by index");
+	check(term.get_integer(prtty::find_capability("colors")) == term.max_colors
+		&& term.get_boolean(prtty::find_capability("am")) == term.auto_right_margin
+		&& term.get_integer(prtty::find_capability("lines")) == term.lines, "capnames: booleans and integers");
+	check(!prtty::find_capability("seta") && !prtty::find_capability("") && !prtty::find_capability("setaf ")
+		&& !prtty::find_capability("XM"), "capnames: not capabilities");
+	check(string(prtty::short_name(fg)) == "setaf" && string(prtty::long_name(prtty::find_capability("cup"))) == "cursor_address"
+		&& !prtty::long_name(prtty::capability()), "capnames: names of an index");
+
+	bool thrown = false;
+	try {
+		term.get_integer(fg);
+	} catch (const prtty::PrttyError &) {
+		thrown = true;
+	}
+	check(thrown, "capnames: index of the wrong type");
+
+	// every name finds its own capability
+	bool all = true;
+	for (size_t i = 0; i < prtty::impl::CapabilityNames::count; i++) {
+		prtty::capability cap = prtty::impl::CapabilityNames::at(i);
+		all = all && prtty::find_capability(prtty::long_name(cap)) == cap && prtty::find_capability(prtty::short_name(cap)) == cap;
+	}
+	check(all, "capnames: every capability");
+}
+
+#ifdef PRTTY_METRICS
+static void testMetrics(const prtty::term &term) {
+	prtty::reset_metrics(term);
+
+	stringstream ss;
+	ss << term.set_a_foreground(1) << term.set_a_foreground(100) << term.clear_screen;
+	string setaf = string(term.set_a_foreground(1)) + string(term.set_a_foreground(100));
+
+	prtty::eval_record records[] = {{&term.set_a_foreground, {2}}};
+	prtty::evaluator ev;
+	ev.run(records, 1);
+
+	size_t caps = 0;
+	prtty::capability_metrics af{0, 0, 0, 0}, cup{1, 1, 1, 1};
+	prtty::for_each_metric(term, [&](const char *name, const prtty::capability_metrics &m) {
+		++caps;
+		if (string(name) == "set_a_foreground") {
+			af = m;
+		} else if (string(name) == "cursor_address") {
+			cup = m;
+		}
+	});
+
+	check(caps >= 394, "metrics: every capability is listed");
+	check(af.evaluations == 5, "metrics: evaluations counted");
+	check(af.bytes == setaf.length() * 2 + ev.output().length(), "metrics: bytes counted");
+	check(af.seconds > 0 && af.p99 > 0, "metrics: timing sampled");
+	check(cup.evaluations == 0 && cup.bytes == 0, "metrics: untouched capability");
+	check(ss.str() == setaf + string(term.clear_screen), "metrics: output unchanged");
+
+	// copies on other threads count into the same capability, exactly
+	prtty::reset_metrics(term);
+	vector<thread> threads;
+	for (int i = 0; i < 4; i++) {
+		threads.emplace_back([](prtty::term t) {
+			ostringstream os;
+			for (int n = 0; n < 5000; n++) {
+				t.cursor_address.eval(os, n % 24, n % 80);
+			}
+		}, term);
+	}
+	for (auto &t : threads) {
+		t.join();
+	}
+	prtty::for_each_metric(term, [&](const char *name, const prtty::capability_metrics &m) {
+		if (string(name) == "cursor_address") {
+			cup = m;
+		}
+	});
+	check(cup.evaluations == 20000, "metrics: copies on several threads");
+}
+#endif
+
+#ifdef PRTTY_TRACE
+static size_t occurrences(const string &s, const string &what) {
+	size_t n = 0;
+	for (size_t at = s.find(what); at != string::npos; at = s.find(what, at + 1)) {
+		++n;
+	}
+	return n;
+}
+
+static string traced() {
+	ostringstream os;
+	prtty::write_trace(os);
+	return os.str();
+}
+
+static void testTrace(const string &dir) {
+	// while off, spans (the library's own included) cost no clock reads
+	typedef prtty::impl::Tracing<> Tracing;
+	prtty::clear_trace();
+	const uint64_t reads = Tracing::clockReads;
+	prtty::get("vt100", dir);
+	for (int i = 0; i < 1000; i++) {
+		prtty::impl::TraceSpan span("off", "test");
+		span.note("i", static_cast<uint64_t>(i));
+	}
+	check(occurrences(traced(), "\"ph\":\"X\"") == 0, "trace: nothing recorded while off");
+	check(Tracing::clockReads == reads, "trace: no clock reads while off");
+
+	prtty::enable_tracing(true);
+	{
+		prtty::impl::TraceSpan span("on", "test");
+	}
+	prtty::enable_tracing(false);
+	check(Tracing::clockReads == reads + 2, "trace: a span reads the clock twice while on");
+	prtty::clear_trace();
+
+	prtty::enable_tracing(true);
+	prtty::term t = prtty::get("xterm-256color", dir);
+	prtty::eval_record records[] = {{&t.cursor_address, {3, 4}}, {&t.set_a_foreground, {1}}};
+	prtty::evaluator ev;
+	ev.run(records, 2);
+	int fds[2];
+	check(pipe(fds) == 0, "trace: pipe");
+	prtty::frame f(t);
+	f.begin().put(t.cursor_address, 1, 1);
+	f.end().write(fds[1]);
+	close(fds[0]);
+	close(fds[1]);
+	prtty::enable_tracing(false);
+
+	string json = traced();
+	check(json.compare(0, 15, "{\"traceEvents\":") == 0 && json.find("\"displayTimeUnit\":\"ns\"}") != string::npos, "trace: chrome trace json");
+	check(occurrences(json, "{\"name\":\"get\",\"cat\":\"load\"") == 1 && occurrences(json, "{\"name\":\"open\"") == 1 && occurrences(json, "{\"name\":\"decode\"") == 1,
+		"trace: get, open and decode");
+	check(occurrences(json, "{\"name\":\"parse\"") == 2 && occurrences(json, "{\"name\":\"Sequence::parse\"") > 100, "trace: parsing");
+	check(json.find("{\"name\":\"evaluator::run\",\"cat\":\"eval\"") != string::npos && json.find("\"args\":{\"records\":2}") != string::npos, "trace: evaluation batches");
+	check(json.find("{\"name\":\"frame::write\",\"cat\":\"output\"") != string::npos, "trace: flushes");
+
+	// a thread that outruns its ring keeps the newest spans, and they outlive it
+	prtty::clear_trace();
+	prtty::enable_tracing(true);
+	const size_t capacity = prtty::impl::TraceRing::capacity;
+	thread([&]() {
+		for (size_t i = 0; i < capacity + 100; i++) {
+			prtty::impl::TraceSpan span("spin", "test");
+		}
+	}).join();
+	json = traced();
+	check(occurrences(json, "{\"name\":\"spin\"") == capacity, "trace: ring keeps the last spans");
+	prtty::clear_trace();
+	check(occurrences(traced(), "\"thread_name\"") == 1, "trace: exited threads are dropped on clear");
+
+	// read while the ring's being overwritten under it
+	atomic<bool> stop(false);
+	thread spinner([&]() {
+		while (!stop.load()) {
+			prtty::impl::TraceSpan span("spin", "test");
+		}
+	});
+	bool whole = true;
+	for (int i = 0; i < 20; i++) {
+		json = traced();
+		whole = whole && occurrences(json, "\"ph\":\"X\"") == occurrences(json, "{\"name\":\"spin\",\"cat\":\"test\",\"ph\":\"X\"");
+	}
+	stop = true;
+	spinner.join();
+	check(whole, "trace: reading alongside the writer");
+
+	prtty::clear_trace();
+}
+#endif
+
+static void testRecognizer(const prtty::term &term) {
+	prtty::recognizer rec(term);
+
+	string out = "hi" + string(term.cursor_address(3, 4)) + "there" + string(term.set_a_foreground(100))
+		+ string(term.set_a_background(2)) + string(term.clear_screen) + string(term.parm_right_cursor(12));
+	check(recognize(rec, out) == "hi<cursor_address 3 4>there<set_a_foreground 100><set_a_background 2><clear_screen><parm_right_cursor 12>", "recognizer: mixed output");
+
+	string bold = term.set_attributes(0, 0, 0, 0, 0, 1, 0, 0, 0);
+	check(recognize(rec, bold) == "<set_attributes 0 0 0 0 0 1 0 0 0>", "recognizer: sgr");
+
+	// split across writes
+	string cup = term.cursor_address(10, 20);
+	check(recognize(rec, "ab" + cup.substr(0, 4)) == "ab" && rec.pending(), "recognizer: split sequence is held back");
+	check(recognize(rec, cup.substr(4) + "cd") == "<cursor_address 10 20>cd", "recognizer: split sequence completes");
+
+	check(recognize(rec, "\x1b[99qx") == "\x1b[99qx", "recognizer: unknown sequence is text");
+}
+
+static void testRecognizerChars(const string &dir) {
+	// %c: 0 goes out as 0200, which is also what 128 does
+	prtty::term chars = prtty::get("prtty-char", dir + "/char");
+	prtty::recognizer crec(chars);
+	check(string(chars.column_address(0)) == "\x1b[\x80G" && recognize(crec, chars.column_address(0)) == "<column_address 0>", "recognizer: %c of 0 round-trips");
+	check(recognize(crec, chars.column_address(65)) == "<column_address 65>", "recognizer: %c");
+	check(recognize(crec, chars.cursor_address(0, 96)) == "<cursor_address 0 96>", "recognizer: %c of 128 with an offset");
+	check(recognize(crec, chars.row_address(7)) == "<row_address 7>", "recognizer: constant %c of 0");
+}
+
+static string translate(prtty::translator &tr, const string &bytes) {
+	string result;
+	tr.feed(bytes.data(), bytes.length(), [&](const char *data, size_t len) {
+		result.append(data, len);
+	});
+	return result;
+}
+
+static void testTranslate(const prtty::term &term, const string &dir) {
+	prtty::term linux = prtty::get("linux", dir);
+	prtty::term vt100 = prtty::get("vt100", dir);
+
+	string cup = term.cursor_address(3, 4);
+	string out = "a" + cup + string(term.set_a_foreground(100)) + "b" + string(term.set_attributes(0, 0, 0, 0, 0, 1, 0, 0, 0)) + "c";
+
+	// identity: everything goes through untouched, straight from the caller's buffer
+	prtty::translator same(term, term);
+	size_t copies = 0;
+	string result;
+	same.feed(out.data(), out.length(), [&](const char *data, size_t len) {
+		copies += data < out.data() || data >= out.data() + out.length();
+		result.append(data, len);
+	});
+	check(result == out && copies == 0, "translate: identity is zero-copy passthrough");
+
+	prtty::translator toLinux(term, linux);
+	string expected = "a" + string(linux.cursor_address(3, 4)) + string(linux.set_a_foreground(3)) + "b"
+		+ string(linux.set_attributes(0, 0, 0, 0, 0, 1, 0, 0, 0)) + "c";
+	check(translate(toLinux, out) == expected, "translate: xterm-256color to linux degrades colors");
+	check(translate(toLinux, string(term.set_a_background(4))) == string(linux.set_a_background(4)), "translate: low colors map to themselves");
+
+	// a sequence split across writes
+	check(translate(toLinux, "x" + out.substr(0, 4)) == "xa", "translate: split sequence is held back");
+	check(translate(toLinux, out.substr(4)) == expected.substr(1), "translate: split sequence completes");
+
+	// one translator per thread, all into the same target term
+	vector<unique_ptr<prtty::translator>> translators;
+	for (int i = 0; i < 4; i++) {
+		translators.emplace_back(new prtty::translator(term, linux));
+	}
+	atomic<int> wrong(0);
+	vector<thread> threads;
+	for (auto &tr : translators) {
+		threads.emplace_back([&](prtty::translator *tr) {
+			for (int n = 0; n < 500; n++) {
+				wrong += translate(*tr, out) != expected;
+			}
+		}, tr.get());
+	}
+	for (auto &t : threads) {
+		t.join();
+	}
+	check(wrong == 0, "translate: translators sharing a target on several threads");
+
+	prtty::translator toVt100(term, vt100);
+	expected = "a" + string(vt100.cursor_address(3, 4)) + "b" + string(vt100.set_attributes(0, 0, 0, 0, 0, 1, 0, 0, 0)) + "c";
+	check(translate(toVt100, out) == expected, "translate: colors dropped without max_colors");
+}
+
+static void testDatabase(const string &dir) {
+	prtty::database db(dir);
+	check(db.size() == 3, "database: indexes the three fixtures");
+
+	const prtty::database::entry *xterm = db.find("xterm-256color");
+	check(xterm && xterm->caps.max_colors == 256 && xterm->caps.auto_right_margin, "database: summary");
+	check(xterm && !xterm->description.empty() && xterm->description.find('|') == string::npos, "database: description");
+	check(!db.find("nonexistent"), "database: unknown name");
+
+	const prtty::database::entry *vt100 = db.find("vt100");
+	check(vt100 && vt100->caps.max_colors == -1 && prtty::get("vt100", dir).max_colors == -1, "database: absent numbers are -1");
+
+	auto colorful = db.select([](const prtty::database::entry &e) { return e.caps.max_colors >= 256; });
+	check(colorful.size() == 1 && colorful[0] == xterm, "database: select");
+
+	for (auto &e : db.entries()) {
+		check(db.find(e.name) == &e, "database: every entry by its name: " + e.name);
+		for (auto &alias : e.aliases) {
+			check(db.find(alias) == &e, "database: alias " + alias);
+		}
+	}
+
+	prtty::term loaded = db.load("linux");
+	prtty::term direct = prtty::get("linux", dir);
+	check(loaded.names == direct.names && loaded.max_colors == direct.max_colors
+		&& string(loaded.cursor_address(3, 4)) == string(direct.cursor_address(3, 4)), "database: load matches get");
+
+	auto all = db.load_all(2);
+	bool complete = all.size() == db.size();
+	for (size_t i = 0; complete && i < all.size(); i++) {
+		complete = all[i] && all[i]->names.front() == db.entries()[i].name;
+	}
+	check(complete, "database: load_all");
+}
+
+// the integer-only path gives what the generic one does, state included
+static void testIntegral(const string &dir) {
+	prtty::database db(dir);
+	static const int grid[][9] = {
+		{0, 0, 0, 0, 0, 0, 0, 0, 0},
+		{1, 2, 3, 4, 5, 6, 7, 8, 9},
+		{7, 80, 255, 0, 1, 0, 1, 0, 1},
+		{255, 1000, 16, 15, 0, 1, 1, 1, 0},
+		{-1, -30, 32767, 9, 8, 7, 6, 5, 4}
+	};
+
+	size_t integral = 0;
+	size_t total = 0;
+	bool same = true;
+	string failed;
+	for (auto &e : db.entries()) {
+		prtty::term t = db.load(e.name);
+		auto compare = [&](const string &name, const prtty::impl::SequenceStreamer &cap) {
+			const prtty::impl::Sequence &seq = cap.sequence();
+			++total;
+			if (!seq.integral()) {
+				return;
+			}
+			++integral;
+
+			prtty::impl::Data fast;
+			prtty::impl::Data slow;
+			for (auto &args : grid) {
+				string a, b;
+				prtty::impl::StringBuf fastBuf(a);
+				prtty::impl::StringBuf slowBuf(b);
+				ostream fastOut(&fastBuf);
+				ostream slowOut(&slowBuf);
+				fast.bind(args, 9);
+				slow.bind(args, 9);
+				seq.run(fast, fastOut);
+				seq.interpret(slow, slowOut);
+
+				bool statics = true;
+				for (size_t i = 0; i < 26; i++) {
+					statics = statics && fast.sparm[i].tint == slow.sparm[i].tint;
+				}
+				if (a != b || !statics) {
+					same = false;
+					failed += " " + e.name + ":" + name;
+				}
+			}
+		};
+
+#		define PRTTY_DO_STRING(name) if (t.name) compare(#name, t.name);
+#		include "./prtty-strings.inc"
+		for (auto &ext : t.extended_strings) {
+			if (ext.second) {
+				compare(ext.first, ext.second);
+			}
+		}
+	}
+
+	check(same, "integral: matches the generic path" + failed);
+	check(integral == total, "integral: every fixture capability qualifies");
+
+	prtty::impl::Sequence strings = prtty::impl::Sequence::parse("%p1%s");
+	prtty::impl::Sequence ints = prtty::impl::Sequence::parse("%p1%d");
+	check(!strings.integral() && ints.integral(), "integral: %s stays generic");
+
+	// where a string is read as a number as 0
+	prtty::impl::Data data;
+	ostringstream os;
+	ints(data, os, "x");
+	check(os.str() == "0", "integral: string arguments take the generic path");
+}
+
+static void copyFile(const string &from, const string &to) {
+	ifstream in(from, ios::binary);
+	ofstream out(to, ios::binary);
+	out << in.rdbuf();
+}
+
+static void testPadding(const string &dir) {
+	prtty::term vt100 = prtty::get("vt100", dir);
+	check(string(vt100.cursor_address(3, 4)) == "\x1b[4;5H", "padding: dropped by default");
+	vt100.use_padding(9600);
+	check(string(vt100.cursor_address(3, 4)) == "\x1b[4;5H", "padding: not sent with xon_xoff");
+
+	auto eval = [](const string &fmt, bool normal) {
+		prtty::impl::Data data;
+		data.padding.baud = 9600;
+		data.padding.pad = '*';
+		data.padding.normal = normal;
+		ostringstream os;
+		prtty::impl::Sequence::parse(fmt)(data, os, 1);
+		return os.str();
+	};
+	check(eval("a$<5>b", true) == "a*****b", "padding: 5ms at 9600 baud");
+	check(eval("a$<5>b", false) == "ab", "padding: only when normal");
+	check(eval("a$<20/>b", false) == "a" + string(21, '*') + "b", "padding: mandatory");
+	check(eval("%p1%d$<1.5*>", true) == "1*", "padding: tenths and proportional");
+	check(eval("$<x>$<5", true) == "$<x>$<5", "padding: malformed is literal");
+	check(eval("a$<5x>b", true) == "a$<5x>b", "padding: junk before > is literal");
+	check(eval("$<5%p1%d>", true) == "$<51>", "padding: stray $< keeps what follows");
+	check(eval("$<3/*>", false) == string(3, '*'), "padding: flags in either order");
+}
+
+static void testSearchPath(const string &dir) {
+	char tmpl[] = "/tmp/prtty-search-XXXXXX";
+	string root = mkdtemp(tmpl);
+	string a = root + "/a";
+	string home = root + "/home";
+	string b = root + "/b";
+	for (auto d : {a, home, home + "/.terminfo", home + "/.terminfo/v", b, b + "/l"}) {
+		mkdir(d.c_str(), 0700);
+	}
+	copyFile(dir + "/76/vt100", home + "/.terminfo/v/vt100");
+	copyFile(dir + "/6c/linux", b + "/l/linux");
+
+	const char *vars[] = {"TERMINFO", "HOME", "TERMINFO_DIRS"};
+	vector<pair<bool, string>> saved;
+	for (auto var : vars) {
+		const char *v = getenv(var);
+		saved.push_back({v != nullptr, v ? v : ""});
+	}
+	setenv("TERMINFO", a.c_str(), 1);
+	setenv("HOME", home.c_str(), 1);
+	setenv("TERMINFO_DIRS", (b + "::" + a).c_str(), 1);
+
+	vector<string> expected = {a, home + "/.terminfo", b, "/etc/terminfo", "/lib/terminfo", "/usr/share/terminfo"};
+	check(prtty::search_path() == expected, "search path: order");
+	check(prtty::locate("vt100") == home + "/.terminfo/v/vt100", "search path: ~/.terminfo");
+	check(prtty::locate("linux") == b + "/l/linux" && prtty::get("linux").max_colors == 8, "search path: TERMINFO_DIRS");
+	check(prtty::locate("../b/l/linux").empty() && prtty::locate("").empty(), "search path: names that aren't names");
+
+	prtty::impl::LookupCache &cache = prtty::impl::lookups();
+	bool threw = false;
+	try {
+		prtty::get("no-such-terminal");
+	} catch (const prtty::PrttyError &) {
+		threw = true;
+	}
+	size_t probes = cache.probes();
+	check(threw && prtty::locate("no-such-terminal").empty() && cache.probes() == probes, "search path: misses are remembered");
+
+	// installing an entry changes the directory's mtime, which forgets what was cached
+	cache.interval = chrono::seconds(0);
+	mkdir((a + "/l").c_str(), 0700);
+	copyFile(dir + "/6c/linux", a + "/l/linux");
+	check(prtty::locate("linux") == a + "/l/linux", "search path: sees new entries");
+	cache.interval = chrono::seconds(1);
+	cache.clear();
+
+	for (size_t i = 0; i < saved.size(); i++) {
+		if (saved[i].first) {
+			setenv(vars[i], saved[i].second.c_str(), 1);
+		} else {
+			unsetenv(vars[i]);
+		}
+	}
+
+	for (auto f : {home + "/.terminfo/v/vt100", b + "/l/linux", a + "/l/linux"}) {
+		unlink(f.c_str());
+	}
+	for (auto d : {a + "/l", a, home + "/.terminfo/v", home + "/.terminfo", home, b + "/l", b, root}) {
+		rmdir(d.c_str());
+	}
+}
+
+static void testReload(const string &dir) {
+	char tmpl[] = "/tmp/prtty-reload-XXXXXX";
+	string root = mkdtemp(tmpl);
+	mkdir((root + "/l").c_str(), 0700);
+	string path = root + "/l/live";
+
+	auto slurp = [](const string &from) {
+		ifstream in(from, ios::binary);
+		return string((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+	};
+	// replaced the way package managers do, or rewritten in place
+	auto install = [&](const string &bytes, bool rename) {
+		string to = rename ? root + "/l/.live.tmp" : path;
+		{
+			ofstream out(to, ios::binary | ios::trunc);
+			out << bytes;
+		}
+		if (rename) {
+			::rename(to.c_str(), path.c_str());
+		}
+	};
+	auto waitFor = [](function<bool()> done) {
+		for (int i = 0; i < 400 && !done(); i++) {
+			this_thread::sleep_for(chrono::milliseconds(5));
+		}
+		return done();
+	};
+
+	string entries[2] = {slurp(dir + "/76/vt100"), slurp(dir + "/78/xterm-256color")};
+	string cup = "\x1b[4;5H";
+	string setaf = string(prtty::get("xterm-256color", dir).set_a_foreground(1));
+	install(entries[0], false);
+
+	prtty::live_term live("live", root);
+	check(live.version() == 1 && live.watching(), "reload: loads and watches");
+
+	// readers evaluate flat out while the entry flips between the two
+	atomic<bool> stop(false);
+	atomic<int> torn(0);
+	atomic<int> moves(0);
+	vector<thread> readers;
+	for (int i = 0; i < 3; i++) {
+		readers.emplace_back([&]() {
+			prtty::live_term::reader r = live.read();
+			uint64_t last = r.version();
+			while (!stop.load()) {
+				const prtty::term &t = r.get();
+				bool color = t.max_colors == 256;
+				if (string(t.cursor_address(3, 4)) != cup || string(t.set_a_foreground(1)) != (color ? setaf : "")) {
+					++torn;
+				}
+				if (r.version() != last) {
+					last = r.version();
+					++moves;
+				}
+			}
+		});
+	}
+
+	const uint64_t rewrites = 40;
+	bool kept = true;
+	for (uint64_t i = 1; i <= rewrites; i++) {
+		install(entries[i % 2], i % 3 != 0);
+		kept = waitFor([&]() { return live.version() == i + 1; }) && kept;
+	}
+	stop = true;
+	for (auto &t : readers) {
+		t.join();
+	}
+	check(kept && torn == 0, "reload: every rewrite published, no reader saw a mix");
+	check(moves > 0, "reload: readers moved to new versions");
+
+	prtty::live_term::reader r = live.read();
+	uint64_t before = live.version();
+	size_t failed = live.failures();
+	install("not an entry", true);
+	check(waitFor([&]() { return live.failures() > failed; }) && live.version() == before && r.get().max_colors == -1, "reload: a broken entry leaves the last good one");
+
+	unlink(path.c_str());
+	check(!live.reload() && live.version() == before, "reload: a removed entry leaves the last good one");
+
+	install(entries[1], true);
+	check(waitFor([&]() { return live.version() == before + 1; }) && r.get().max_colors == 256, "reload: picks up a reinstalled entry");
+	check(!live.reload() && live.unreclaimed() == 0, "reload: old versions are freed");
+
+	unlink(path.c_str());
+	rmdir((root + "/l").c_str());
+	rmdir(root.c_str());
+}
+
+static void testFrame(const prtty::term &term, const string &dir) {
+	prtty::term sync = prtty::get("xterm-sync", dir + "/sync");
+	prtty::frame sf(sync);
+	check(sf.synchronized(), "frame: Sync is advertised");
+	sf.begin().put(sync.cursor_address, 3, 4) << "hi";
+	check(sf.end().str() == "\x1b[?2026h\x1b[4;5Hhi\x1b[?2026l" && !sf.hidCursor(), "frame: synchronized, cursor left alone");
+	check(sf.begin().end().length() == 0, "frame: nothing to bracket");
+
+	prtty::frame f(term);
+	string civis = term.cursor_invisible;
+	string cnorm = term.cursor_normal;
+	check(!f.synchronized(), "frame: no Sync in xterm-256color");
+	f.begin();
+	f.put(term.cursor_address, 3, 4) << "hi" << term.exit_attribute_mode;
+	check(f.end().str() == civis + "\x1b[4;5Hhi" + string(term.exit_attribute_mode) + cnorm && f.hidCursor(), "frame: motion hides the cursor");
+	f.begin() << "x" << term.exit_attribute_mode;
+	check(f.end().str() == "x" + string(term.exit_attribute_mode) && !f.hidCursor(), "frame: text alone doesn't");
+	f.cursorHidden(true);
+	f.begin().put(term.cursor_address, 0, 0);
+	check(f.end().str() == "\x1b[1;1H", "frame: cursor kept hidden by the application");
+
+	prtty::term vt100 = prtty::get("vt100", dir);
+	prtty::frame vf(vt100);
+	vf.begin().put(vt100.cursor_address, 0, 0);
+	check(vf.end().str() == "\x1b[1;1H", "frame: nothing to hide the cursor with");
+
+	int fds[2];
+	check(pipe(fds) == 0, "frame: pipe");
+	f.cursorHidden(false);
+	f.begin().put(term.cursor_address, 1, 1) << string(1000, '.');
+	f.end().write(fds[1]);
+	string got(f.length(), '\0');
+	check(read(fds[0], &got[0], got.length()) == static_cast<ssize_t>(got.length()) && got == f.str(), "frame: written in one go");
+	close(fds[0]);
+	close(fds[1]);
+}
+
+static void testFanout(const prtty::term &term, const string &dir) {
+	prtty::term linux = prtty::get("linux", dir);
+	prtty::fanout fan;
+
+	vector<prtty::fanout::frame> got[4];
+	bool accept = true;
+	for (int i = 0; i < 3; i++) {
+		fan.attach(term, [&, i](const prtty::fanout::frame &f) {
+			if (i == 2 && !accept) {
+				return false;
+			}
+			got[i].push_back(f);
+			return true;
+		});
+	}
+	fan.attach(linux, [&](const prtty::fanout::frame &f) { got[3].push_back(f); return true; });
+
+	auto render = [](const prtty::term &t, ostream &os) {
+		os << t.set_a_foreground(1) << "status" << t.cursor_down;
+	};
+
+	fan.broadcast(0, 0, render);
+	check(fan.terminals() == 2 && fan.clients() == 4 && fan.renders() == 2, "fanout: one render per terminal");
+	check(got[0].size() == 2 && got[0][1] == got[1][1] && got[1][1] == got[2][1], "fanout: clients share the frame buffer");
+	check(*got[0][0] == string(term.exit_attribute_mode) + string(term.cursor_address(0, 0)), "fanout: new clients are resynced");
+	check(*got[3][1] == string(linux.set_a_foreground(1)) + "status" + string(linux.cursor_down), "fanout: rendered per terminal");
+
+	// client 2 falls behind for a frame, then catches up with a resync
+	accept = false;
+	fan.broadcast(1, 0, render);
+	accept = true;
+	fan.broadcast(2, 0, render);
+	check(got[0].size() == 4 && got[2].size() == 4, "fanout: lagging client skips a frame");
+	check(got[2].size() == 4 && *got[2][2] == string(term.exit_attribute_mode) + string(term.cursor_address(2, 0)), "fanout: lagging client is resynced");
+	check(fan.resynced() == 5, "fanout: only lagging clients are resynced");
+
+	// copies of one loaded term share a group
+	prtty::fanout shared;
+	prtty::term copy(term);
+	size_t delivered = 0;
+	shared.attach(term, [&](const prtty::fanout::frame &) { ++delivered; return true; });
+	shared.attach(copy, [&](const prtty::fanout::frame &) { ++delivered; return true; });
+	shared.broadcast(0, 0, render);
+	check(shared.terminals() == 1 && shared.renders() == 1 && delivered == 4, "fanout: copies of a term render once");
+
+	// a sink that drops clients (its own included) and brings in another, mid-broadcast
+	auto counted = [&](const prtty::fanout::frame &) { ++delivered; return true; };
+	size_t gone = 0, late = 0;
+	bool added = false;
+	gone = shared.attach(term, [&](const prtty::fanout::frame &) {
+		shared.detach(gone);
+		shared.detach(late);
+		if (!added) {
+			added = true;
+			shared.attach(copy, counted);
+		}
+		return false;
+	});
+	late = shared.attach(copy, counted);
+	delivered = 0;
+	shared.broadcast(0, 0, render);
+	check(shared.clients() == 3 && shared.terminals() == 1, "fanout: detached and attached during a broadcast");
+	check(delivered == 4, "fanout: detached clients get nothing more, attached ones start right away");
+}
+
+// reads whatever the pty has; waits up to `ms` for something to show up
+static size_t drain(int fd, string &into, size_t limit, int ms) {
+	struct pollfd p = {fd, POLLIN, 0};
+	if (poll(&p, 1, ms) <= 0) {
+		return 0;
+	}
+
+	char buf[4096];
+	ssize_t n = read(fd, buf, min(limit, sizeof(buf)));
+	if (n <= 0) {
+		return 0;
+	}
+	into.append(buf, static_cast<size_t>(n));
+	return static_cast<size_t>(n);
+}
+
+static void testWriter() {
+	int master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+		cout << "(no pty, skipping writer tests)" << endl;
+		return;
+	}
+	int slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+	struct termios raw;
+	tcgetattr(slave, &raw);
+	cfmakeraw(&raw);
+	tcsetattr(slave, TCSANOW, &raw);
+
+	const size_t frameSize = 4096;
+	auto frame = [&](int i) {
+		string f = to_string(1000000 + i);
+		f.resize(frameSize, static_cast<char>('a' + i % 26));
+		return f;
+	};
+
+	// 0 is a stalled reader
+	for (size_t rate : {static_cast<size_t>(0), static_cast<size_t>(64), static_cast<size_t>(1024), frameSize * 4}) {
+		prtty::writer w(slave);
+		string got;
+		const int frames = 300;
+		for (int i = 0; i < frames; i++) {
+			w.write(frame(i));
+			if (rate > 0) {
+				drain(master, got, rate, 0);
+			}
+			w.pump();
+		}
+
+		while (w.pending() || drain(master, got, frameSize, 100) > 0) {
+			w.pump();
+			drain(master, got, frameSize, 10);
+		}
+
+		const string what = "writer (drain " + to_string(rate) + "): ";
+		check(w.highWater() <= 2, what + "full frames don't queue up");
+		check(got.length() % frameSize == 0, what + "only whole frames are written");
+		int last = -1;
+		bool whole = true;
+		for (size_t off = 0; off + frameSize <= got.length(); off += frameSize) {
+			int n = stoi(got.substr(off, 7)) - 1000000;
+			whole = whole && n > last && got.compare(off, frameSize, frame(n)) == 0;
+			last = n;
+		}
+		check(whole && last == frames - 1, what + "frames arrive intact, in order, ending with the latest");
+		check(got.length() / frameSize + w.dropped() == frames, what + "every frame is written or dropped");
+		if (rate == 0) {
+			check(w.dropped() > 0, what + "stalled reader drops superseded frames");
+		}
+	}
+
+	// increments can't be coalesced; past the limit they wait for a full frame
+	{
+		prtty::writer w(slave, 4);
+		string big(frameSize * 64, 'x');
+		w.write(big);
+		for (int i = 0; i < 10; i++) {
+			w.write(string("delta"), false);
+		}
+		check(w.needsFull() && w.depth() <= 4, "writer: stalled increments are dropped until a full frame");
+		w.write(string("full"));
+		check(!w.needsFull(), "writer: full frame resumes");
+
+		string got;
+		while (w.pending() || drain(master, got, frameSize, 100) > 0) {
+			w.pump();
+			drain(master, got, frameSize, 10);
+		}
+		check(got == big + "full", "writer: in-progress frame is finished, then the full frame");
+	}
+
+	close(slave);
+	close(master);
+}
+
+/*
+	a terminal at the other end of a pty, `rtt` away: it answers cursor
+	position, device attributes and (if `tcap`) XTGETTCAP queries in
+	order, with a keypress mixed in, until `stop`.
+*/
+static void standIn(int master, chrono::milliseconds rtt, bool tcap, atomic<bool> &stop) {
+	string in;
+	while (!stop) {
+		struct pollfd p = {master, POLLIN, 0};
+		char buf[256];
+		if (poll(&p, 1, 5) <= 0) {
+			continue;
+		}
+		ssize_t n = read(master, buf, sizeof(buf));
+		if (n <= 0) {
+			continue;
+		}
+		in.append(buf, static_cast<size_t>(n));
+
+		string out;
+		for (size_t i; (i = in.find('\x1b')) != string::npos;) {
+			if (in.compare(i, 4, "\x1b[6n") == 0) {
+				out += "\x1b[5;10R";
+				in.erase(0, i + 4);
+			} else if (in.compare(i, 3, "\x1b[c") == 0) {
+				out += "x\x1b[?64;1;2c";
+				in.erase(0, i + 3);
+			} else if (in.compare(i, 4, "\x1bP+q") == 0 && in.find("\x1b\\", i + 4) != string::npos) {
+				size_t end = in.find("\x1b\\", i + 4);
+				string name = in.substr(i + 4, end - i - 4);
+				if (tcap) {
+					out += name == "436F" ? "\x1bP1+r436F=323536\x1b\\" : "\x1bP0+r\x1b\\";
+				}
+				in.erase(0, end + 2);
+			} else {
+				break;
+			}
+		}
+		this_thread::sleep_for(rtt);
+		if (!out.empty() && write(master, out.data(), out.length()) < 0) {
+			return;
+		}
+	}
+}
+
+static void testProbe(const prtty::term &term, const string &dir) {
+	typedef prtty::probe_result::State State;
+
+	// reply formats skip delays, but only ones tputs would take
+	{
+		typedef prtty::impl::ReplyPattern Pattern;
+		Pattern pattern;
+		Pattern::Match m;
+		const string padded = "\x1b[7R", junk = "\x1b[$<5x>7R";
+		check(pattern.compile("\x1b[%d$<5/>R") && pattern.match(padded.data(), padded.data() + padded.length(), m) == Pattern::Result::MATCH && m.args[0] == 7,
+			"probe: delay in a reply format");
+		check(pattern.compile("\x1b[$<5x>%dR") && pattern.match(junk.data(), junk.data() + junk.length(), m) == Pattern::Result::MATCH && m.args[0] == 7,
+			"probe: malformed delay is literal");
+	}
+
+	// fed by hand: split replies, and keys around them
+	{
+		prtty::prober p(term);
+		size_t pos = p.cursorPosition();
+		size_t da = p.deviceAttributes();
+		check(p.request() == "\x1b[6n\x1b[c" && p.request().empty(), "probe: one request for the batch");
+		string text;
+		auto pass = [&](const char *bytes, size_t length) { text.append(bytes, length); };
+		auto feed = [&](const string &bytes) { p.feed(bytes.data(), bytes.length(), pass); };
+		feed("ab\x1b[A\x1b[1");
+		check(text == "ab\x1b[A" && p.result(pos).state == State::PENDING, "probe: partial reply held back");
+		feed("2;3Rc\x1b[?6");
+		check(p.result(pos).state == State::ANSWERED && p.result(pos).args[0] == 11 && p.result(pos).args[1] == 2,
+			"probe: cursor position");
+		feed("2;22c\x1b");
+		check(p.result(da).state == State::ANSWERED && p.result(da).text == "62;22" && p.result(da).nargs == 2
+			&& p.result(da).args[1] == 22, "probe: device attributes");
+		p.expire(pass);
+		check(text == "ab\x1b[Ac\x1b" && p.done(), "probe: the rest passed through once done");
+	}
+
+	// the linux entry's user8 is its own reply, not a pattern
+	{
+		prtty::prober p(prtty::get("linux", dir));
+		size_t da = p.deviceAttributes();
+		p.request();
+		p.feed("\x1b[?1;2c", 7, [](const char *, size_t) {});
+		check(p.result(da).state == State::ANSWERED && p.result(da).text == "1;2", "probe: literal reply format");
+	}
+
+	int master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+		cout << "(no pty, skipping probe tests)" << endl;
+		return;
+	}
+	int slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+	struct termios raw;
+	tcgetattr(slave, &raw);
+	cfmakeraw(&raw);
+	tcsetattr(slave, TCSANOW, &raw);
+
+	const chrono::milliseconds rtt(50);
+	auto run = [&](bool tcap, function<void()> body) {
+		atomic<bool> stop(false);
+		thread t(standIn, master, rtt, tcap, ref(stop));
+		body();
+		stop = true;
+		t.join();
+	};
+
+	// three queries in one round trip, against one after another
+	run(true, [&]() {
+		string text;
+		auto pass = [&](const char *bytes, size_t length) { text.append(bytes, length); };
+
+		auto start = chrono::steady_clock::now();
+		prtty::prober p(term);
+		size_t pos = p.cursorPosition();
+		size_t colors = p.capability("Co");
+		size_t missing = p.capability("xx");
+		size_t da = p.deviceAttributes();
+		p.exchange(slave, pass);
+		auto pipelined = chrono::steady_clock::now() - start;
+
+		check(p.result(pos).state == State::ANSWERED && p.result(pos).args[0] == 4 && p.result(pos).args[1] == 9,
+			"probe (pty): cursor position");
+		check(p.result(colors).state == State::ANSWERED && p.result(colors).text == "256", "probe (pty): XTGETTCAP");
+		check(p.result(missing).state == State::UNSUPPORTED, "probe (pty): XTGETTCAP of an unknown capability");
+		check(p.result(da).state == State::ANSWERED && p.result(da).args[0] == 64, "probe (pty): device attributes");
+		check(text == "x", "probe (pty): typed keys passed through");
+
+		start = chrono::steady_clock::now();
+		for (int i = 0; i < 3; i++) {
+			prtty::prober one(term);
+			one.cursorPosition();
+			one.exchange(slave, pass);
+		}
+		auto serial = chrono::steady_clock::now() - start;
+		check(pipelined < rtt * 2 && serial >= rtt * 3, "probe (pty): a batch takes one round trip");
+	});
+
+	// unanswered queries are given up on as soon as a later one's answered
+	run(false, [&]() {
+		auto start = chrono::steady_clock::now();
+		prtty::prober p(term);
+		size_t colors = p.capability("Co", chrono::seconds(10));
+		size_t da = p.deviceAttributes(chrono::seconds(10));
+		p.exchange(slave, [](const char *, size_t) {});
+		check(p.result(colors).state == State::UNANSWERED && p.result(da).state == State::ANSWERED
+			&& chrono::steady_clock::now() - start < chrono::seconds(5), "probe (pty): settled by a later reply");
+
+		prtty::prober q(term);
+		size_t alone = q.capability("Co", chrono::milliseconds(100));
+		q.exchange(slave, [](const char *, size_t) {});
+		check(q.result(alone).state == State::TIMED_OUT, "probe (pty): timeout");
+	});
+
+	close(slave);
+	close(master);
+}
+
+static void testColor(const prtty::term &term, const string &dir) {
+	prtty::color_quantizer q(term);
+	check(q.colors() == 256 && !q.direct(), "color: from max_colors");
+	check(q.foreground(196) == string(term.set_a_foreground(196)) && q.background(3) == string(term.set_a_background(3)),
+		"color: sequences evaluated up front");
+
+	// the same answers as searching the whole palette
+	for (int colors : {16, 256}) {
+		prtty::color_quantizer p(colors);
+		vector<prtty::rgb> row;
+		bool same = true;
+		for (int r = 0; r < 256; r += 5) {
+			for (int g = 0; g < 256; g += 7) {
+				for (int b = 0; b < 256; b += 11) {
+					prtty::rgb c = {uint8_t(r), uint8_t(g), uint8_t(b)};
+					same = same && p.nearest(c) == prtty::impl::nearestColor(colors, c);
+					row.push_back(c);
+				}
+			}
+		}
+		check(same, "color: nearest of " + to_string(colors) + " as by exhaustive search");
+
+		vector<uint8_t> batch(row.size() + 1, 0xEE);
+		p.quantize(row.data(), batch.data(), row.size());
+		bool agree = batch.back() == 0xEE;
+		for (size_t i = 0; i < row.size(); i++) {
+			agree = agree && batch[i] == p.nearest(row[i]);
+		}
+		check(agree, "color: batch of " + to_string(colors));
+	}
+
+	prtty::color_quantizer mono(2, {prtty::rgb{0, 0, 0}, prtty::rgb{255, 255, 255}});
+	check(mono.nearest(prtty::rgb{200, 180, 190}) == 1 && mono.nearest(prtty::rgb{40, 90, 10}) == 0, "color: own palette");
+
+	prtty::color_quantizer none(prtty::get("vt100", dir));
+	check(none.colors() == 0 && none.nearest(prtty::rgb{255, 0, 0}) == 0 && none.foreground(0).empty(), "color: no colors");
+
+	// a palette bigger than the terminal's colors is cut down to them
+	vector<prtty::rgb> big;
+	for (int i = 0; i < 256; i++) {
+		big.push_back(prtty::impl::paletteColor(256, i));
+	}
+	prtty::term linux = prtty::get("linux", dir);
+	prtty::color_quantizer few(linux, big);
+	check(few.colors() == linux.max_colors && few.nearest(big[200]) < linux.max_colors && few.foreground(200).empty(), "color: own palette within max_colors");
+	prtty::color_quantizer noneOwn(prtty::get("vt100", dir), big);
+	check(noneOwn.colors() == 0 && noneOwn.nearest(big[200]) == 0, "color: own palette without colors");
+
+	// built from one term on several threads at once
+	const string fg = term.set_a_foreground(196);
+	atomic<int> wrong(0);
+	vector<thread> threads;
+	for (int i = 0; i < 4; i++) {
+		threads.emplace_back([&]() {
+			for (int n = 0; n < 20; n++) {
+				prtty::color_quantizer mine(term);
+				wrong += mine.foreground(196) != fg;
+			}
+		});
+	}
+	for (auto &t : threads) {
+		t.join();
+	}
+	check(wrong == 0, "color: quantizers built on several threads");
+}
+
+static void testBatch() {
+	for (auto backend : {prtty::batch_writer::Backend::URING, prtty::batch_writer::Backend::EPOLL}) {
+		prtty::batch_writer out(backend);
+		const string what = string("batch (") + (out.backend() == prtty::batch_writer::Backend::URING ? "io_uring" : "epoll") + "): ";
+
+		const int count = 8;
+		int masters[count], slaves[count];
+		for (int i = 0; i < count; i++) {
+			masters[i] = posix_openpt(O_RDWR | O_NOCTTY);
+			if (masters[i] < 0 || grantpt(masters[i]) != 0 || unlockpt(masters[i]) != 0) {
+				cout << "(no pty, skipping batch tests)" << endl;
+				return;
+			}
+			slaves[i] = open(ptsname(masters[i]), O_RDWR | O_NOCTTY | O_NONBLOCK);
+			struct termios raw;
+			tcgetattr(slaves[i], &raw);
+			cfmakeraw(&raw);
+			tcsetattr(slaves[i], TCSANOW, &raw);
+		}
+
+		// one client is gone
+		close(masters[count - 1]);
+
+		auto a = make_shared<const string>("frame one;");
+		auto b = make_shared<const string>(string(3000, 'b'));
+		auto c = make_shared<const string>("frame three");
+		for (auto f : {a, b, c}) {
+			for (int i = 0; i < count; i++) {
+				out.write(slaves[i], f);
+			}
+		}
+
+		check(out.wait(chrono::milliseconds(2000)), what + "all writes finish");
+		check(out.errors() == 1, what + "closed client is an error");
+
+		bool ok = true;
+		for (int i = 0; i < count - 1; i++) {
+			string got;
+			while (drain(masters[i], got, 4096, 50) > 0);
+			ok = ok && got == *a + *b + *c;
+		}
+		check(ok, what + "frames arrive whole and in order on every fd");
+
+		// one client stalls while short-lived frames, likely reusing
+		// each other's addresses, go out to another
+		auto stalled = make_shared<const string>(string(512 * 1024, 's'));
+		out.write(slaves[0], stalled);
+		stalled.reset();
+
+		ok = true;
+		for (int i = 0; i < 32; i++) {
+			out.write(slaves[1], make_shared<const string>(string(200, static_cast<char>('a' + i % 26))));
+			for (int tries = 0; out.pending() > 1 && tries < 2000; tries++) {
+				out.wait(chrono::milliseconds(1));
+			}
+			string got;
+			while (got.length() < 200 && drain(masters[1], got, 4096, 50) > 0);
+			ok = ok && got == string(200, static_cast<char>('a' + i % 26));
+		}
+		check(ok, what + "frames freed while another fd stalls arrive intact");
+
+		string rest;
+		for (int tries = 0; rest.length() < 512 * 1024 && tries < 2000; tries++) {
+			out.submit();
+			drain(masters[0], rest, 4096, 1);
+		}
+		check(out.wait(chrono::milliseconds(2000)) && rest == string(512 * 1024, 's'), what + "stalled client catches up");
+
+		for (int i = 0; i < count; i++) {
+			close(slaves[i]);
+			if (i < count - 1) {
+				close(masters[i]);
+			}
+		}
+
+		// a stalled fd is forgotten and closed, and its number comes
+		// straight back from the next socketpair(). a write still in
+		// flight fails with EPIPE, as it would for any socket server.
+		signal(SIGPIPE, SIG_IGN);
+		int before[2], after[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, before) != 0) {
+			check(false, what + "socketpair");
+			continue;
+		}
+		out.write(before[0], make_shared<const string>(string(4 << 20, 'x')));
+		for (int i = 0; i < 4; i++) {
+			out.wait(chrono::milliseconds(5));
+		}
+		check(out.pending() == 1, what + "write to an unread socket stalls");
+		out.forget(before[0]);
+		close(before[0]);
+		close(before[1]);
+
+		if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, after) != 0) {
+			check(false, what + "socketpair");
+			continue;
+		}
+		const size_t errors = out.errors();
+		auto reused = make_shared<const string>(string(4 << 20, 'r'));
+		out.write(after[0], reused);
+		rest.clear();
+		for (int tries = 0; rest.length() < reused->length() && tries < 20000; tries++) {
+			out.submit();
+			drain(after[1], rest, 4096, 1);
+		}
+		check(after[0] == before[0], what + "socketpair reuses the forgotten fd");
+		check(out.wait(chrono::milliseconds(2000)) && rest == *reused, what + "reused fd gets only its own frame");
+		check(out.pending() == 0 && out.errors() == errors, what + "forgotten fd leaves nothing behind");
+
+		// closed with nothing pending but without forget(): the reused
+		// number has fallen out of the epoll set and is added back
+		close(after[0]);
+		close(after[1]);
+		if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, after) != 0) {
+			check(false, what + "socketpair");
+			continue;
+		}
+		out.write(after[0], reused);
+		rest.clear();
+		for (int tries = 0; rest.length() < reused->length() && tries < 20000; tries++) {
+			out.submit();
+			drain(after[1], rest, 4096, 1);
+		}
+		check(out.wait(chrono::milliseconds(2000)) && rest == *reused && out.errors() == errors, what + "fd reused without forget() still stalls and resumes");
+		out.forget(after[0]);
+		close(after[0]);
+		close(after[1]);
+	}
+}
+
+static void paintPane(prtty::region_output &out) {
+	const prtty::term &t = out.terminal();
+	const prtty::region &r = out.bounds();
+	for (int row = 0; row < r.rows; row++) {
+		out.moveTo(row, 0);
+		out.put(t.set_a_foreground, (r.row + row + r.col) % 256);
+		out << "pane " << r.row << "," << r.col << " line " << row;
+		out << t.exit_attribute_mode;
+	}
+}
+
+static void testRender(const prtty::term &term) {
+	// a 6x5 grid of panes, like a busy multiplexer
+	vector<prtty::region> panes;
+	for (int y = 0; y < 6; y++) {
+		for (int x = 0; x < 5; x++) {
+			panes.push_back({y * 8, x * 40, 8, 40});
+		}
+	}
+
+	// what a plain single-threaded renderer would write
+	string expected;
+	for (auto &r : panes) {
+		expected += term.cursor_address(r.row, r.col);
+		for (int row = 0; row < r.rows; row++) {
+			expected += term.cursor_address(r.row + row, r.col);
+			expected += term.set_a_foreground((r.row + row + r.col) % 256);
+			expected += "pane " + to_string(r.row) + "," + to_string(r.col) + " line " + to_string(row);
+			expected += term.exit_attribute_mode;
+		}
+	}
+
+	for (unsigned threads : {1u, 4u}) {
+		prtty::parallel_renderer renderer(term, threads);
+		bool same = true;
+		for (int frame = 0; frame < 20; frame++) {
+			renderer.render(panes, paintPane);
+			same = same && renderer.str() == expected;
+		}
+		check(same, "render: " + to_string(threads) + " threads match single-threaded output");
+		check(renderer.length() == expected.length(), "render: length");
+	}
+
+	prtty::parallel_renderer renderer(term, 3);
+	renderer.render(panes, paintPane);
+	int pipes[2];
+	if (pipe(pipes) == 0) {
+		renderer.write(pipes[1]);
+		close(pipes[1]);
+		string got;
+		char buf[4096];
+		ssize_t n;
+		while ((n = read(pipes[0], buf, sizeof(buf))) > 0) {
+			got.append(buf, static_cast<size_t>(n));
+		}
+		close(pipes[0]);
+		check(got == expected, "render: writev output matches");
+	}
+
+	bool threw = false;
+	try {
+		renderer.render(panes, [](prtty::region_output &out) {
+			if (out.bounds().row == 16) {
+				throw prtty::PrttyError("pane failed");
+			}
+		});
+	} catch (const prtty::PrttyError &) {
+		threw = true;
+	}
+	check(threw, "render: errors in a region reach the caller");
+}
+
+static void testInput(const prtty::term &term) {
+	prtty::input in(term);
+
+	check(decode(in, "hello\x1bOAworld") == "hello<key_up>world", "input: key between text");
+	check(decode(in, "\x1b[15~\x1b[3~\x7f") == "<key_f5><key_dc>\x7f", "input: adjacent keys");
+	check(decode(in, "\x1b[Zq") == "<key_btab>q", "input: back tab");
+
+	// sequence split across reads
+	check(decode(in, "ab\x1b[1") == "ab" && in.pending(), "input: split sequence is held back");
+	check(decode(in, "5~cd") == "<key_f5>cd" && !in.pending(), "input: split sequence completes");
+
+	// lone escape resolves as text once it expires
+	check(decode(in, "\x1b") == "" && in.timeout() >= 0, "input: lone escape is pending");
+	string expired;
+	in.expire([&](const prtty::key_event &ev) { expired += string(ev.bytes, ev.length); });
+	check(expired == "\x1b" && in.timeout() == -1, "input: lone escape expires as text");
+
+	// unknown escapes pass through as text
+	check(decode(in, "\x1b[99qx") == "\x1b[99qx", "input: unknown sequence is text");
+
+	string big(1000, 'x');
+	check(decode(in, big + "\x1bOB" + big) == big + "<key_down>" + big, "input: long text runs");
+}
+
 int main(int argc, char **argv) {
 	(void) argc;
 
@@ -49,5 +1511,36 @@ int main(int argc, char **argv) {
 	ss << endl;
 	cout << ss.str();
 
-	return 0;
+	testEvaluation(term);
+	testCopy(term);
+	testBatchEvaluation(term);
+	testCapabilityNames(term);
+#	ifdef PRTTY_METRICS
+	testMetrics(term);
+#	endif
+	testRecognizer(term);
+	testInput(term);
+	testMouse(term);
+	testRender(term);
+	testWriter();
+	testBatch();
+	if (argc >= 2) {
+		testAssign(term, argv[1]);
+		testRecognizerChars(argv[1]);
+		testTranslate(term, argv[1]);
+		testFanout(term, argv[1]);
+		testDatabase(argv[1]);
+		testIntegral(argv[1]);
+		testPadding(argv[1]);
+		testSearchPath(argv[1]);
+		testProbe(term, argv[1]);
+		testColor(term, argv[1]);
+		testReload(argv[1]);
+		testFrame(term, argv[1]);
+#		ifdef PRTTY_TRACE
+		testTrace(argv[1]);
+#		endif
+	}
+
+	return failures == 0 ? 0 : 1;
 }